@@ -0,0 +1,42 @@
+#!/bin/bash
+# Writes a synthetic program with many functions to stdout, used to measure
+# lexing and compilation throughput.
+# usage: gen_large.sh [function count]
+
+awk -v count="${1:-20000}" '
+# Aquila names are alphabetic, so function numbers are spelled with a-j.
+function name(n) {
+    s = sprintf("%d", n)
+    gsub(/0/, "a", s); gsub(/1/, "b", s); gsub(/2/, "c", s)
+    gsub(/3/, "d", s); gsub(/4/, "e", s); gsub(/5/, "f", s)
+    gsub(/6/, "g", s); gsub(/7/, "h", s); gsub(/8/, "i", s)
+    gsub(/9/, "j", s)
+    return "f" s
+}
+
+BEGIN {
+    for (i = 0; i < count; i++) {
+        print "func " name(i) "(a: integer, b: integer): integer {"
+        print "    let x: integer = a * 3 + b;"
+        print "    let y: integer = x - a / 2;"
+        print "    if (y > 100) {"
+        print "        y = y - 100;"
+        print "    }"
+        # Never taken at run time, but every call is a name lookup.
+        if (i > 0) {
+            print "    if (a < 0) {"
+            print "        y = " name(i - 1) "(b, a);"
+            print "    }"
+        }
+        print "    while (x > 10) {"
+        print "        x = x / 2;"
+        print "    }"
+        print "    return x + y;"
+        print "}"
+        print ""
+    }
+    print "func main(): integer {"
+    print "    print(" name(count - 1) "(7, 11));"
+    print "    return 0;"
+    print "}"
+}'
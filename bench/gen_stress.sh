@@ -0,0 +1,69 @@
+#!/bin/bash
+# Writes a program that stresses one compiler table to stdout.
+# usage: gen_stress.sh locals|depth|functions [size]
+#
+#   locals     one function with size locals (default 100000)
+#   depth      an expression nested size levels deep (default 10000)
+#   functions  size functions that each call the previous one (default
+#              100000)
+
+awk -v kind="$1" -v size="$2" '
+# Aquila names are alphabetic, so numbers are spelled with a-j.
+function name(prefix, n) {
+    s = sprintf("%d", n)
+    gsub(/0/, "a", s); gsub(/1/, "b", s); gsub(/2/, "c", s)
+    gsub(/3/, "d", s); gsub(/4/, "e", s); gsub(/5/, "f", s)
+    gsub(/6/, "g", s); gsub(/7/, "h", s); gsub(/8/, "i", s)
+    gsub(/9/, "j", s)
+    return prefix s
+}
+
+BEGIN {
+    if (kind == "locals") {
+        count = size != "" ? size : 100000
+        print "func main(): integer {"
+        print "    let " name("v", 0) ": integer = 1;"
+        for (i = 1; i < count; i++) {
+            print "    let " name("v", i) ": integer = " name("v", i - 1) " + 1;"
+        }
+        print "    print(" name("v", count - 1) ");"
+        print "    return 0;"
+        print "}"
+    } else if (kind == "depth") {
+        count = size != "" ? size : 10000
+        print "func main(): integer {"
+        print "    let x: integer = 1;"
+        line = "    print("
+        for (i = 0; i < count; i++) {
+            line = line "x + ("
+        }
+        line = line "0"
+        for (i = 0; i < count; i++) {
+            line = line ")"
+        }
+        print line ");"
+        print "    return 0;"
+        print "}"
+    } else if (kind == "functions") {
+        count = size != "" ? size : 100000
+        # Only the last few functions run, the rest are just compiled.
+        print "func " name("f", 0) "(n: integer): integer {"
+        print "    return n;"
+        print "}"
+        for (i = 1; i < count; i++) {
+            print "func " name("f", i) "(n: integer): integer {"
+            print "    if (n > 0) {"
+            print "        return " name("f", i - 1) "(n - 1) + 1;"
+            print "    }"
+            print "    return 0;"
+            print "}"
+        }
+        print "func main(): integer {"
+        print "    print(" name("f", count - 1) "(10));"
+        print "    return 0;"
+        print "}"
+    } else {
+        print "usage: gen_stress.sh locals|depth|functions [size]" > "/dev/stderr"
+        exit 1
+    }
+}'
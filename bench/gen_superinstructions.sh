@@ -0,0 +1,80 @@
+#!/bin/bash
+# Picks the opcode sequences worth a superinstruction from the output of
+# aquila --trace-pairs and writes src/superinstructions.h to stdout.
+#
+# usage: gen_superinstructions.sh <profile>...
+#
+# Each profile counts for the same, whatever its length: a sequence scores
+# the fraction of its program's instructions it ran, summed over the
+# programs, times the dispatches it saves. Only the last opcode of a
+# sequence may jump, call or return.
+#
+# Environment:
+#   SUPERINSTRUCTIONS  how many sequences to pick (default 12)
+limit=${SUPERINSTRUCTIONS:-12}
+
+if [ $# -eq 0 ]; then
+    echo "usage: gen_superinstructions.sh <profile>..." >&2
+    exit 1
+fi
+
+awk -v limit="$limit" '
+FNR == 1 { total = 0 }
+/ instructions$/ { total = $1 }
+$1 ~ /^[0-9]+$/ && NF >= 3 && total > 0 {
+    straight = 1
+    for (i = 2; i < NF; i++) {
+        if ($i ~ /^(EXIT|JUMP.*|CALL|RETURN|TAIL_CALL)$/) {
+            straight = 0
+        }
+    }
+    if (!straight || $NF == "EXIT") {
+        next
+    }
+    sequence = $2
+    for (i = 3; i <= NF; i++) {
+        sequence = sequence " " $i
+    }
+    score[sequence] += $1 / total * (NF - 2)
+}
+END {
+    for (sequence in score) {
+        printf "%.9f %s\n", score[sequence], sequence
+    }
+}' "$@" | sort -k1,1gr -k2 | head -n "$limit" | awk '
+{
+    name = "SUPER"
+    operands = ""
+    for (i = 2; i <= NF; i++) {
+        name = name "_" $i
+        operands = operands ", " $i
+    }
+    entry = "X(" name operands ")"
+    if (NF == 3) {
+        pairs[++pair_count] = entry
+    } else {
+        triples[++triple_count] = entry
+    }
+}
+function emit(macro, entries, count) {
+    printf "#define %s(X)", macro
+    for (i = 1; i <= count; i++) {
+        printf " \\\n\t%s", entries[i]
+    }
+    printf "\n"
+}
+END {
+    print "// Generated by bench/gen_superinstructions.sh from the opcode"
+    print "// sequences the benchmarks run most. Run make superinstructions to"
+    print "// regenerate it."
+    print "#ifndef SUPERINSTRUCTIONS_H"
+    print "#define SUPERINSTRUCTIONS_H"
+    print ""
+    print "// X(name, first, second), naming the opcodes without OP_."
+    emit("SUPERINSTRUCTION_PAIRS", pairs, pair_count)
+    print ""
+    print "// X(name, first, second, third)"
+    emit("SUPERINSTRUCTION_TRIPLES", triples, triple_count)
+    print ""
+    print "#endif"
+}'
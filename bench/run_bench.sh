@@ -0,0 +1,111 @@
+#!/bin/bash
+# Runs every benchmark program several times, reports the median wall time
+# and the interpreted instructions per second, writes the results as JSON
+# and compares them against a stored baseline. The large program measures
+# the compiler rather than the interpreter, so it reports compiled
+# functions per second instead.
+#
+# usage: run_bench.sh [--update-baseline] [aquila options...]
+#
+# Environment:
+#   RUNS       runs per benchmark (default 5)
+#   THRESHOLD  allowed slowdown against the baseline in percent (default 15)
+#   BASELINE   baseline file (default bench/baseline.json)
+#   RESULTS    results file (default bench/results.json)
+cd $(dirname $0)
+
+aquila=../src/aquila
+runs=${RUNS:-5}
+threshold=${THRESHOLD:-15}
+baseline=${BASELINE:-baseline.json}
+results=${RESULTS:-results.json}
+
+update_baseline=0
+if [ "$1" = "--update-baseline" ]; then
+    update_baseline=1
+    shift
+fi
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+large_functions=20000
+./gen_large.sh $large_functions > "$workdir/large.aq"
+
+programs="fib.aq loop.aq calls.aq print.aq integers.aq $workdir/large.aq"
+
+now_ns() {
+    date +%s%N
+}
+
+median() {
+    sort -n | awk '{ a[NR] = $1 } END { print a[int((NR + 1) / 2)] }'
+}
+
+status=0
+printf '%-8s %12s %22s %16s %10s\n' benchmark "median ms" work "per second" \
+    baseline
+echo '{' > "$results"
+echo '  "benchmarks": [' >> "$results"
+first=1
+for program in $programs
+do
+    name=$(basename "$program" .aq)
+
+    if [ "$name" = large ]; then
+        unit=functions
+        work=$large_functions
+    else
+        unit=instructions
+        work=$("$aquila" "$program" --profile "$@" 2>&1 >/dev/null |
+            sed -n 's/^\([0-9]*\) instructions.*/\1/p')
+    fi
+
+    times=""
+    for ((i = 0; i < runs; i++))
+    do
+        start=$(now_ns)
+        "$aquila" "$program" "$@" > /dev/null
+        end=$(now_ns)
+        times="$times $(( (end - start) / 1000 ))"
+    done
+    median_us=$(echo $times | tr ' ' '\n' | median)
+    median_ms=$(awk -v us="$median_us" 'BEGIN { printf "%.3f", us / 1000 }')
+    rate=$(awk -v n="$work" -v us="$median_us" \
+        'BEGIN { rate = 0; if (us > 0) rate = n / (us / 1e6); printf "%.0f", rate }')
+
+    comparison="-"
+    if [ -f "$baseline" ]; then
+        old_ms=$(sed -n "s/.*\"name\": \"$name\".*\"median_ms\": \([0-9.]*\).*/\1/p" \
+            "$baseline")
+        if [ -n "$old_ms" ]; then
+            comparison=$(awk -v new="$median_ms" -v old="$old_ms" \
+                'BEGIN { printf "%+.1f%%", (new - old) / old * 100 }')
+            if awk -v new="$median_ms" -v old="$old_ms" -v t="$threshold" \
+                'BEGIN { exit !(new > old * (1 + t / 100)) }'; then
+                comparison="$comparison REGRESSION"
+                status=1
+            fi
+        fi
+    fi
+
+    printf '%-8s %12s %22s %16s %10s\n' "$name" "$median_ms" "$work $unit" \
+        "$rate" "$comparison"
+
+    if [ $first -eq 0 ]; then
+        echo ',' >> "$results"
+    fi
+    first=0
+    printf '    {"name": "%s", "runs": %d, "median_ms": %s, "%s": %s, "%s_per_second": %s}' \
+        "$name" "$runs" "$median_ms" "$unit" "${work:-0}" "$unit" "$rate" \
+        >> "$results"
+done
+printf '\n  ]\n}\n' >> "$results"
+
+if [ $update_baseline -eq 1 ]; then
+    cp "$results" "$baseline"
+    echo "Baseline updated: $baseline"
+    status=0
+elif [ $status -ne 0 ]; then
+    echo "Slower than the baseline by more than $threshold%"
+fi
+exit $status
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Compiles and runs the gen_stress.sh programs under a time and memory
+# limit, and fails if any of them does not finish cleanly.
+#
+# Environment:
+#   TIME_LIMIT    seconds per program (default 10)
+#   MEMORY_LIMIT  virtual memory per program in KiB (default 1048576)
+cd $(dirname $0)
+
+aquila=../src/aquila
+time_limit=${TIME_LIMIT:-10}
+memory_limit=${MEMORY_LIMIT:-1048576}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+status=0
+printf '%-10s %10s %8s\n' program ms result
+for kind in locals depth functions
+do
+    ./gen_stress.sh $kind > "$workdir/$kind.aq"
+    start=$(date +%s%N)
+    (ulimit -v "$memory_limit"; timeout "$time_limit" "$aquila" \
+        "$workdir/$kind.aq" "$@" > /dev/null)
+    result=$?
+    end=$(date +%s%N)
+    if [ $result -eq 0 ]; then
+        outcome=ok
+    else
+        outcome="FAILED ($result)"
+        status=1
+    fi
+    printf '%-10s %10s %8s\n' "$kind" $(( (end - start) / 1000000 )) \
+        "$outcome"
+done
+exit $status
@@ -1,58 +1,213 @@
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "arena.h"
+#include "bytecode.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "inliner.h"
 #include "interpreter.h"
+#include "ir.h"
+#include "jit.h"
 #include "lexer.h"
+#include "lower.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "passes.h"
+#include "profiler.h"
+#include "regvm.h"
+#include "source.h"
+#include "symbol.h"
+#include "transpiler.h"
 
-char *read_source(char *path) {
-	FILE *file = fopen(path, "r");
-	if (file == NULL) {
-		perror("fopen");
-		exit(EXIT_SUCCESS);
-	}
+typedef struct Options {
+	bool only_compile;
+	bool emit_c;
+	bool optimize;
+	int passes;
+	bool dump_ir;
+	int inline_size;
+	bool jit;
+	bool register_vm;
+	bool bench;
+	bool profile;
+	bool trace_pairs;
+	bool memoize;
+	int max_depth;
+	char *output;
+} Options;
 
-	fseek(file, 0, SEEK_END);
-	long fsize = ftell(file);
-	fseek(file, 0, SEEK_SET);
+static double elapsed_ms(struct timespec *start, struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e3 +
+	       (end->tv_nsec - start->tv_nsec) / 1e6;
+}
 
-	char *source = malloc(fsize + 1);
-	fread(source, fsize, 1, file);
-	source[fsize] = '\0';
+static void bench(Chunk *chunk, FunctionList *flist, int max_depth) {
+	struct timespec start, middle, registers, end;
 
-	fclose(file);
+	Interpreter interpreter;
+	init_interpreter(&interpreter, chunk, flist, max_depth);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	interpret(&interpreter);
+	flush_output(&interpreter.output);
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+	free_interpreter(&interpreter);
+
+	init_interpreter(&interpreter, chunk, flist, max_depth);
+	register_interpret(&interpreter, flist);
+	flush_output(&interpreter.output);
+	clock_gettime(CLOCK_MONOTONIC, &registers);
+	free_interpreter(&interpreter);
+
+	init_interpreter(&interpreter, chunk, flist, max_depth);
+	jit_interpret(&interpreter, flist);
+	flush_output(&interpreter.output);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free_interpreter(&interpreter);
 
-	return source;
+	double interpreter_ms = elapsed_ms(&start, &middle);
+	double register_ms = elapsed_ms(&middle, &registers);
+	double jit_ms = elapsed_ms(&registers, &end);
+	fprintf(stderr, "interpreter: %10.3f ms\n", interpreter_ms);
+	fprintf(stderr, "register vm: %10.3f ms (including translation)\n",
+		register_ms);
+	fprintf(stderr, "jit:         %10.3f ms (including compilation)\n",
+		jit_ms);
+	fprintf(stderr, "speedup:     %10.2fx\n", interpreter_ms / jit_ms);
 }
 
-void run(char *source, bool only_compile) {
-	Lexer lexer;
-	init_lexer(&lexer, source);
+static void execute(Chunk *chunk, FunctionList *flist, Options *options) {
+	if (options->only_compile) {
+		print_chunk(chunk);
+		if (options->register_vm) {
+			printf("== Register code ==\n");
+			print_register_code(stdout, chunk, flist);
+		}
+	} else if (options->emit_c) {
+		emit_c(stdout, chunk, flist);
+	} else if (options->bench) {
+		bench(chunk, flist, options->max_depth);
+	} else {
+		Interpreter interpreter;
+		init_interpreter(&interpreter, chunk, flist,
+				 options->max_depth);
+		if (options->profile || options->trace_pairs) {
+			// Only the interpreter can be profiled.
+			Profiler profiler;
+			init_profiler(&profiler, chunk, flist);
+			if (options->trace_pairs) {
+				trace_sequences(&profiler);
+			}
+			interpreter.profiler = &profiler;
+			interpret(&interpreter);
+			flush_output(&interpreter.output);
+			if (options->trace_pairs) {
+				print_sequences(stderr, &profiler);
+			} else {
+				print_profile(stderr, &profiler);
+			}
+			free_profiler(&profiler);
+		} else if (options->jit) {
+			jit_interpret(&interpreter, flist);
+		} else if (options->register_vm) {
+			register_interpret(&interpreter, flist);
+		} else if (options->memoize) {
+			// Only the interpreter memoizes.
+			Memoizer memoizer;
+			init_memoizer(&memoizer, chunk, flist);
+			interpreter.memoizer = &memoizer;
+			interpret(&interpreter);
+			flush_output(&interpreter.output);
+			print_memo_stats(stderr, &memoizer);
+			free_memoizer(&memoizer);
+		} else {
+			interpret(&interpreter);
+		}
+		free_interpreter(&interpreter);
+	}
+}
+
+static void write_output(char *path, Chunk *chunk, FunctionList *flist,
+			 uint64_t source_hash) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	write_bytecode(file, chunk, flist, source_hash);
+	if (fclose(file) != 0) {
+		perror("fclose");
+		exit(EXIT_FAILURE);
+	}
+}
 
+// Runs a compiled .aqc file without lexing or compiling anything.
+static void run_bytecode(char *path, Options *options) {
+	Arena arena;
+	init_arena(&arena);
 	Chunk chunk;
-	init_chunk(&chunk);
+	FunctionList flist;
+	BytecodeFile bytecode;
+	load_bytecode(&bytecode, path, &chunk, &flist, &arena);
+	execute(&chunk, &flist, options);
+	free_arena(&arena);
+	unload_bytecode(&bytecode);
+}
 
+void run(Source *source, Options *options) {
+	Arena arena;
+	init_arena(&arena);
+	SymbolTable symbols;
+	init_symbol_table(&symbols, &arena);
+	Lexer lexer;
+	init_lexer(&lexer, source->text, source->length, &symbols);
+
+	// The IR is only needed until it is lowered.
+	Arena ir_arena;
+	init_arena(&ir_arena);
+	IrProgram program;
+	init_ir_program(&program, &ir_arena);
 	Compiler compiler;
-	init_compiler(&compiler, &lexer, &chunk);
+	init_compiler(&compiler, &lexer, &program, &arena);
 	compile(&compiler);
-	free_compiler(&compiler);
-
-	if (only_compile) {
-		print_chunk(&chunk);
-		free_chunk(&chunk);
+	if (options->optimize) {
+		run_passes(&program, options->passes);
+	}
+	if (options->dump_ir) {
+		print_ir_program(stdout, &program, &compiler.flist);
+		free_arena(&ir_arena);
+		free_arena(&arena);
 		return;
 	}
 
-	Interpreter interpreter;
-	init_interpreter(&interpreter, &chunk);
+	Chunk chunk;
+	init_chunk(&chunk);
+	lower_program(&program, &compiler.flist, &chunk);
+	free_arena(&ir_arena);
 
-	interpret(&interpreter);
+	if (options->only_compile && options->optimize) {
+		printf("== Before optimization ==\n");
+		print_chunk(&chunk);
+		printf("== After optimization ==\n");
+	}
+	if (options->optimize) {
+		inline_calls(&chunk, &compiler.flist, options->inline_size);
+		optimize_chunk(&chunk, &compiler.flist);
+	}
+
+	if (options->output != NULL) {
+		write_output(options->output, &chunk, &compiler.flist,
+			     hash_source(source->text, source->length));
+	} else {
+		execute(&chunk, &compiler.flist, options);
+	}
 
 	free_chunk(&chunk);
-	free_interpreter(&interpreter);
+	free_arena(&arena);
 }
 
 int main(int argc, char *argv[]) {
@@ -61,14 +216,79 @@ int main(int argc, char *argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
-	bool only_compile = false;
+	Options options;
+	options.only_compile = false;
+	options.emit_c = false;
+	options.optimize = true;
+	options.passes = ALL_PASSES;
+	options.dump_ir = false;
+	options.inline_size = DEFAULT_INLINE_SIZE;
+	options.jit = false;
+	options.register_vm = false;
+	options.bench = false;
+	options.profile = false;
+	options.trace_pairs = false;
+	options.memoize = false;
+	options.max_depth = DEFAULT_MAX_DEPTH;
+	options.output = NULL;
 	for (int i = 2; i < argc; i++) {
 		if (strcmp(argv[i], "-C") == 0) {
-			only_compile = true;
+			options.only_compile = true;
+		} else if (strcmp(argv[i], "--emit-c") == 0) {
+			options.emit_c = true;
+		} else if (strcmp(argv[i], "--no-optimize") == 0) {
+			options.optimize = false;
+		} else if (strcmp(argv[i], "--dump-ir") == 0) {
+			options.dump_ir = true;
+		} else if (strncmp(argv[i], "--passes=", 9) == 0) {
+			if (!parse_passes(argv[i] + 9, &options.passes)) {
+				fprintf(stderr, "Unknown pass in: %s\n",
+					argv[i] + 9);
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			options.jit = true;
+		} else if (strcmp(argv[i], "--register-vm") == 0) {
+			options.register_vm = true;
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			options.bench = true;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			options.profile = true;
+		} else if (strcmp(argv[i], "--trace-pairs") == 0) {
+			options.trace_pairs = true;
+		} else if (strcmp(argv[i], "--memoize") == 0) {
+			options.memoize = true;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			options.output = argv[++i];
+		} else if (strncmp(argv[i], "--inline=", 9) == 0) {
+			char *end;
+			long size = strtol(argv[i] + 9, &end, 10);
+			if (*end != '\0' || end == argv[i] + 9 || size < 0 ||
+			    size > INT_MAX) {
+				fprintf(stderr, "Invalid inline size: %s\n",
+					argv[i] + 9);
+				exit(EXIT_FAILURE);
+			}
+			options.inline_size = (int) size;
+		} else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+			char *end;
+			long depth = strtol(argv[i] + 12, &end, 10);
+			if (*end != '\0' || end == argv[i] + 12 || depth <= 0 ||
+			    depth > INT_MAX) {
+				fprintf(stderr, "Invalid maximum depth: %s\n",
+					argv[i] + 12);
+				exit(EXIT_FAILURE);
+			}
+			options.max_depth = (int) depth;
 		}
 	}
 
-	char *source = read_source(argv[1]);
-	run(source, only_compile);
-	free(source);
+	if (is_bytecode_file(argv[1])) {
+		run_bytecode(argv[1], &options);
+		return 0;
+	}
+	Source source;
+	load_source(&source, argv[1]);
+	run(&source, &options);
+	free_source(&source);
 }
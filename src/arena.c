@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct ArenaBlock {
+	ArenaBlock *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+static size_t align_size(size_t size);
+static ArenaBlock *add_block(Arena *arena, size_t size);
+
+void init_arena(Arena *arena) {
+	arena->blocks = NULL;
+	arena->last = NULL;
+}
+
+void free_arena(Arena *arena) {
+	ArenaBlock *block = arena->blocks;
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	init_arena(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+	size = align_size(size);
+	ArenaBlock *block = arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		block = add_block(arena, size);
+	}
+	void *memory = (char *) block->data + block->used;
+	block->used += size;
+	arena->last = memory;
+	return memory;
+}
+
+// Grows the most recent allocation in place when its block has room, and
+// copies it into a new allocation otherwise. The old memory is only
+// reclaimed with the rest of the arena.
+void *arena_resize(Arena *arena, void *memory, size_t old_size,
+		   size_t new_size) {
+	if (memory == NULL) {
+		return arena_alloc(arena, new_size);
+	}
+
+	ArenaBlock *block = arena->blocks;
+	size_t old_aligned = align_size(old_size);
+	size_t new_aligned = align_size(new_size);
+	if (memory == arena->last &&
+	    block->size - block->used + old_aligned >= new_aligned) {
+		block->used += new_aligned - old_aligned;
+		return memory;
+	}
+
+	void *resized = arena_alloc(arena, new_size);
+	memcpy(resized, memory, old_size < new_size ? old_size : new_size);
+	return resized;
+}
+
+static size_t align_size(size_t size) {
+	return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+// Allocations larger than a block get a block of their own.
+static ArenaBlock *add_block(Arena *arena, size_t size) {
+	size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+	ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+	if (block == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	block->next = arena->blocks;
+	block->size = block_size;
+	block->used = 0;
+	arena->blocks = block;
+	return block;
+}
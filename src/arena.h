@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump-pointer allocator. Allocations are never freed one by one; the
+// whole arena is released at once when the data it holds is no longer
+// needed.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock *blocks;
+	// The most recent allocation, which can grow in place.
+	void *last;
+} Arena;
+
+void init_arena(Arena *arena);
+void free_arena(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_resize(Arena *arena, void *memory, size_t old_size,
+		   size_t new_size);
+
+#endif
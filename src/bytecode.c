@@ -0,0 +1,283 @@
+#include "bytecode.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include "type.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t code_size(uint32_t code_length);
+static void validate_code(const char *path, Chunk *chunk,
+			  FunctionList *flist);
+static bool has_code_target(OpCode op_code);
+static void write_or_fail(FILE *file, const void *data, size_t size);
+static void invalid_file(const char *path, const char *reason);
+
+// 64-bit FNV-1a.
+uint64_t hash_source(const char *source, size_t length) {
+	uint64_t hash = 0xcbf29ce484222325u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char) source[i];
+		hash *= 0x100000001b3u;
+	}
+	return hash;
+}
+
+void write_bytecode(FILE *file, Chunk *chunk, FunctionList *flist,
+		    uint64_t source_hash) {
+	BytecodeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+	header.version = BYTECODE_VERSION;
+	header.endianness = BYTECODE_ENDIANNESS;
+	header.code_length = chunk->length;
+	header.function_count = flist->count;
+	header.source_hash = source_hash;
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		header.parameter_type_count += f->parameter_count;
+		header.names_size += f->name.length;
+	}
+
+	write_or_fail(file, &header, sizeof(header));
+	write_or_fail(file, chunk->code, chunk->length);
+	static const uint8_t padding[4] = {0};
+	write_or_fail(file, padding, code_size(chunk->length) - chunk->length);
+
+	uint32_t first_parameter_type = 0;
+	uint32_t name_offset = 0;
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		BytecodeFunction entry;
+		entry.index = f->index;
+		entry.return_type = f->return_type;
+		entry.parameter_count = f->parameter_count;
+		entry.first_parameter_type = first_parameter_type;
+		entry.name_offset = name_offset;
+		entry.name_length = f->name.length;
+		write_or_fail(file, &entry, sizeof(entry));
+		first_parameter_type += f->parameter_count;
+		name_offset += f->name.length;
+	}
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		for (int j = 0; j < f->parameter_count; j++) {
+			uint32_t type = f->parameter_types[j];
+			write_or_fail(file, &type, sizeof(type));
+		}
+	}
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		write_or_fail(file, f->name.start, f->name.length);
+	}
+}
+
+// Only regular files are sniffed: reading the magic from a pipe would eat
+// the start of the program.
+bool is_bytecode_file(const char *path) {
+	struct stat status;
+	if (stat(path, &status) != 0 || !S_ISREG(status.st_mode)) {
+		return false;
+	}
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	char magic[4];
+	bool is_bytecode = fread(magic, sizeof(magic), 1, file) == 1 &&
+			   memcmp(magic, BYTECODE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return is_bytecode;
+}
+
+// Maps the file and points the chunk straight at the code in the mapping,
+// so only the pages that run are ever read. Only the small function table
+// is copied out.
+void load_bytecode(BytecodeFile *bytecode, const char *path, Chunk *chunk,
+		   FunctionList *flist, Arena *arena) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		perror("fstat");
+		exit(EXIT_FAILURE);
+	}
+	size_t size = status.st_size;
+	if (size < sizeof(BytecodeHeader)) {
+		invalid_file(path, "truncated header");
+	}
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	const BytecodeHeader *header = mapping;
+	if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0) {
+		invalid_file(path, "bad magic");
+	}
+	if (header->endianness != BYTECODE_ENDIANNESS) {
+		invalid_file(path, "written with a different byte order");
+	}
+	if (header->version != BYTECODE_VERSION) {
+		invalid_file(path, "unsupported version");
+	}
+
+	// The sizes are 32-bit, so none of these sums can overflow.
+	uint64_t padded_code_size = code_size(header->code_length);
+	uint64_t functions_size =
+	    (uint64_t) header->function_count * sizeof(BytecodeFunction);
+	uint64_t types_size =
+	    (uint64_t) header->parameter_type_count * sizeof(uint32_t);
+	uint64_t expected_size = sizeof(BytecodeHeader) + padded_code_size +
+				 functions_size + types_size +
+				 header->names_size;
+	if (expected_size != size) {
+		invalid_file(path, "wrong size");
+	}
+
+	uint8_t *bytes = mapping;
+	uint8_t *code = bytes + sizeof(BytecodeHeader);
+	const BytecodeFunction *functions =
+	    (const BytecodeFunction *) (code + padded_code_size);
+	const uint32_t *types =
+	    (const uint32_t *) ((uint8_t *) functions + functions_size);
+	char *names = (char *) types + types_size;
+
+	chunk->code = code;
+	chunk->length = header->code_length;
+	chunk->capacity = header->code_length;
+
+	init_function_list(flist, arena);
+	for (uint32_t i = 0; i < header->function_count; i++) {
+		const BytecodeFunction *entry = &functions[i];
+		if (entry->index >= header->code_length ||
+		    entry->return_type > TY_BOOLEAN ||
+		    (uint64_t) entry->first_parameter_type +
+			    entry->parameter_count >
+			header->parameter_type_count ||
+		    (uint64_t) entry->name_offset + entry->name_length >
+			header->names_size) {
+			invalid_file(path, "bad function table");
+		}
+
+		Function *f = add_function(flist);
+		f->name.type = TT_NAME;
+		f->name.start = names + entry->name_offset;
+		f->name.length = entry->name_length;
+		f->name.symbol = -1;
+		f->return_type = entry->return_type;
+		f->index = entry->index;
+		for (uint32_t j = 0; j < entry->parameter_count; j++) {
+			uint32_t type = types[entry->first_parameter_type + j];
+			if (type > TY_BOOLEAN) {
+				invalid_file(path, "bad parameter type");
+			}
+			add_parameter_type(flist, f, type);
+		}
+	}
+	validate_code(path, chunk, flist);
+	// Purity is not stored, but the code tells.
+	infer_purity(chunk, flist);
+
+	bytecode->mapping = mapping;
+	bytecode->size = size;
+	bytecode->source_hash = header->source_hash;
+}
+
+void unload_bytecode(BytecodeFile *bytecode) {
+	munmap(bytecode->mapping, bytecode->size);
+}
+
+// Everything that runs the code trusts it to decode: every opcode is
+// known, every instruction ends within the code, every jump lands on an
+// instruction and every call on a function.
+static void validate_code(const char *path, Chunk *chunk,
+			  FunctionList *flist) {
+	// 1 where an instruction starts, 2 where a function does.
+	uint8_t *starts = calloc(chunk->length, 1);
+	int index = 0;
+	while (index < chunk->length) {
+		OpCode op_code = chunk->code[index];
+		if (op_code >= OP_CODE_COUNT) {
+			invalid_file(path, "bad opcode");
+		}
+		if (encoded_instruction_size(op_code) > chunk->length - index) {
+			invalid_file(path, "truncated instruction");
+		}
+		starts[index] = 1;
+		index += encoded_instruction_size(op_code);
+	}
+	for (int i = 0; i < flist->count; i++) {
+		int start = flist->functions[i].index;
+		if (starts[start] == 0) {
+			invalid_file(path, "bad function table");
+		}
+		starts[start] = 2;
+	}
+
+	index = 0;
+	while (index < chunk->length) {
+		Instruction instruction;
+		index = decode_instruction(chunk, index, &instruction);
+		if (!has_code_target(instruction.op_code)) {
+			continue;
+		}
+		uint32_t target = instruction.operands[0];
+		if (target >= (uint32_t) chunk->length || starts[target] == 0) {
+			invalid_file(path, "bad jump target");
+		}
+		if ((instruction.op_code == OP_CALL ||
+		     instruction.op_code == OP_TAIL_CALL) &&
+		    starts[target] != 2) {
+			invalid_file(path, "bad call target");
+		}
+	}
+	free(starts);
+}
+
+static bool has_code_target(OpCode op_code) {
+	switch (op_code) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// The code is padded so that the tables after it stay aligned.
+static uint64_t code_size(uint32_t code_length) {
+	return ((uint64_t) code_length + 3) & ~(uint64_t) 3;
+}
+
+static void write_or_fail(FILE *file, const void *data, size_t size) {
+	if (size > 0 && fwrite(data, size, 1, file) != 1) {
+		perror("fwrite");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void invalid_file(const char *path, const char *reason) {
+	fprintf(stderr, "%s: invalid bytecode file: %s\n", path, reason);
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,58 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "chunk.h"
+#include "function.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A compiled program as stored in an .aqc file. The header is followed by
+// the code, padded to a multiple of four bytes, the function table, the
+// parameter types of all functions and finally their names. Everything is
+// in the byte order of the machine that wrote the file.
+
+#define BYTECODE_MAGIC "AQC"
+#define BYTECODE_VERSION 3
+#define BYTECODE_ENDIANNESS 0x01020304u
+
+typedef struct BytecodeHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t endianness;
+	uint32_t code_length;
+	uint32_t function_count;
+	uint32_t parameter_type_count;
+	uint32_t names_size;
+	uint32_t reserved;
+	// Lets tools tell whether the file is stale against its source.
+	uint64_t source_hash;
+} BytecodeHeader;
+
+typedef struct BytecodeFunction {
+	uint32_t index;
+	uint32_t return_type;
+	uint32_t parameter_count;
+	uint32_t first_parameter_type;
+	uint32_t name_offset;
+	uint32_t name_length;
+} BytecodeFunction;
+
+// A loaded .aqc file. The chunk's code and the function names point into
+// the read-only mapping.
+typedef struct BytecodeFile {
+	void *mapping;
+	size_t size;
+	uint64_t source_hash;
+} BytecodeFile;
+
+uint64_t hash_source(const char *source, size_t length);
+void write_bytecode(FILE *file, Chunk *chunk, FunctionList *flist,
+		    uint64_t source_hash);
+bool is_bytecode_file(const char *path);
+void load_bytecode(BytecodeFile *bytecode, const char *path, Chunk *chunk,
+		   FunctionList *flist, Arena *arena);
+void unload_bytecode(BytecodeFile *bytecode);
+
+#endif
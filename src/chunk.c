@@ -1,39 +1,88 @@
 #include "chunk.h"
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 const int AQ_UNIT = 0;
 const int AQ_TRUE = 1;
 const int AQ_FALSE = 0;
 
+typedef enum OperandKind {
+	OPERAND_NONE,
+	OPERAND_U8,
+	OPERAND_I8,
+	OPERAND_U32,
+} OperandKind;
+
+// How each operand of every encoded opcode is stored.
+static const uint8_t operand_kinds[][MAX_OPERANDS] = {
+    [OP_PUSH] = {OPERAND_I8},
+    [OP_LOAD] = {OPERAND_U8},
+    [OP_STORE] = {OPERAND_U8},
+    [OP_SHIFT_LEFT] = {OPERAND_U8},
+    [OP_DIV_SHIFT] = {OPERAND_U8},
+    [OP_DIV_MULTIPLY] = {OPERAND_U32, OPERAND_U8},
+    [OP_JUMP] = {OPERAND_U32},
+    [OP_JUMP_IF_FALSE] = {OPERAND_U32},
+    [OP_CALL] = {OPERAND_U32, OPERAND_U8},
+    [OP_RETURN] = {OPERAND_U8},
+    [OP_TAIL_CALL] = {OPERAND_U32, OPERAND_U8},
+    [OP_POP_N] = {OPERAND_U8},
+    [OP_INCREMENT] = {OPERAND_U8, OPERAND_I8},
+    [OP_JUMP_IF_NOT_EQUAL] = {OPERAND_U32},
+    [OP_JUMP_IF_EQUAL] = {OPERAND_U32},
+    [OP_JUMP_IF_NOT_LESS] = {OPERAND_U32},
+    [OP_JUMP_IF_NOT_LESS_EQUAL] = {OPERAND_U32},
+    [OP_JUMP_IF_NOT_GREATER] = {OPERAND_U32},
+    [OP_JUMP_IF_NOT_GREATER_EQUAL] = {OPERAND_U32},
+    [OP_PUSH_WIDE] = {OPERAND_U32},
+    [OP_LOAD_WIDE] = {OPERAND_U32},
+    [OP_STORE_WIDE] = {OPERAND_U32},
+    [OP_CALL_WIDE] = {OPERAND_U32, OPERAND_U32},
+    [OP_RETURN_WIDE] = {OPERAND_U32},
+    [OP_TAIL_CALL_WIDE] = {OPERAND_U32, OPERAND_U32},
+    [OP_POP_N_WIDE] = {OPERAND_U32},
+    [OP_INCREMENT_WIDE] = {OPERAND_U32, OPERAND_U32},
+};
+
+static OpCode encoded_op_code(Instruction *instruction);
+static OpCode wide_op_code(OpCode op_code);
+static OpCode decoded_op_code(OpCode op_code);
+static bool operand_fits(OperandKind kind, uint32_t operand);
+static int operand_size(OperandKind kind);
+
 void init_chunk(Chunk *chunk) {
-	chunk->code = malloc(4 * sizeof(uint32_t));
+	chunk->code = malloc(16);
 	chunk->length = 0;
-	chunk->capacity = 4;
+	chunk->capacity = 16;
 }
 
 void free_chunk(Chunk *chunk) {
 	free(chunk->code);
 }
 
-void write_into_chunk(Chunk *chunk, uint32_t word) {
+void write_into_chunk(Chunk *chunk, uint8_t byte) {
 	if (chunk->length == chunk->capacity) {
 		chunk->capacity *= 2;
-		chunk->code =
-		    realloc(chunk->code, chunk->capacity * sizeof(uint32_t));
+		chunk->code = realloc(chunk->code, chunk->capacity);
 	}
-	chunk->code[chunk->length] = word;
+	chunk->code[chunk->length] = byte;
 	chunk->length++;
 }
 
+// Reserves a four-byte operand to be filled in later by patch_chunk.
 int reserve_place_in_chunk(Chunk *chunk) {
-	if (chunk->length == chunk->capacity) {
-		chunk->capacity *= 2;
-		chunk->code =
-		    realloc(chunk->code, chunk->capacity * sizeof(uint32_t));
+	int index = chunk->length;
+	for (int i = 0; i < 4; i++) {
+		write_into_chunk(chunk, 0);
 	}
-        return chunk->length++;
+	return index;
+}
+
+void patch_chunk(Chunk *chunk, int index, uint32_t value) {
+	memcpy(&chunk->code[index], &value, sizeof(value));
 }
 
 void print_chunk(Chunk *chunk) {
@@ -43,85 +92,291 @@ void print_chunk(Chunk *chunk) {
 	}
 }
 
-int print_op_code(Chunk *chunk, int index) {
-	printf("%-8d", index);
-	switch (chunk->code[index]) {
+void write_instruction(Chunk *chunk, Instruction *instruction) {
+	OpCode op_code = encoded_op_code(instruction);
+	write_into_chunk(chunk, op_code);
+	int count = op_code_operand_count(op_code);
+	for (int i = 0; i < count; i++) {
+		uint32_t operand = instruction->operands[i];
+		int size = operand_size(operand_kinds[op_code][i]);
+		for (int j = 0; j < size; j++) {
+			write_into_chunk(chunk, 0);
+		}
+		uint8_t *bytes = &chunk->code[chunk->length - size];
+		if (size == 1) {
+			bytes[0] = (uint8_t) operand;
+		} else {
+			memcpy(bytes, &operand, sizeof(operand));
+		}
+	}
+}
+
+// The number of bytes write_instruction takes for the instruction.
+int instruction_size(Instruction *instruction) {
+	return encoded_instruction_size(encoded_op_code(instruction));
+}
+
+// The number of bytes an instruction takes in the chunk, given the opcode
+// it is encoded with.
+int encoded_instruction_size(OpCode op_code) {
+	int size = 1;
+	int count = op_code_operand_count(op_code);
+	for (int i = 0; i < count; i++) {
+		size += operand_size(operand_kinds[op_code][i]);
+	}
+	return size;
+}
+
+// Decodes the instruction at index into its short form and returns the
+// index of the next one.
+int decode_instruction(Chunk *chunk, int index, Instruction *instruction) {
+	OpCode op_code = chunk->code[index++];
+	instruction->op_code = decoded_op_code(op_code);
+	int count = op_code_operand_count(op_code);
+	for (int i = 0; i < count; i++) {
+		uint8_t *bytes = &chunk->code[index];
+		switch (operand_kinds[op_code][i]) {
+			case OPERAND_U8:
+				instruction->operands[i] = bytes[0];
+				index += 1;
+				break;
+			case OPERAND_I8:
+				instruction->operands[i] =
+				    (uint32_t) (int32_t) (int8_t) bytes[0];
+				index += 1;
+				break;
+			default:
+				instruction->operands[i] = read_u32(bytes);
+				index += 4;
+				break;
+		}
+	}
+	return index;
+}
+
+// The short form if every operand fits it, the wide form otherwise.
+static OpCode encoded_op_code(Instruction *instruction) {
+	OpCode op_code = instruction->op_code;
+	int count = op_code_operand_count(op_code);
+	for (int i = 0; i < count; i++) {
+		if (!operand_fits(operand_kinds[op_code][i],
+				  instruction->operands[i])) {
+			return wide_op_code(op_code);
+		}
+	}
+	return op_code;
+}
+
+static OpCode wide_op_code(OpCode op_code) {
+	switch (op_code) {
+		case OP_PUSH:
+			return OP_PUSH_WIDE;
+		case OP_LOAD:
+			return OP_LOAD_WIDE;
+		case OP_STORE:
+			return OP_STORE_WIDE;
+		case OP_CALL:
+			return OP_CALL_WIDE;
+		case OP_RETURN:
+			return OP_RETURN_WIDE;
+		case OP_TAIL_CALL:
+			return OP_TAIL_CALL_WIDE;
+		case OP_POP_N:
+			return OP_POP_N_WIDE;
+		case OP_INCREMENT:
+			return OP_INCREMENT_WIDE;
+		default:
+			return op_code;
+	}
+}
+
+static OpCode decoded_op_code(OpCode op_code) {
+	switch (op_code) {
+		case OP_PUSH_WIDE:
+			return OP_PUSH;
+		case OP_LOAD_WIDE:
+			return OP_LOAD;
+		case OP_STORE_WIDE:
+			return OP_STORE;
+		case OP_CALL_WIDE:
+			return OP_CALL;
+		case OP_RETURN_WIDE:
+			return OP_RETURN;
+		case OP_TAIL_CALL_WIDE:
+			return OP_TAIL_CALL;
+		case OP_POP_N_WIDE:
+			return OP_POP_N;
+		case OP_INCREMENT_WIDE:
+			return OP_INCREMENT;
+		default:
+			return op_code;
+	}
+}
+
+static bool operand_fits(OperandKind kind, uint32_t operand) {
+	switch (kind) {
+		case OPERAND_U8:
+			return operand <= UINT8_MAX;
+		case OPERAND_I8: {
+			int32_t value = (int32_t) operand;
+			return value >= INT8_MIN && value <= INT8_MAX;
+		}
+		default:
+			return true;
+	}
+}
+
+static int operand_size(OperandKind kind) {
+	return kind == OPERAND_U32 ? 4 : 1;
+}
+
+const char *op_code_name(OpCode op_code) {
+	switch (op_code) {
 		case OP_NOOP:
-			printf("NOOP\n");
-			return index + 1;
+			return "NOOP";
 		case OP_EXIT:
-			printf("EXIT\n");
-			return index + 1;
+			return "EXIT";
 		case OP_POP:
-			printf("POP\n");
-			return index + 1;
+			return "POP";
 		case OP_PUSH:
-			printf("PUSH %d\n", chunk->code[index + 1]);
-			return index + 2;
+			return "PUSH";
 		case OP_LOAD:
-			printf("LOAD %d\n", chunk->code[index + 1]);
-			return index + 2;
+			return "LOAD";
 		case OP_STORE:
-			printf("STORE %d\n", chunk->code[index + 1]);
-			return index + 2;
+			return "STORE";
 		case OP_PRINT_UNIT:
-			printf("PRINT_UNIT\n");
-			return index + 1;
+			return "PRINT_UNIT";
 		case OP_PRINT_INTEGER:
-			printf("PRINT_INTEGER\n");
-			return index + 1;
+			return "PRINT_INTEGER";
 		case OP_PRINT_BOOLEAN:
-			printf("PRINT_BOOLEAN\n");
-			return index + 1;
+			return "PRINT_BOOLEAN";
 		case OP_ADD:
-			printf("ADD\n");
-			return index + 1;
+			return "ADD";
 		case OP_SUB:
-			printf("SUB\n");
-			return index + 1;
+			return "SUB";
 		case OP_MUL:
-			printf("MUL\n");
-			return index + 1;
+			return "MUL";
 		case OP_DIV:
-			printf("DIV\n");
-			return index + 1;
+			return "DIV";
 		case OP_NEGATE:
-			printf("NEGATE\n");
-			return index + 1;
+			return "NEGATE";
+		case OP_SHIFT_LEFT:
+			return "SHIFT_LEFT";
+		case OP_DIV_SHIFT:
+			return "DIV_SHIFT";
+		case OP_DIV_MULTIPLY:
+			return "DIV_MULTIPLY";
 		case OP_EQUAL:
-			printf("EQUAL\n");
-			return index + 1;
+			return "EQUAL";
 		case OP_NOT_EQUAL:
-			printf("NOT_EQUAL\n");
-			return index + 1;
+			return "NOT_EQUAL";
 		case OP_LESS:
-			printf("LESS\n");
-			return index + 1;
+			return "LESS";
 		case OP_LESS_EQUAL:
-			printf("LESS_EQUAL\n");
-			return index + 1;
+			return "LESS_EQUAL";
 		case OP_GREATER:
-			printf("GREATER\n");
-			return index + 1;
+			return "GREATER";
 		case OP_GREATER_EQUAL:
-			printf("GREATER_EQUAL\n");
-			return index + 1;
+			return "GREATER_EQUAL";
 		case OP_JUMP:
-			printf("JUMP %d\n", chunk->code[index + 1]);
-			return index + 2;
+			return "JUMP";
 		case OP_JUMP_IF_FALSE:
-			printf("JUMP_IF_FALSE %d\n", chunk->code[index + 1]);
-			return index + 2;
+			return "JUMP_IF_FALSE";
 		case OP_CALL:
-			printf("CALL %d %d\n", chunk->code[index + 1],
-			       chunk->code[index + 2]);
-			return index + 3;
+			return "CALL";
+		case OP_RETURN:
+			return "RETURN";
+		case OP_TAIL_CALL:
+			return "TAIL_CALL";
+		case OP_POP_N:
+			return "POP_N";
+		case OP_INCREMENT:
+			return "INCREMENT";
+		case OP_JUMP_IF_NOT_EQUAL:
+			return "JUMP_IF_NOT_EQUAL";
+		case OP_JUMP_IF_EQUAL:
+			return "JUMP_IF_EQUAL";
+		case OP_JUMP_IF_NOT_LESS:
+			return "JUMP_IF_NOT_LESS";
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+			return "JUMP_IF_NOT_LESS_EQUAL";
+		case OP_JUMP_IF_NOT_GREATER:
+			return "JUMP_IF_NOT_GREATER";
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			return "JUMP_IF_NOT_GREATER_EQUAL";
+		case OP_PUSH_WIDE:
+			return "PUSH_WIDE";
+		case OP_LOAD_WIDE:
+			return "LOAD_WIDE";
+		case OP_STORE_WIDE:
+			return "STORE_WIDE";
+		case OP_CALL_WIDE:
+			return "CALL_WIDE";
+		case OP_RETURN_WIDE:
+			return "RETURN_WIDE";
+		case OP_TAIL_CALL_WIDE:
+			return "TAIL_CALL_WIDE";
+		case OP_POP_N_WIDE:
+			return "POP_N_WIDE";
+		case OP_INCREMENT_WIDE:
+			return "INCREMENT_WIDE";
+		default:
+			return NULL;
+	}
+}
+
+int op_code_operand_count(OpCode op_code) {
+	switch (op_code) {
+		case OP_PUSH:
+		case OP_LOAD:
+		case OP_STORE:
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
 		case OP_RETURN:
-			printf("RETURN %d\n", chunk->code[index + 1]);
-			return index + 2;
+		case OP_POP_N:
+		case OP_SHIFT_LEFT:
+		case OP_DIV_SHIFT:
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+		case OP_PUSH_WIDE:
+		case OP_LOAD_WIDE:
+		case OP_STORE_WIDE:
+		case OP_RETURN_WIDE:
+		case OP_POP_N_WIDE:
+			return 1;
+		case OP_CALL:
+		case OP_TAIL_CALL:
+		case OP_INCREMENT:
+		case OP_DIV_MULTIPLY:
+		case OP_CALL_WIDE:
+		case OP_TAIL_CALL_WIDE:
+		case OP_INCREMENT_WIDE:
+			return 2;
 		default:
-			printf("UNKNOWN OP: %d", chunk->code[index]);
-                        return index + 1;
-			break;
+			return 0;
+	}
+}
+
+int print_op_code(Chunk *chunk, int index) {
+	printf("%-8d", index);
+	OpCode op_code = chunk->code[index];
+	const char *name = op_code_name(op_code);
+	if (name == NULL) {
+		printf("UNKNOWN OP: %d\n", op_code);
+		return index + 1;
+	}
+
+	Instruction instruction;
+	int next_index = decode_instruction(chunk, index, &instruction);
+	printf("%s", name);
+	int count = op_code_operand_count(op_code);
+	for (int i = 0; i < count; i++) {
+		printf(" %d", (int) instruction.operands[i]);
 	}
+	printf("\n");
+	return next_index;
 }
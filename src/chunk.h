@@ -2,6 +2,7 @@
 #define CHUNK_H
 
 #include <inttypes.h>
+#include <string.h>
 
 typedef enum OpCode {
 	OP_NOOP,
@@ -21,6 +22,10 @@ typedef enum OpCode {
 	OP_MUL,
 	OP_DIV,
 	OP_NEGATE,
+	// Multiplication and division by constants, see below
+	OP_SHIFT_LEFT,
+	OP_DIV_SHIFT,
+	OP_DIV_MULTIPLY,
 
 	OP_EQUAL,
 	OP_NOT_EQUAL,
@@ -34,22 +39,86 @@ typedef enum OpCode {
 
 	OP_CALL,
 	OP_RETURN,
+	OP_TAIL_CALL,
+
+	// Fused by the optimizer
+	OP_POP_N,
+	OP_INCREMENT,
+	OP_JUMP_IF_NOT_EQUAL,
+	OP_JUMP_IF_EQUAL,
+	OP_JUMP_IF_NOT_LESS,
+	OP_JUMP_IF_NOT_LESS_EQUAL,
+	OP_JUMP_IF_NOT_GREATER,
+	OP_JUMP_IF_NOT_GREATER_EQUAL,
+
+	// Only in the encoded chunk, never in a decoded Instruction
+	OP_PUSH_WIDE,
+	OP_LOAD_WIDE,
+	OP_STORE_WIDE,
+	OP_CALL_WIDE,
+	OP_RETURN_WIDE,
+	OP_TAIL_CALL_WIDE,
+	OP_POP_N_WIDE,
+	OP_INCREMENT_WIDE,
 } OpCode;
 
+#define OP_CODE_COUNT (OP_INCREMENT_WIDE + 1)
+#define MAX_OPERANDS 2
+
+typedef struct Instruction {
+	OpCode op_code;
+	uint32_t operands[MAX_OPERANDS];
+} Instruction;
+
+// The code is a byte stream. Every instruction starts with a one-byte
+// opcode. Local slots, pop counts, argument counts and immediates take a
+// single byte when they fit and the instruction uses its _WIDE opcode with
+// four-byte operands when they do not. Jump and call targets are always
+// four-byte absolute byte offsets, so they can be patched in place.
+// Multi-byte operands are unaligned and in host byte order.
 typedef struct Chunk {
-	uint32_t *code;
+	uint8_t *code;
 	int length;
 	int capacity;
 } Chunk;
 
+static inline uint32_t read_u32(const uint8_t *bytes) {
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+// Division by a constant power of two 2^shift, rounding towards zero like
+// OP_DIV: negative values are biased by 2^shift - 1 before the shift.
+static inline int divide_by_shift(int value, uint32_t shift) {
+	uint32_t bias = (uint32_t) (value >> 31) >> (32 - shift);
+	return (int) ((uint32_t) value + bias) >> shift;
+}
+
+// Division by a constant d of at least 2, given magic = ceil(2^(32 + shift)
+// / d) as computed by the IR's strength reduction. The 64-bit product cannot
+// overflow, and rounding it down is one too low for negative values.
+static inline int divide_by_multiply(int value, uint32_t magic,
+				     uint32_t shift) {
+	int quotient = (int) ((int64_t) value * magic >> (32 + shift));
+	return quotient + (int) ((uint32_t) value >> 31);
+}
+
 extern const int AQ_UNIT;
 extern const int AQ_TRUE;
 extern const int AQ_FALSE;
 
 void init_chunk(Chunk *chunk);
 void free_chunk(Chunk *chunk);
-void write_into_chunk(Chunk *chunk, uint32_t word);
+void write_into_chunk(Chunk *chunk, uint8_t byte);
 int reserve_place_in_chunk(Chunk *chunk);
+void patch_chunk(Chunk *chunk, int index, uint32_t value);
+void write_instruction(Chunk *chunk, Instruction *instruction);
+int instruction_size(Instruction *instruction);
+int encoded_instruction_size(OpCode op_code);
+int decode_instruction(Chunk *chunk, int index, Instruction *instruction);
+const char *op_code_name(OpCode op_code);
+int op_code_operand_count(OpCode op_code);
 void print_chunk(Chunk *chunk);
 int print_op_code(Chunk *chunk, int index);
 
@@ -2,10 +2,10 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include "chunk.h"
 #include "compiler.h"
+#include "ir.h"
 #include "lexer.h"
 #include "token.h"
 #include "type.h"
@@ -36,33 +36,46 @@ static void compile_name(Compiler *compiler, Token token);
 static void compile_call(Compiler *compiler, Token token);
 static void compile_negation(Compiler *compiler);
 
+static int *find_function_symbol(Compiler *compiler, int symbol);
+static int parse_integer(Token *token);
+
 static void error(Compiler *compiler);
 static Token match(Compiler *compiler, TokenType type);
 
-static void push_type(Compiler *compiler, Type type);
-static Type pop_type(Compiler *compiler);
-static void match_type(Compiler *compiler, Type expected);
+static void emit_constant(Compiler *compiler, Type type, int value);
+static void emit_binary(Compiler *compiler, IrOp op, Operand left,
+			Operand right, Type result_type);
+static bool simplify_binary(Compiler *compiler, IrOp op, Operand left,
+			    Operand right);
+static bool constant_value(Compiler *compiler, Operand operand, int *value);
+
+static void push_type(Compiler *compiler, Type type, int value, bool is_pure);
+static void push_operand(Compiler *compiler, Operand operand);
+static Operand pop_type(Compiler *compiler);
+static Operand match_type(Compiler *compiler, Type expected);
 static void type_error(Type expected, Type found);
 
-void init_compiler(Compiler *compiler, Lexer *lexer, Chunk *chunk) {
+// Everything the compiler allocates, including the function list it hands
+// on, lives in the arena and is released with it. The IR it builds lives in
+// the program's arena instead.
+void init_compiler(Compiler *compiler, Lexer *lexer, IrProgram *program,
+		   Arena *arena) {
 	compiler->lexer = lexer;
-	compiler->chunk = chunk;
-	init_variable_stack(&compiler->variable_stack);
-	init_function_list(&compiler->flist);
+	compiler->program = program;
+	init_ir_builder(&compiler->builder, program->arena);
+	compiler->arena = arena;
+	init_variable_stack(&compiler->variable_stack, arena);
+	init_function_list(&compiler->flist, arena);
+	compiler->function_symbols = NULL;
+	compiler->function_symbol_capacity = 0;
+	compiler->type_stack = arena_alloc(arena, 64 * sizeof(Operand));
 	compiler->type_stackSize = 0;
-}
-
-void free_compiler(Compiler *compiler) {
-	free_variable_stack(&compiler->variable_stack);
-        free_function_list(&compiler->flist);
+	compiler->type_stack_capacity = 64;
+	compiler->arguments = arena_alloc(arena, 16 * sizeof(int));
+	compiler->argument_capacity = 16;
 }
 
 void compile(Compiler *compiler) {
-	write_into_chunk(compiler->chunk, OP_CALL);
-        int main_function_index = reserve_place_in_chunk(compiler->chunk);
-	write_into_chunk(compiler->chunk, 0);
-	write_into_chunk(compiler->chunk, OP_EXIT);
-
 	for (;;) {
 		Token token = peek_next_token(compiler->lexer);
 		if (token.type == TT_END) {
@@ -77,7 +90,6 @@ void compile(Compiler *compiler) {
 		fprintf(stderr, "No main function\n");
 		exit(EXIT_FAILURE);
 	}
-	compiler->chunk->code[main_function_index] = main->index;
 
 	// print_function_list(stdout, &compiler->flist);
 }
@@ -88,6 +100,11 @@ static void compile_function(Compiler *compiler) {
 
 	Token name = match(compiler, TT_NAME);
 	f->name = name;
+	// Calls resolve to the first function with a name.
+	int *function = find_function_symbol(compiler, name.symbol);
+	if (*function < 0) {
+		*function = compiler->flist.count - 1;
+	}
 
 	match(compiler, TT_LPAREN);
 	Token token = peek_next_token(compiler->lexer);
@@ -98,7 +115,7 @@ static void compile_function(Compiler *compiler) {
 
 		declare_variable(&compiler->variable_stack, name, type);
 		mark_initializied(&compiler->variable_stack);
-		add_parameter_type(f, type);
+		add_parameter_type(&compiler->flist, f, type);
 
 		for (;;) {
 			Token token = peek_next_token(compiler->lexer);
@@ -113,7 +130,7 @@ static void compile_function(Compiler *compiler) {
 
 			declare_variable(&compiler->variable_stack, name, type);
 			mark_initializied(&compiler->variable_stack);
-			add_parameter_type(f, type);
+			add_parameter_type(&compiler->flist, f, type);
 		}
 	}
 	match(compiler, TT_RPAREN);
@@ -122,10 +139,11 @@ static void compile_function(Compiler *compiler) {
 	Type return_type = compile_type(compiler);
 	f->return_type = return_type;
 
-	f->index = compiler->chunk->length;
+	begin_ir_function(&compiler->builder, f->parameter_count);
 	compile_block(compiler, return_type);
+	finish_ir_function(&compiler->builder, compiler->program);
 
-	compiler->variable_stack.variable_count = 0;
+	clear_variables(&compiler->variable_stack);
 }
 
 static void compile_statement(Compiler *compiler, Type type) {
@@ -165,8 +183,10 @@ static void compile_block(Compiler *compiler, Type type) {
 		compile_statement(compiler, type);
 	}
 	int pops = exit_block(&compiler->variable_stack);
-	for (int i = 0; i < pops; i++) {
-		write_into_chunk(compiler->chunk, OP_POP);
+	if (pops > 0) {
+		int pop = emit_ir(&compiler->builder, IR_POP, TY_UNIT, -1, -1,
+				  compiler->variable_stack.variable_count);
+		set_ir_count(&compiler->builder, pop, pops);
 	}
 	match(compiler, TT_RCURLY);
 }
@@ -176,11 +196,11 @@ static void compile_return(Compiler *compiler, Type type) {
 	compile_expression(compiler);
 	match(compiler, TT_SEMICOLON);
 
-        match_type(compiler, type);
-
-	write_into_chunk(compiler->chunk, OP_RETURN);
-	write_into_chunk(compiler->chunk,
-			 compiler->variable_stack.variable_count);
+	Operand operand = match_type(compiler, type);
+	int instruction = emit_ir(&compiler->builder, IR_RETURN, type,
+				  operand.value, -1, 0);
+	set_ir_count(&compiler->builder, instruction,
+		     compiler->variable_stack.variable_count);
 }
 
 static void compile_let(Compiler *compiler) {
@@ -191,12 +211,15 @@ static void compile_let(Compiler *compiler) {
 	Type type = compile_type(compiler);
 
 	declare_variable(&compiler->variable_stack, name, type);
+	int slot = compiler->variable_stack.variable_count - 1;
+	note_ir_slots(&compiler->builder, slot + 1);
 
 	match(compiler, TT_EQUAL);
 	compile_expression(compiler);
 	match(compiler, TT_SEMICOLON);
 
-        match_type(compiler, type);
+        Operand operand = match_type(compiler, type);
+	emit_ir(&compiler->builder, IR_LOCAL, type, operand.value, -1, slot);
 
 	mark_initializied(&compiler->variable_stack);
 }
@@ -209,9 +232,9 @@ static void compile_assignment(Compiler *compiler) {
 
 	int i = resolve_variable(&compiler->variable_stack, &name);
 	Variable *variable = &compiler->variable_stack.variables[i];
-	match_type(compiler, variable->type);
-	write_into_chunk(compiler->chunk, OP_STORE);
-	write_into_chunk(compiler->chunk, i);
+	Operand operand = match_type(compiler, variable->type);
+	emit_ir(&compiler->builder, IR_STORE, variable->type, operand.value, -1,
+		i);
 }
 
 static Type compile_type(Compiler *compiler) {
@@ -237,41 +260,36 @@ static void compile_print(Compiler *compiler) {
 	match(compiler, TT_RPAREN);
 	match(compiler, TT_SEMICOLON);
 
-	Type type = pop_type(compiler);
-	switch (type) {
-                case TY_UNIT:
-			write_into_chunk(compiler->chunk, OP_PRINT_UNIT);
-                        break;
-		case TY_INTEGER:
-			write_into_chunk(compiler->chunk, OP_PRINT_INTEGER);
-			break;
-		case TY_BOOLEAN:
-			write_into_chunk(compiler->chunk, OP_PRINT_BOOLEAN);
-			break;
-	}
+	Operand operand = pop_type(compiler);
+	emit_ir(&compiler->builder, IR_PRINT, operand.type, operand.value, -1,
+		0);
 }
 
 static void compile_if(Compiler *compiler, Type type) {
 	match(compiler, TT_IF);
 	compile_expression(compiler);
-	match_type(compiler, TY_BOOLEAN);
-	write_into_chunk(compiler->chunk, OP_JUMP_IF_FALSE);
-	int dest_index = reserve_place_in_chunk(compiler->chunk);
+	Operand condition = match_type(compiler, TY_BOOLEAN);
+	IrBuilder *builder = &compiler->builder;
+	int branch =
+	    emit_ir(builder, IR_BRANCH, TY_UNIT, condition.value, -1, 0);
+	patch_ir_target(builder, branch, 0, start_ir_block(builder));
 	compile_block(compiler, type);
-	compiler->chunk->code[dest_index] = compiler->chunk->length;
+	patch_ir_target(builder, branch, 1, start_ir_block(builder));
 }
 
 static void compile_while(Compiler *compiler, Type type) {
 	match(compiler, TT_WHILE);
-	int entry_index = compiler->chunk->length;
+	IrBuilder *builder = &compiler->builder;
+	int header = start_ir_block(builder);
 	compile_expression(compiler);
-	match_type(compiler, TY_BOOLEAN);
-	write_into_chunk(compiler->chunk, OP_JUMP_IF_FALSE);
-	int dest_index = reserve_place_in_chunk(compiler->chunk);
+	Operand condition = match_type(compiler, TY_BOOLEAN);
+	int branch =
+	    emit_ir(builder, IR_BRANCH, TY_UNIT, condition.value, -1, 0);
+	patch_ir_target(builder, branch, 0, start_ir_block(builder));
 	compile_block(compiler, type);
-	write_into_chunk(compiler->chunk, OP_JUMP);
-	write_into_chunk(compiler->chunk, entry_index);
-	compiler->chunk->code[dest_index] = compiler->chunk->length;
+	int jump = emit_ir(builder, IR_JUMP, TY_UNIT, -1, -1, 0);
+	patch_ir_target(builder, jump, 0, header);
+	patch_ir_target(builder, branch, 1, start_ir_block(builder));
 }
 
 static void compile_expression(Compiler *compiler) {
@@ -280,26 +298,26 @@ static void compile_expression(Compiler *compiler) {
 
 static void compile_comparison(Compiler *compiler) {
 	compile_addition_and_subtraction(compiler);
-	OpCode comparison;
+	IrOp comparison;
 	Token token = peek_next_token(compiler->lexer);
 	switch (token.type) {
 		case TT_DOUBLE_EQUAL:
-			comparison = OP_EQUAL;
+			comparison = IR_EQUAL;
 			break;
 		case TT_NOT_EQUAL:
-			comparison = OP_NOT_EQUAL;
+			comparison = IR_NOT_EQUAL;
 			break;
 		case TT_LESS:
-			comparison = OP_LESS;
+			comparison = IR_LESS;
 			break;
 		case TT_LESS_EQUAL:
-			comparison = OP_LESS_EQUAL;
+			comparison = IR_LESS_EQUAL;
 			break;
 		case TT_GREATER:
-			comparison = OP_GREATER;
+			comparison = IR_GREATER;
 			break;
 		case TT_GREATER_EQUAL:
-			comparison = OP_GREATER_EQUAL;
+			comparison = IR_GREATER_EQUAL;
 			break;
 		default:
 			return;
@@ -307,19 +325,9 @@ static void compile_comparison(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_addition_and_subtraction(compiler);
 
-	Type first_type = pop_type(compiler);
-	if (first_type != TY_INTEGER) {
-		error(compiler);
-		type_error(TY_INTEGER, first_type);
-	}
-	Type second_type = pop_type(compiler);
-	if (second_type != TY_INTEGER) {
-		error(compiler);
-		type_error(TY_INTEGER, first_type);
-	}
-	push_type(compiler, TY_BOOLEAN);
-
-	write_into_chunk(compiler->chunk, comparison);
+	Operand right = match_type(compiler, TY_INTEGER);
+	Operand left = match_type(compiler, TY_INTEGER);
+	emit_binary(compiler, comparison, left, right, TY_BOOLEAN);
 }
 
 static void compile_addition_and_subtraction(Compiler *compiler) {
@@ -343,22 +351,18 @@ static void compile_addition(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_multiplication_and_division(compiler);
 
-	match_type(compiler, TY_INTEGER);
-	match_type(compiler, TY_INTEGER);
-	push_type(compiler, TY_INTEGER);
-
-	write_into_chunk(compiler->chunk, OP_ADD);
+	Operand right = match_type(compiler, TY_INTEGER);
+	Operand left = match_type(compiler, TY_INTEGER);
+	emit_binary(compiler, IR_ADD, left, right, TY_INTEGER);
 }
 
 static void compile_subtraction(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_multiplication_and_division(compiler);
 
-	match_type(compiler, TY_INTEGER);
-	match_type(compiler, TY_INTEGER);
-	push_type(compiler, TY_INTEGER);
-
-	write_into_chunk(compiler->chunk, OP_SUB);
+	Operand right = match_type(compiler, TY_INTEGER);
+	Operand left = match_type(compiler, TY_INTEGER);
+	emit_binary(compiler, IR_SUB, left, right, TY_INTEGER);
 }
 
 static void compile_multiplication_and_division(Compiler *compiler) {
@@ -382,55 +386,42 @@ static void compile_multiplication(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_unary(compiler);
 
-	match_type(compiler, TY_INTEGER);
-	match_type(compiler, TY_INTEGER);
-	push_type(compiler, TY_INTEGER);
-
-	write_into_chunk(compiler->chunk, OP_MUL);
+	Operand right = match_type(compiler, TY_INTEGER);
+	Operand left = match_type(compiler, TY_INTEGER);
+	emit_binary(compiler, IR_MUL, left, right, TY_INTEGER);
 }
 
 static void compile_division(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_unary(compiler);
 
-	match_type(compiler, TY_INTEGER);
-	match_type(compiler, TY_INTEGER);
-	push_type(compiler, TY_INTEGER);
-
-	write_into_chunk(compiler->chunk, OP_DIV);
+	Operand right = match_type(compiler, TY_INTEGER);
+	Operand left = match_type(compiler, TY_INTEGER);
+	emit_binary(compiler, IR_DIV, left, right, TY_INTEGER);
 }
 
 static void compile_unary(Compiler *compiler) {
-	Chunk *chunk = compiler->chunk;
 	Token token = peek_next_token(compiler->lexer);
 	switch (token.type) {
 		case TT_NUMBER: {
 			get_next_token(compiler->lexer);
-			write_into_chunk(chunk, OP_PUSH);
-			int n = atoi(token.start);
-			write_into_chunk(chunk, n);
-			push_type(compiler, TY_INTEGER);
+			int n = parse_integer(&token);
+			emit_constant(compiler, TY_INTEGER, n);
 			break;
 		}
 		case TT_TRUE: {
 			get_next_token(compiler->lexer);
-			write_into_chunk(chunk, OP_PUSH);
-			write_into_chunk(chunk, AQ_TRUE);
-			push_type(compiler, TY_BOOLEAN);
+			emit_constant(compiler, TY_BOOLEAN, AQ_TRUE);
 			break;
 		}
 		case TT_FALSE: {
 			get_next_token(compiler->lexer);
-			write_into_chunk(chunk, OP_PUSH);
-			write_into_chunk(chunk, AQ_FALSE);
-			push_type(compiler, TY_BOOLEAN);
+			emit_constant(compiler, TY_BOOLEAN, AQ_FALSE);
 			break;
 		}
                 case TT_UNIT: {
                         get_next_token(compiler->lexer);
-                        write_into_chunk(chunk, OP_PUSH);
-                        write_into_chunk(chunk, AQ_UNIT);
-                        push_type(compiler, TY_UNIT);
+                        emit_constant(compiler, TY_UNIT, AQ_UNIT);
                         break;
                 }
 		case TT_LPAREN: {
@@ -468,28 +459,30 @@ static void compile_name_or_call(Compiler *compiler) {
 }
 
 static void compile_name(Compiler *compiler, Token token) {
-	write_into_chunk(compiler->chunk, OP_LOAD);
-
 	int i = resolve_variable(&compiler->variable_stack, &token);
 	Variable *v = &compiler->variable_stack.variables[i];
-	push_type(compiler, v->type);
-	write_into_chunk(compiler->chunk, i);
+	int value = emit_ir(&compiler->builder, IR_LOAD, v->type, -1, -1, i);
+	push_type(compiler, v->type, value, true);
 }
 
 static void compile_call(Compiler *compiler, Token name) {
-	Function *f = find_function(&compiler->flist, &name);
-	if (f == NULL) {
+	int function = *find_function_symbol(compiler, name.symbol);
+	if (function < 0) {
 		error(compiler);
 		fprintf(stderr, "Name Error: Unknown Function\n");
 		exit(EXIT_FAILURE);
 	}
+	Function *f = &compiler->flist.functions[function];
 
+	// The arguments stay on the type stack until the call is emitted.
 	match(compiler, TT_LPAREN);
 	int num_args = 0;
         Token token = peek_next_token(compiler->lexer);
 	if (token.type != TT_RPAREN) {
 		compile_expression(compiler);
-		match_type(compiler, f->parameter_types[num_args++]);
+		push_operand(compiler,
+			     match_type(compiler,
+					f->parameter_types[num_args++]));
 
 		for (;;) {
 			Token token = peek_next_token(compiler->lexer);
@@ -506,7 +499,9 @@ static void compile_call(Compiler *compiler, Token name) {
 			}
 			match(compiler, TT_COMMA);
 			compile_expression(compiler);
-			match_type(compiler, f->parameter_types[num_args++]);
+			push_operand(compiler,
+				     match_type(compiler,
+						f->parameter_types[num_args++]));
 		}
 	}
 	match(compiler, TT_RPAREN);
@@ -520,21 +515,180 @@ static void compile_call(Compiler *compiler, Token name) {
 		exit(EXIT_FAILURE);
 	}
 
-	push_type(compiler, f->return_type);
-
-	write_into_chunk(compiler->chunk, OP_CALL);
-	write_into_chunk(compiler->chunk, f->index);
-	write_into_chunk(compiler->chunk, f->parameter_count);
+	if (num_args > compiler->argument_capacity) {
+		compiler->arguments = arena_resize(
+		    compiler->arena, compiler->arguments,
+		    compiler->argument_capacity * sizeof(int),
+		    num_args * sizeof(int));
+		compiler->argument_capacity = num_args;
+	}
+	compiler->type_stackSize -= num_args;
+	for (int i = 0; i < num_args; i++) {
+		compiler->arguments[i] =
+		    compiler->type_stack[compiler->type_stackSize + i].value;
+	}
+	int value = emit_ir_call(&compiler->builder, f->return_type, function,
+				 compiler->arguments, num_args);
+	push_type(compiler, f->return_type, value, false);
 }
 
 static void compile_negation(Compiler *compiler) {
 	get_next_token(compiler->lexer);
 	compile_unary(compiler);
 
-	match_type(compiler, TY_INTEGER);
-	push_type(compiler, TY_INTEGER);
+	Operand operand = match_type(compiler, TY_INTEGER);
+	int constant;
+	if (constant_value(compiler, operand, &constant)) {
+		emit_constant(compiler, TY_INTEGER,
+			      (int) (0u - (unsigned int) constant));
+		return;
+	}
+
+	int value = emit_ir(&compiler->builder, IR_NEGATE, TY_INTEGER,
+			    operand.value, -1, 0);
+	push_type(compiler, TY_INTEGER, value, operand.is_pure);
+}
+
+static void emit_constant(Compiler *compiler, Type type, int value) {
+	int constant =
+	    emit_ir(&compiler->builder, IR_CONSTANT, type, -1, -1, value);
+	push_type(compiler, type, constant, true);
+}
+
+// Emits a binary operation on two compiled operands, unless it can be
+// folded away at compile time. An operand that is dropped is left for
+// lowering, which only emits values that are used.
+static void emit_binary(Compiler *compiler, IrOp op, Operand left,
+			Operand right, Type result_type) {
+	int a, b;
+	bool left_is_constant = constant_value(compiler, left, &a);
+	bool right_is_constant = constant_value(compiler, right, &b);
+	if (op == IR_DIV && right_is_constant && b == 0) {
+		error(compiler);
+		fprintf(stderr, "Division by zero\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int value;
+	if (left_is_constant && right_is_constant &&
+	    fold_ir_binary(op, a, b, &value)) {
+		emit_constant(compiler, result_type, value);
+		return;
+	}
+
+	if (simplify_binary(compiler, op, left, right)) {
+		return;
+	}
 
-	write_into_chunk(compiler->chunk, OP_NEGATE);
+	value = emit_ir(&compiler->builder, op, result_type, left.value,
+			right.value, 0);
+	// A division traps unless its divisor is a constant, which was
+	// checked for zero above.
+	bool is_pure = left.is_pure && right.is_pure &&
+		       (op != IR_DIV || right_is_constant);
+	push_type(compiler, result_type, value, is_pure);
+}
+
+static bool simplify_binary(Compiler *compiler, IrOp op, Operand left,
+			    Operand right) {
+	int a, b;
+	bool left_is_constant = constant_value(compiler, left, &a);
+	bool right_is_constant = constant_value(compiler, right, &b);
+	bool right_is_zero = right_is_constant && b == 0;
+	bool right_is_one = right_is_constant && b == 1;
+	bool left_is_zero = left_is_constant && a == 0;
+	bool left_is_one = left_is_constant && a == 1;
+
+	switch (op) {
+		case IR_ADD:
+		case IR_SUB:
+			if (right_is_zero) {
+				// x + 0, x - 0
+				push_operand(compiler, left);
+				return true;
+			}
+			if (left_is_zero && op == IR_ADD) {
+				// 0 + x
+				push_operand(compiler, right);
+				return true;
+			}
+			if (left_is_zero && op == IR_SUB) {
+				// 0 - x
+				int value =
+				    emit_ir(&compiler->builder, IR_NEGATE,
+					    TY_INTEGER, right.value, -1, 0);
+				push_type(compiler, TY_INTEGER, value,
+					  right.is_pure);
+				return true;
+			}
+			return false;
+		case IR_MUL:
+			if ((right_is_zero && left.is_pure) ||
+			    (left_is_zero && right.is_pure)) {
+				// x * 0, 0 * x when x has no side effects
+				emit_constant(compiler, TY_INTEGER, 0);
+				return true;
+			}
+			if (right_is_one) {
+				// x * 1
+				push_operand(compiler, left);
+				return true;
+			}
+			if (left_is_one) {
+				// 1 * x
+				push_operand(compiler, right);
+				return true;
+			}
+			return false;
+		case IR_DIV:
+			if (right_is_one) {
+				// x / 1
+				push_operand(compiler, left);
+				return true;
+			}
+			return false;
+		default:
+			return false;
+	}
+}
+
+// Literals and whatever was folded from them.
+static bool constant_value(Compiler *compiler, Operand operand, int *value) {
+	IrInstruction *instruction =
+	    &compiler->builder.function.instructions[operand.value];
+	*value = instruction->immediate;
+	return instruction->op == IR_CONSTANT;
+}
+
+static int *find_function_symbol(Compiler *compiler, int symbol) {
+	if (symbol >= compiler->function_symbol_capacity) {
+		int capacity = compiler->function_symbol_capacity > 0
+				   ? compiler->function_symbol_capacity
+				   : 64;
+		while (capacity <= symbol) {
+			capacity *= 2;
+		}
+		compiler->function_symbols = arena_resize(
+		    compiler->arena, compiler->function_symbols,
+		    compiler->function_symbol_capacity * sizeof(int),
+		    capacity * sizeof(int));
+		for (int i = compiler->function_symbol_capacity; i < capacity;
+		     i++) {
+			compiler->function_symbols[i] = -1;
+		}
+		compiler->function_symbol_capacity = capacity;
+	}
+	return &compiler->function_symbols[symbol];
+}
+
+// The source is not NUL-terminated, so the digits are bounded by the token.
+// Like the interpreter's arithmetic, out-of-range literals wrap.
+static int parse_integer(Token *token) {
+	unsigned int n = 0;
+	for (int i = 0; i < token->length; i++) {
+		n = n * 10 + (unsigned int) (token->start[i] - '0');
+	}
+	return (int) n;
 }
 
 static void error(Compiler *compiler) {
@@ -555,20 +709,36 @@ static Token match(Compiler *compiler, TokenType type) {
 	return get_next_token(compiler->lexer);
 }
 
-static void push_type(Compiler *compiler, Type type) {
-	compiler->type_stack[compiler->type_stackSize++] = type;
+static void push_type(Compiler *compiler, Type type, int value, bool is_pure) {
+	Operand operand;
+	operand.type = type;
+	operand.value = value;
+	operand.is_pure = is_pure;
+	push_operand(compiler, operand);
+}
+
+static void push_operand(Compiler *compiler, Operand operand) {
+	if (compiler->type_stackSize == compiler->type_stack_capacity) {
+		compiler->type_stack = arena_resize(
+		    compiler->arena, compiler->type_stack,
+		    compiler->type_stack_capacity * sizeof(Operand),
+		    2 * compiler->type_stack_capacity * sizeof(Operand));
+		compiler->type_stack_capacity *= 2;
+	}
+	compiler->type_stack[compiler->type_stackSize++] = operand;
 }
 
-static Type pop_type(Compiler *compiler) {
+static Operand pop_type(Compiler *compiler) {
 	return compiler->type_stack[--compiler->type_stackSize];
 }
 
-static void match_type(Compiler *compiler, Type expected) {
-	Type found = pop_type(compiler);
-	if (found != expected) {
+static Operand match_type(Compiler *compiler, Type expected) {
+	Operand found = pop_type(compiler);
+	if (found.type != expected) {
 		error(compiler);
-		type_error(expected, found);
+		type_error(expected, found.type);
 	}
+	return found;
 }
 
 static void type_error(Type expected, Type found) {
@@ -1,26 +1,47 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
-#include "chunk.h"
+#include "arena.h"
 #include "function.h"
+#include "ir.h"
 #include "lexer.h"
 #include "token.h"
 #include "type.h"
 #include "variable.h"
 #include <stdbool.h>
 
+// An entry on the compiler's type stack describes an operand that has
+// already been compiled: its type, the IR value that holds it and whether
+// evaluating it has no effect other than producing its value.
+typedef struct Operand {
+	Type type;
+	int value;
+	bool is_pure;
+} Operand;
+
 typedef struct Compiler {
 	Lexer *lexer;
-	Chunk *chunk;
+	IrProgram *program;
+	IrBuilder builder;
+	Arena *arena;
 
 	VariableStack variable_stack;
 	FunctionList flist;
-	Type type_stack[256];
+	// Index into flist of the function with each interned name, or -1.
+	int *function_symbols;
+	int function_symbol_capacity;
+	Operand *type_stack;
 	int type_stackSize;
+	int type_stack_capacity;
+	// Argument values of the call being emitted.
+	int *arguments;
+	int argument_capacity;
 } Compiler;
 
-void init_compiler(Compiler *compiler, Lexer *lexer, Chunk *chunk);
-void free_compiler(Compiler *compiler);
+void init_compiler(Compiler *compiler, Lexer *lexer, IrProgram *program,
+		   Arena *arena);
+// Adds the IR of every function to the program. lower_program turns it
+// into bytecode.
 void compile(Compiler *compile);
 
 #endif
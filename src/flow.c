@@ -0,0 +1,194 @@
+#include "flow.h"
+#include "chunk.h"
+#include "function.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+int stack_effect(Instruction *instruction) {
+	switch (instruction->op_code) {
+		case OP_PUSH:
+		case OP_LOAD:
+			return 1;
+		case OP_POP:
+		case OP_STORE:
+		case OP_PRINT_UNIT:
+		case OP_PRINT_INTEGER:
+		case OP_PRINT_BOOLEAN:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_EQUAL:
+		case OP_NOT_EQUAL:
+		case OP_LESS:
+		case OP_LESS_EQUAL:
+		case OP_GREATER:
+		case OP_GREATER_EQUAL:
+		case OP_JUMP_IF_FALSE:
+			return -1;
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			return -2;
+		case OP_POP_N:
+			return -(int) instruction->operands[0];
+		case OP_CALL:
+			return 1 - (int) instruction->operands[1];
+		default:
+			return 0;
+	}
+}
+
+int jump_target(Instruction *instruction) {
+	switch (instruction->op_code) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			return instruction->operands[0];
+		default:
+			return -1;
+	}
+}
+
+bool falls_through(OpCode op_code) {
+	return op_code != OP_JUMP && op_code != OP_RETURN &&
+	       op_code != OP_TAIL_CALL && op_code != OP_EXIT;
+}
+
+bool compute_depths(Chunk *chunk, int start, int end, int entry_depth,
+		    int *depths, bool *is_target, int *max_depth) {
+	for (int i = start; i <= end; i++) {
+		depths[i] = -1;
+		is_target[i] = false;
+	}
+
+	int *worklist = malloc((end - start + 1) * sizeof(int));
+	int count = 0;
+	depths[start] = entry_depth;
+	worklist[count++] = start;
+
+	bool ok = true;
+	while (count > 0 && ok) {
+		int index = worklist[--count];
+		Instruction instruction;
+		int next = decode_instruction(chunk, index, &instruction);
+		int depth = depths[index] + stack_effect(&instruction);
+		if (depth > *max_depth) {
+			*max_depth = depth;
+		}
+
+		int successors[2];
+		int successor_count = 0;
+		if (falls_through(instruction.op_code)) {
+			successors[successor_count++] = next;
+		}
+		int target = jump_target(&instruction);
+		if (target >= 0) {
+			successors[successor_count++] = target;
+			is_target[target] = true;
+		}
+		// Self tail calls loop back to the start.
+		if (instruction.op_code == OP_TAIL_CALL &&
+		    (int) instruction.operands[0] == start) {
+			is_target[start] = true;
+		}
+
+		for (int i = 0; i < successor_count; i++) {
+			int successor = successors[i];
+			if (successor < start || successor > end) {
+				ok = false;
+			} else if (successor == end) {
+				// Running off the end is left to the caller.
+			} else if (depths[successor] < 0) {
+				depths[successor] = depth;
+				worklist[count++] = successor;
+			} else if (depths[successor] != depth) {
+				ok = false;
+			}
+		}
+	}
+
+	free(worklist);
+	return ok;
+}
+
+void infer_purity(Chunk *chunk, FunctionList *flist) {
+	int *function_at = malloc((chunk->length + 1) * sizeof(int));
+	for (int i = 0; i <= chunk->length; i++) {
+		function_at[i] = -1;
+	}
+	for (int i = 0; i < flist->count; i++) {
+		flist->functions[i].is_pure = true;
+		function_at[flist->functions[i].index] = i;
+	}
+
+	// Every call from one function to another, as caller and callee.
+	int *calls = malloc(16 * sizeof(int));
+	int call_count = 0;
+	int call_capacity = 16;
+	int function = -1;
+	int index = 0;
+	while (index < chunk->length) {
+		if (function_at[index] >= 0) {
+			function = function_at[index];
+		}
+		Instruction instruction;
+		index = decode_instruction(chunk, index, &instruction);
+		if (function < 0) {
+			continue;
+		}
+		switch (instruction.op_code) {
+			case OP_PRINT_UNIT:
+			case OP_PRINT_INTEGER:
+			case OP_PRINT_BOOLEAN:
+				flist->functions[function].is_pure = false;
+				break;
+			case OP_CALL:
+			case OP_TAIL_CALL: {
+				uint32_t target = instruction.operands[0];
+				if (call_count + 2 > call_capacity) {
+					call_capacity *= 2;
+					calls = realloc(calls, call_capacity *
+								   sizeof(int));
+				}
+				calls[call_count++] = function;
+				calls[call_count++] =
+				    target <= (uint32_t) chunk->length
+					? function_at[target]
+					: -1;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	// Impurity spreads from callees to their callers until nothing
+	// changes. Calls only reach functions defined earlier or the caller
+	// itself, so this settles after a pass or two.
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = 0; i < call_count; i += 2) {
+			Function *caller = &flist->functions[calls[i]];
+			int callee = calls[i + 1];
+			bool callee_is_pure =
+			    callee >= 0 && flist->functions[callee].is_pure;
+			if (caller->is_pure && !callee_is_pure) {
+				caller->is_pure = false;
+				changed = true;
+			}
+		}
+	}
+
+	free(calls);
+	free(function_at);
+}
@@ -0,0 +1,31 @@
+#ifndef FLOW_H
+#define FLOW_H
+
+#include "chunk.h"
+#include "function.h"
+#include <stdbool.h>
+
+// Within a function the height of the value stack before every instruction
+// is fixed. Backends that give every stack slot a fixed home, like the C
+// transpiler and the register VM, start from these heights.
+
+int stack_effect(Instruction *instruction);
+// Chunk index an instruction may jump to, or -1.
+int jump_target(Instruction *instruction);
+bool falls_through(OpCode op_code);
+
+// Fills depths[start..end] with the stack height before each instruction
+// of the code in [start, end), or -1 where it is unreachable, and marks
+// every index that is jumped to in is_target. Running off the end counts
+// as reaching end. Returns false if the heights disagree or control leaves
+// the range.
+bool compute_depths(Chunk *chunk, int start, int end, int entry_depth,
+		    int *depths, bool *is_target, int *max_depth);
+
+// Sets is_pure on every function that neither prints nor calls a function
+// that is not pure, so that its result depends only on its arguments. A
+// function runs from its index up to the next function or the end of the
+// chunk.
+void infer_purity(Chunk *chunk, FunctionList *flist);
+
+#endif
@@ -15,39 +15,38 @@ void print_function(FILE *file, Function *function) {
 	fprintf(file, " @ %d\n", function->index);
 }
 
-void add_parameter_type(Function *function, Type type) {
+void add_parameter_type(FunctionList *flist, Function *function, Type type) {
 	if (function->parameter_count == function->parameter_capacity) {
+		int old_size = function->parameter_capacity * sizeof(Type);
 		function->parameter_capacity *= 2;
 		int new_size = function->parameter_capacity * sizeof(Type);
 		function->parameter_types =
-		    realloc(function->parameter_types, new_size);
+		    arena_resize(flist->arena, function->parameter_types,
+				 old_size, new_size);
 	}
 	function->parameter_types[function->parameter_count++] = type;
 }
 
-void init_function_list(FunctionList *flist) {
-	flist->functions = malloc(4 * sizeof(Function));
+void init_function_list(FunctionList *flist, Arena *arena) {
+	flist->arena = arena;
+	flist->functions = arena_alloc(arena, 4 * sizeof(Function));
 	flist->count = 0;
 	flist->capacity = 4;
 }
 
-void free_function_list(FunctionList *flist) {
-        for (int i = 0; i < flist->count; i++) {
-                free(flist->functions[i].parameter_types);
-        }
-	free(flist->functions);
-}
-
 Function *add_function(FunctionList *flist) {
 	if (flist->count == flist->capacity) {
+		int old_size = flist->capacity * sizeof(Function);
 		flist->capacity *= 2;
 		int new_size = flist->capacity * sizeof(Function);
-		flist->functions = realloc(flist->functions, new_size);
+		flist->functions = arena_resize(flist->arena, flist->functions,
+						old_size, new_size);
 	}
 	Function *function = &flist->functions[flist->count++];
-	function->parameter_types = malloc(4 * sizeof(Type));
+	function->parameter_types = arena_alloc(flist->arena, 4 * sizeof(Type));
 	function->parameter_count = 0;
 	function->parameter_capacity = 4;
+	function->is_pure = false;
 	return function;
 }
 
@@ -74,6 +73,16 @@ Function *find_main_function(FunctionList *flist) {
 	return NULL;
 }
 
+Function *find_function_at(FunctionList *flist, int index) {
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		if (f->index == index) {
+			return f;
+		}
+	}
+	return NULL;
+}
+
 void print_function_list(FILE *file, FunctionList *flist) {
 	for (int i = 0; i < flist->count; i++) {
 		print_function(file, &flist->functions[i]);
@@ -1,8 +1,10 @@
 #ifndef FUNCTION_H
 #define FUNCTION_H
 
+#include "arena.h"
 #include "token.h"
 #include "type.h"
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef struct Function {
@@ -12,22 +14,27 @@ typedef struct Function {
 	int parameter_count;
 	int parameter_capacity;
 	int index;
+	// Whether the result depends only on the arguments; see infer_purity.
+	bool is_pure;
 } Function;
 
 void print_function(FILE *file, Function *function);
-void add_parameter_type(Function *function, Type type);
 
+// Functions and their parameter types live in the arena, so the list has
+// no teardown of its own.
 typedef struct FunctionList {
 	Function *functions;
 	int count;
 	int capacity;
+	Arena *arena;
 } FunctionList;
 
-void init_function_list(FunctionList *flist);
-void free_function_list(FunctionList *flist);
+void init_function_list(FunctionList *flist, Arena *arena);
+void add_parameter_type(FunctionList *flist, Function *function, Type type);
 Function *add_function(FunctionList *flist);
 Function *find_function(FunctionList *flist, Token *name);
 Function *find_main_function(FunctionList *flist);
+Function *find_function_at(FunctionList *flist, int index);
 void print_function_list(FILE *file, FunctionList *flist);
 
 #endif
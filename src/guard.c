@@ -0,0 +1,167 @@
+#define _DEFAULT_SOURCE
+
+#include "guard.h"
+#include "function.h"
+#include "output.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The VM stacks are large reservations that end in an inaccessible guard
+// page, so they need no bounds checks: running off the end faults, and the
+// SIGSEGV handler reports the overflow instead of crashing. The handler
+// runs on a stack of its own because the machine stack may be the one that
+// overflowed.
+
+#define MAX_GUARDED_STACKS 8
+#define SIGNAL_STACK_SIZE (64 * 1024)
+
+typedef struct GuardedStack {
+	uint8_t *mapping;
+	size_t mapping_size;
+	uint8_t *guard;
+	void *stack;
+	OverflowLocator locate;
+	void *context;
+} GuardedStack;
+
+static GuardedStack guarded_stacks[MAX_GUARDED_STACKS];
+static size_t page_size;
+
+static void install_handler(void);
+static void handle_segfault(int signal_number, siginfo_t *info, void *ucontext);
+static void write_message(const char *message, size_t length);
+
+// Returns the lowest address of size usable bytes. The guard page lies
+// directly below them for stacks that grow down and directly above them
+// otherwise.
+void *map_guarded_stack(size_t size, bool grows_down, OverflowLocator locate,
+			void *context) {
+	if (page_size == 0) {
+		install_handler();
+	}
+
+	GuardedStack *guarded = NULL;
+	for (int i = 0; i < MAX_GUARDED_STACKS; i++) {
+		if (guarded_stacks[i].mapping == NULL) {
+			guarded = &guarded_stacks[i];
+			break;
+		}
+	}
+	if (guarded == NULL) {
+		fprintf(stderr, "Too many guarded stacks\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t rounded = (size + page_size - 1) / page_size * page_size;
+	size_t mapping_size = rounded + page_size;
+	// Only the pages that are actually touched use memory.
+	void *mapping =
+	    mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	guarded->mapping = mapping;
+	guarded->mapping_size = mapping_size;
+	if (grows_down) {
+		guarded->guard = guarded->mapping;
+		guarded->stack = guarded->mapping + page_size;
+	} else {
+		guarded->guard = guarded->mapping + rounded;
+		guarded->stack = guarded->guard - size;
+	}
+	guarded->locate = locate;
+	guarded->context = context;
+
+	if (mprotect(guarded->guard, page_size, PROT_NONE) != 0) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+	return guarded->stack;
+}
+
+void unmap_guarded_stack(void *stack) {
+	for (int i = 0; i < MAX_GUARDED_STACKS; i++) {
+		GuardedStack *guarded = &guarded_stacks[i];
+		if (guarded->mapping != NULL && guarded->stack == stack) {
+			munmap(guarded->mapping, guarded->mapping_size);
+			guarded->mapping = NULL;
+			return;
+		}
+	}
+}
+
+static void install_handler(void) {
+	page_size = sysconf(_SC_PAGESIZE);
+
+	stack_t signal_stack;
+	signal_stack.ss_sp = malloc(SIGNAL_STACK_SIZE);
+	signal_stack.ss_size = SIGNAL_STACK_SIZE;
+	signal_stack.ss_flags = 0;
+	if (sigaltstack(&signal_stack, NULL) != 0) {
+		perror("sigaltstack");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = handle_segfault;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, NULL) != 0) {
+		perror("sigaction");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void handle_segfault(int signal_number, siginfo_t *info,
+			    void *ucontext) {
+	uint8_t *address = info->si_addr;
+	for (int i = 0; i < MAX_GUARDED_STACKS; i++) {
+		GuardedStack *guarded = &guarded_stacks[i];
+		if (guarded->mapping == NULL || address < guarded->guard ||
+		    address >= guarded->guard + page_size) {
+			continue;
+		}
+
+		Function *f = NULL;
+		if (guarded->locate != NULL) {
+			f = guarded->locate(guarded->context);
+		}
+		// Keep whatever the program printed before it overflowed.
+		fflush(stdout);
+		flush_active_output();
+		const char *message = "stack overflow";
+		write_message(message, strlen(message));
+		if (f != NULL) {
+			message = " in function ";
+			write_message(message, strlen(message));
+			write_message(f->name.start, f->name.length);
+		}
+		write_message("\n", 1);
+		_exit(EXIT_FAILURE);
+	}
+
+	// Any other fault is a genuine crash. Returning with the default
+	// action restored repeats it.
+	signal(SIGSEGV, SIG_DFL);
+}
+
+static void write_message(const char *message, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(STDERR_FILENO, message, length);
+		if (written <= 0) {
+			return;
+		}
+		message += written;
+		length -= written;
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include "function.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Names the function that was running when a guarded stack overflowed, or
+// returns NULL if that cannot be told from the stack.
+typedef Function *(*OverflowLocator)(void *context);
+
+void *map_guarded_stack(size_t size, bool grows_down, OverflowLocator locate,
+			void *context);
+void unmap_guarded_stack(void *stack);
+
+#endif
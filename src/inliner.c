@@ -0,0 +1,386 @@
+#include "inliner.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The inliner decodes the chunk, copies it into a list of instructions with
+// inlined bodies in place of calls and encodes the list back. Jump and call
+// operands in the list hold list indices once resolved; copied code starts
+// out with chunk indices and inlined code with indices into its callee.
+//
+// An inlined body works on the caller's frame: the arguments are already
+// where the callee would find its parameters, so callee slot s becomes
+// caller slot base + s, where base is the stack height below the
+// arguments. A RETURN becomes a STORE of the result into base and pops of
+// the locals above it, leaving the stack as the call would.
+
+// Marks a jump to the end of the body being inlined.
+#define BODY_END UINT32_MAX
+
+typedef struct Inliner {
+	Chunk *chunk;
+	FunctionList *flist;
+	int max_size;
+
+	// The instruction at every chunk index an instruction starts at, and
+	// the index of the next one.
+	Instruction *instructions;
+	int *nexts;
+	// Function starting at every chunk index, or -1.
+	int *function_at;
+	// Per function: where its code ends, whether calls to it are inlined
+	// and whether its stack heights are in depths, 1 if so, -1 if they
+	// are unknown and 0 if not computed yet. Only callers need them, and
+	// only once they call a function that is inlined.
+	int *ends;
+	bool *is_inlinable;
+	int *has_depths;
+	int *depths;
+	bool *is_target;
+	// Which instructions of inlined functions ever run.
+	bool *is_reachable;
+
+	Instruction *list;
+	bool *resolved;
+	int count;
+	int capacity;
+	// List index of every chunk index in copied code.
+	int *list_index;
+} Inliner;
+
+static bool inline_round(Chunk *chunk, FunctionList *flist, int max_size);
+static bool analyze_functions(Inliner *inliner);
+static bool is_inlinable(Inliner *inliner, Function *f, int end);
+static bool has_caller_depths(Inliner *inliner, int function);
+static void inline_body(Inliner *inliner, int function, int base);
+static void append(Inliner *inliner, Instruction *instruction,
+		   bool resolved);
+static void encode_list(Inliner *inliner);
+static bool has_code_target(OpCode op_code);
+
+void inline_calls(Chunk *chunk, FunctionList *flist, int max_size) {
+	if (max_size <= 0) {
+		return;
+	}
+	while (inline_round(chunk, flist, max_size)) {
+	}
+}
+
+// Returns whether anything was inlined.
+static bool inline_round(Chunk *chunk, FunctionList *flist, int max_size) {
+	Inliner inliner;
+	inliner.chunk = chunk;
+	inliner.flist = flist;
+	inliner.max_size = max_size;
+	bool any_inlinable = analyze_functions(&inliner);
+
+	inliner.capacity = chunk->length + 16;
+	inliner.list = malloc(inliner.capacity * sizeof(Instruction));
+	inliner.resolved = malloc(inliner.capacity * sizeof(bool));
+	inliner.count = 0;
+	inliner.list_index = malloc((chunk->length + 1) * sizeof(int));
+
+	bool changed = false;
+	int function = -1;
+	int index = 0;
+	while (index < chunk->length) {
+		if (inliner.function_at[index] >= 0) {
+			function = inliner.function_at[index];
+		}
+		inliner.list_index[index] = inliner.count;
+		Instruction *instruction = &inliner.instructions[index];
+		int next = inliner.nexts[index];
+
+		int callee = -1;
+		if (instruction->op_code == OP_CALL) {
+			callee = inliner.function_at[instruction->operands[0]];
+		}
+		if (any_inlinable && function >= 0 && callee >= 0 &&
+		    inliner.is_inlinable[callee] &&
+		    has_caller_depths(&inliner, function) &&
+		    inliner.depths[index] >= 0) {
+			int base = inliner.depths[index] -
+				   (int) instruction->operands[1];
+			inline_body(&inliner, callee, base);
+			changed = true;
+		} else {
+			append(&inliner, instruction, false);
+		}
+		index = next;
+	}
+	// Jumps out of the last block of the last function land here.
+	inliner.list_index[chunk->length] = inliner.count;
+
+	if (changed) {
+		encode_list(&inliner);
+	}
+
+	free(inliner.instructions);
+	free(inliner.nexts);
+	free(inliner.function_at);
+	free(inliner.ends);
+	free(inliner.has_depths);
+	free(inliner.is_inlinable);
+	free(inliner.depths);
+	free(inliner.is_target);
+	free(inliner.is_reachable);
+	free(inliner.list);
+	free(inliner.resolved);
+	free(inliner.list_index);
+	return changed;
+}
+
+// Returns whether calls to any function can be inlined.
+static bool analyze_functions(Inliner *inliner) {
+	Chunk *chunk = inliner->chunk;
+	FunctionList *flist = inliner->flist;
+	inliner->instructions =
+	    malloc((chunk->length + 1) * sizeof(Instruction));
+	inliner->nexts = malloc((chunk->length + 1) * sizeof(int));
+	inliner->function_at = malloc((chunk->length + 1) * sizeof(int));
+	inliner->ends = malloc(flist->count * sizeof(int));
+	inliner->is_inlinable = calloc(flist->count, sizeof(bool));
+	inliner->has_depths = calloc(flist->count, sizeof(int));
+	inliner->depths = malloc((chunk->length + 1) * sizeof(int));
+	inliner->is_target = malloc((chunk->length + 1) * sizeof(bool));
+	inliner->is_reachable = malloc((chunk->length + 1) * sizeof(bool));
+
+	for (int i = 0; i <= chunk->length; i++) {
+		inliner->function_at[i] = -1;
+	}
+	for (int i = 0; i < flist->count; i++) {
+		inliner->function_at[flist->functions[i].index] = i;
+	}
+
+	// Functions in the order of their code, each ending where the next
+	// one starts, and whether they call anything.
+	int *order = malloc(flist->count * sizeof(int));
+	bool *calls = calloc(flist->count, sizeof(bool));
+	int order_count = 0;
+	int index = 0;
+	while (index < chunk->length) {
+		int function = inliner->function_at[index];
+		if (function >= 0) {
+			if (order_count > 0) {
+				inliner->ends[order[order_count - 1]] = index;
+			}
+			order[order_count++] = function;
+		}
+		Instruction *instruction = &inliner->instructions[index];
+		inliner->nexts[index] =
+		    decode_instruction(chunk, index, instruction);
+		if (order_count > 0 && (instruction->op_code == OP_CALL ||
+					instruction->op_code == OP_TAIL_CALL)) {
+			calls[order[order_count - 1]] = true;
+		}
+		index = inliner->nexts[index];
+	}
+	if (order_count > 0) {
+		inliner->ends[order[order_count - 1]] = chunk->length;
+	}
+
+	bool any_inlinable = false;
+	for (int i = 0; i < order_count; i++) {
+		int function = order[i];
+		Function *f = &flist->functions[function];
+		int end = inliner->ends[function];
+		int max_depth = 0;
+		if (calls[function] ||
+		    !compute_depths(chunk, f->index, end, f->parameter_count,
+				    inliner->depths, inliner->is_target,
+				    &max_depth) ||
+		    !is_inlinable(inliner, f, end)) {
+			continue;
+		}
+		inliner->is_inlinable[function] = true;
+		any_inlinable = true;
+		for (int j = f->index; j < end; j++) {
+			inliner->is_reachable[j] = inliner->depths[j] >= 0;
+		}
+	}
+	free(calls);
+	free(order);
+	return any_inlinable;
+}
+
+// The body of a function that calls nothing can be inlined if it is small,
+// never runs off its end and every RETURN drops exactly the locals below
+// the result.
+static bool is_inlinable(Inliner *inliner, Function *f, int end) {
+	int size = 0;
+	int index = f->index;
+	while (index < end) {
+		Instruction *instruction = &inliner->instructions[index];
+		int next = inliner->nexts[index];
+		int depth = inliner->depths[index];
+		if (depth < 0) {
+			index = next;
+			continue;
+		}
+
+		OpCode op_code = instruction->op_code;
+		if (++size > inliner->max_size || op_code == OP_EXIT) {
+			return false;
+		}
+		if ((falls_through(op_code) && next == end) ||
+		    jump_target(instruction) == end) {
+			return false;
+		}
+		if (op_code == OP_RETURN &&
+		    (int) instruction->operands[0] != depth - 1) {
+			return false;
+		}
+		index = next;
+	}
+	return true;
+}
+
+// The stack heights of a caller overwrite the entry at its end, which may
+// be the start of the next function, so they are computed right before
+// they are needed.
+static bool has_caller_depths(Inliner *inliner, int function) {
+	if (inliner->has_depths[function] == 0) {
+		Function *f = &inliner->flist->functions[function];
+		int max_depth = 0;
+		bool known = compute_depths(
+		    inliner->chunk, f->index, inliner->ends[function],
+		    f->parameter_count, inliner->depths, inliner->is_target,
+		    &max_depth);
+		inliner->has_depths[function] = known ? 1 : -1;
+	}
+	return inliner->has_depths[function] > 0;
+}
+
+static void inline_body(Inliner *inliner, int function, int base) {
+	Function *f = &inliner->flist->functions[function];
+	int end = inliner->ends[function];
+	int first = inliner->count;
+	// List index of every instruction of the callee, for the jumps within
+	// the body.
+	int *body_index = malloc((end - f->index) * sizeof(int));
+
+	int index = f->index;
+	while (index < end) {
+		Instruction instruction = inliner->instructions[index];
+		int next = inliner->nexts[index];
+		if (!inliner->is_reachable[index]) {
+			index = next;
+			continue;
+		}
+		body_index[index - f->index] = inliner->count;
+
+		switch (instruction.op_code) {
+			case OP_LOAD:
+			case OP_STORE:
+			case OP_INCREMENT:
+				instruction.operands[0] += base;
+				append(inliner, &instruction, false);
+				break;
+			case OP_RETURN: {
+				uint32_t locals = instruction.operands[0];
+				if (locals > 0) {
+					Instruction store = {OP_STORE, {base}};
+					append(inliner, &store, true);
+				}
+				if (locals == 2) {
+					Instruction pop = {OP_POP};
+					append(inliner, &pop, true);
+				} else if (locals > 2) {
+					Instruction pop = {OP_POP_N,
+							   {locals - 1}};
+					append(inliner, &pop, true);
+				}
+				Instruction jump = {OP_JUMP, {BODY_END}};
+				append(inliner, &jump, false);
+				break;
+			}
+			default:
+				append(inliner, &instruction, false);
+				break;
+		}
+		index = next;
+	}
+
+	for (int i = first; i < inliner->count; i++) {
+		Instruction *instruction = &inliner->list[i];
+		if (inliner->resolved[i] ||
+		    !has_code_target(instruction->op_code)) {
+			continue;
+		}
+		uint32_t target = instruction->operands[0];
+		instruction->operands[0] =
+		    target == BODY_END ? inliner->count
+				       : body_index[target - f->index];
+		inliner->resolved[i] = true;
+	}
+	free(body_index);
+}
+
+static void append(Inliner *inliner, Instruction *instruction,
+		   bool resolved) {
+	if (inliner->count == inliner->capacity) {
+		inliner->capacity *= 2;
+		inliner->list = realloc(
+		    inliner->list, inliner->capacity * sizeof(Instruction));
+		inliner->resolved = realloc(inliner->resolved,
+					    inliner->capacity * sizeof(bool));
+	}
+	inliner->list[inliner->count] = *instruction;
+	inliner->resolved[inliner->count] = resolved;
+	inliner->count++;
+}
+
+// Resolves the targets of copied code, then lays the list out again.
+static void encode_list(Inliner *inliner) {
+	int *position = malloc((inliner->count + 1) * sizeof(int));
+	int length = 0;
+	for (int i = 0; i < inliner->count; i++) {
+		Instruction *instruction = &inliner->list[i];
+		if (!inliner->resolved[i] &&
+		    has_code_target(instruction->op_code)) {
+			instruction->operands[0] =
+			    inliner->list_index[instruction->operands[0]];
+		}
+		position[i] = length;
+		length += instruction_size(instruction);
+	}
+	position[inliner->count] = length;
+
+	Chunk *chunk = inliner->chunk;
+	chunk->length = 0;
+	for (int i = 0; i < inliner->count; i++) {
+		Instruction instruction = inliner->list[i];
+		if (has_code_target(instruction.op_code)) {
+			instruction.operands[0] =
+			    position[instruction.operands[0]];
+		}
+		write_instruction(chunk, &instruction);
+	}
+
+	FunctionList *flist = inliner->flist;
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		f->index = position[inliner->list_index[f->index]];
+	}
+	free(position);
+}
+
+static bool has_code_target(OpCode op_code) {
+	switch (op_code) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			return true;
+		default:
+			return false;
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include "chunk.h"
+#include "function.h"
+
+// Largest function, in instructions, inlined unless told otherwise.
+#define DEFAULT_INLINE_SIZE 12
+
+// Replaces calls to functions of at most max_size instructions that call
+// nothing themselves with a copy of their body, whose locals live on top of
+// the caller's stack. Functions that only call such functions become
+// candidates once those calls are gone. A max_size of 0 inlines nothing.
+void inline_calls(Chunk *chunk, FunctionList *flist, int max_size);
+
+#endif
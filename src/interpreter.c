@@ -1,5 +1,8 @@
 #include "interpreter.h"
 #include "chunk.h"
+#include "function.h"
+#include "guard.h"
+#include "superinstructions.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,243 +10,804 @@
 //#define DEBUG
 //#define DEBUG_STACK
 
-static uint32_t next(Interpreter *interpreter);
-static void push(Interpreter *interpreter, Object value);
-static Object pop(Interpreter *interpreter);
-static Object make_integer(int value);
-static Object make_boolean(bool value);
+// GCC and Clang support taking the address of a label, which lets every
+// handler jump straight to the next one through a table instead of going
+// back through a single switch. Define AQ_SWITCH_DISPATCH to force the
+// portable switch loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(AQ_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#if defined(DEBUG) && defined(DEBUG_STACK)
+#define TRACE()                                                                \
+	do {                                                                   \
+		print_stack(interpreter, sp, tos, frame);                      \
+		print_op_code(interpreter->chunk,                              \
+			      interpreter->indexes[ip - code]);                \
+	} while (0)
+#elif defined(DEBUG)
+#define TRACE()                                                                \
+	print_op_code(interpreter->chunk, interpreter->indexes[ip - code])
+#elif defined(DEBUG_STACK)
+#define TRACE() print_stack(interpreter, sp, tos, frame)
+#else
+#define TRACE()                                                                \
+	do {                                                                   \
+	} while (0)
+#endif
+
+#ifdef THREADED_DISPATCH
+#define TARGET(op) label_##op:
+#define DISPATCH()                                                             \
+	do {                                                                   \
+		TRACE();                                                       \
+		__extension__({ goto *ip->handler; });                         \
+	} while (0)
+#else
+#define TARGET(op) case op:
+// Not continue, which would only leave the do while of a handler macro.
+#define DISPATCH() goto next_instruction
+#endif
+
+// Decoding is kept out of line, where it cannot take registers away from
+// the dispatch loop.
+#if defined(__GNUC__) || defined(__clang__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+// Room on the value stack for every frame, on average, before it overflows.
+#define VALUES_PER_FRAME 64
+
+// A superinstruction runs a sequence of opcodes from one dispatch. It takes
+// the place of the handler of the first instruction, and the operands stay
+// in the decoded instructions of the sequence.
+typedef struct Superinstruction {
+	int length;
+	OpCode op_codes[3];
+	const void *handler;
+} Superinstruction;
 
-void init_interpreter(Interpreter *interpreter, Chunk *chunk) {
+static NOINLINE void decode_chunk(Interpreter *interpreter,
+				  const void *const *handlers);
+#ifdef THREADED_DISPATCH
+static NOINLINE void attach_memoizer(Interpreter *interpreter,
+				     const void *memo_call,
+				     const void *memo_return);
+static NOINLINE void
+fuse_superinstructions(Interpreter *interpreter, const void *const *handlers,
+		       const Superinstruction *superinstructions, int count);
+static bool matches_sequence(DecodedInstruction *decoded, int remaining,
+			     const void *const *handlers,
+			     const Superinstruction *superinstruction);
+#endif
+static Function *locate_frame_overflow(void *context);
+static void profile_instruction(Interpreter *interpreter,
+				DecodedInstruction *decoded);
+#if defined(DEBUG_STACK)
+static void print_stack(Interpreter *interpreter, Object *sp, Object tos,
+			Frame *frame);
+#endif
+
+void init_interpreter(Interpreter *interpreter, Chunk *chunk,
+		      FunctionList *flist, int max_depth) {
 	interpreter->chunk = chunk;
-	interpreter->index = 0;
-	interpreter->offset = 0;
-	interpreter->stack = malloc(256 * sizeof(Object));
-	interpreter->stack_length = 0;
-	interpreter->frames = malloc(256 * sizeof(Frame));
-	interpreter->frame_count = 0;
+	interpreter->flist = flist;
+	interpreter->max_depth = max_depth;
+	// Neither stack is bounds checked; pushing past the end hits a guard
+	// page instead.
+	interpreter->stack = map_guarded_stack(
+	    (size_t) max_depth * VALUES_PER_FRAME * sizeof(Object), false, NULL,
+	    NULL);
+	interpreter->frames =
+	    map_guarded_stack((size_t) max_depth * sizeof(Frame), false,
+			      locate_frame_overflow, interpreter);
+	interpreter->profiler = NULL;
+	interpreter->memoizer = NULL;
+	init_output(&interpreter->output);
+	interpreter->code = NULL;
+	interpreter->indexes = NULL;
 }
 
 void free_interpreter(Interpreter *interpreter) {
-	free(interpreter->stack);
-	free(interpreter->frames);
+	free_output(&interpreter->output);
+	free(interpreter->code);
+	free(interpreter->indexes);
+	unmap_guarded_stack(interpreter->stack);
+	unmap_guarded_stack(interpreter->frames);
 }
 
+// What every opcode does to the stack, given its decoded instruction i.
+// Opcodes that always continue with the next instruction have a STEP_ that
+// leaves ip alone. Every opcode has an END_ that also moves ip on and
+// dispatches. The handlers are single END_s and the superinstructions are
+// STEP_s followed by an END_.
+//
+// The hot state lives in locals of interpret() so the compiler can keep it
+// in registers: ip is the instruction to execute, tos the value on top of
+// the stack, sp the slot that value is spilled to, fp the first local of
+// the current function and frame the next free call frame.
+//
+// Everything below the top is always in memory, so most opcodes only touch
+// memory for their second operand. Code that reaches the stack through fp
+// has to allow for the top being a local: calls spill it, loads push it,
+// which spills it first, and increments check for it.
+#define STEP_OP_NOOP(i)                                                        \
+	do {                                                                   \
+	} while (0)
+#define STEP_OP_POP(i)                                                         \
+	do {                                                                   \
+		tos = *--sp;                                                   \
+	} while (0)
+#define STEP_OP_PUSH(i)                                                        \
+	do {                                                                   \
+		*sp++ = tos;                                                   \
+		tos.integer = (i)->first.value;                                \
+	} while (0)
+// Spilling first also covers loading the top itself.
+#define STEP_OP_LOAD(i)                                                        \
+	do {                                                                   \
+		*sp++ = tos;                                                   \
+		tos = fp[(i)->first.slot];                                     \
+	} while (0)
+#define STEP_OP_STORE(i)                                                       \
+	do {                                                                   \
+		fp[(i)->first.slot] = tos;                                     \
+		tos = *--sp;                                                   \
+	} while (0)
+#define STEP_OP_PRINT_UNIT(i)                                                  \
+	do {                                                                   \
+		tos = *--sp;                                                   \
+		print_unit(&interpreter->output);                              \
+	} while (0)
+#define STEP_OP_PRINT_INTEGER(i)                                               \
+	do {                                                                   \
+		print_integer(&interpreter->output, tos.integer);              \
+		tos = *--sp;                                                   \
+	} while (0)
+#define STEP_OP_PRINT_BOOLEAN(i)                                               \
+	do {                                                                   \
+		print_boolean(&interpreter->output, tos.integer);              \
+		tos = *--sp;                                                   \
+	} while (0)
+#define ARITHMETIC(operator)                                                   \
+	do {                                                                   \
+		tos.integer = (--sp)->integer operator tos.integer;            \
+	} while (0)
+#define STEP_OP_ADD(i) ARITHMETIC(+)
+#define STEP_OP_SUB(i) ARITHMETIC(-)
+#define STEP_OP_MUL(i) ARITHMETIC(*)
+#define STEP_OP_DIV(i) ARITHMETIC(/)
+#define STEP_OP_NEGATE(i)                                                      \
+	do {                                                                   \
+		tos.integer = -tos.integer;                                    \
+	} while (0)
+#define STEP_OP_SHIFT_LEFT(i)                                                  \
+	do {                                                                   \
+		uint32_t shifted = (uint32_t) tos.integer << (i)->first.count; \
+		tos.integer = (int) shifted;                                   \
+	} while (0)
+#define STEP_OP_DIV_SHIFT(i)                                                   \
+	do {                                                                   \
+		tos.integer = divide_by_shift(tos.integer, (i)->first.count);  \
+	} while (0)
+#define STEP_OP_DIV_MULTIPLY(i)                                                \
+	do {                                                                   \
+		uint32_t magic = (uint32_t) (i)->first.value;                  \
+		uint32_t shift = (i)->second;                                  \
+		tos.integer = divide_by_multiply(tos.integer, magic, shift);   \
+	} while (0)
+#define COMPARISON(operator)                                                   \
+	do {                                                                   \
+		bool result = (--sp)->integer operator tos.integer;            \
+		tos.integer = result ? AQ_TRUE : AQ_FALSE;                     \
+	} while (0)
+#define STEP_OP_EQUAL(i) COMPARISON(==)
+#define STEP_OP_NOT_EQUAL(i) COMPARISON(!=)
+#define STEP_OP_LESS(i) COMPARISON(<)
+#define STEP_OP_LESS_EQUAL(i) COMPARISON(<=)
+#define STEP_OP_GREATER(i) COMPARISON(>)
+#define STEP_OP_GREATER_EQUAL(i) COMPARISON(>=)
+#define STEP_OP_POP_N(i)                                                       \
+	do {                                                                   \
+		sp -= (i)->first.count;                                        \
+		tos = *sp;                                                     \
+	} while (0)
+// Loop counters are often the cached top itself.
+#define STEP_OP_INCREMENT(i)                                                   \
+	do {                                                                   \
+		Object *slot = &fp[(i)->first.slot];                           \
+		if (slot == sp) {                                              \
+			tos.integer += (int) (i)->second;                      \
+		} else {                                                       \
+			slot->integer += (int) (i)->second;                    \
+		}                                                              \
+	} while (0)
+
+#define NEXT(step, i)                                                          \
+	do {                                                                   \
+		step(i);                                                       \
+		ip = (i) + 1;                                                  \
+		DISPATCH();                                                    \
+	} while (0)
+#define END_OP_NOOP(i) NEXT(STEP_OP_NOOP, i)
+#define END_OP_POP(i) NEXT(STEP_OP_POP, i)
+#define END_OP_PUSH(i) NEXT(STEP_OP_PUSH, i)
+#define END_OP_LOAD(i) NEXT(STEP_OP_LOAD, i)
+#define END_OP_STORE(i) NEXT(STEP_OP_STORE, i)
+#define END_OP_PRINT_UNIT(i) NEXT(STEP_OP_PRINT_UNIT, i)
+#define END_OP_PRINT_INTEGER(i) NEXT(STEP_OP_PRINT_INTEGER, i)
+#define END_OP_PRINT_BOOLEAN(i) NEXT(STEP_OP_PRINT_BOOLEAN, i)
+#define END_OP_ADD(i) NEXT(STEP_OP_ADD, i)
+#define END_OP_SUB(i) NEXT(STEP_OP_SUB, i)
+#define END_OP_MUL(i) NEXT(STEP_OP_MUL, i)
+#define END_OP_DIV(i) NEXT(STEP_OP_DIV, i)
+#define END_OP_NEGATE(i) NEXT(STEP_OP_NEGATE, i)
+#define END_OP_SHIFT_LEFT(i) NEXT(STEP_OP_SHIFT_LEFT, i)
+#define END_OP_DIV_SHIFT(i) NEXT(STEP_OP_DIV_SHIFT, i)
+#define END_OP_DIV_MULTIPLY(i) NEXT(STEP_OP_DIV_MULTIPLY, i)
+#define END_OP_EQUAL(i) NEXT(STEP_OP_EQUAL, i)
+#define END_OP_NOT_EQUAL(i) NEXT(STEP_OP_NOT_EQUAL, i)
+#define END_OP_LESS(i) NEXT(STEP_OP_LESS, i)
+#define END_OP_LESS_EQUAL(i) NEXT(STEP_OP_LESS_EQUAL, i)
+#define END_OP_GREATER(i) NEXT(STEP_OP_GREATER, i)
+#define END_OP_GREATER_EQUAL(i) NEXT(STEP_OP_GREATER_EQUAL, i)
+#define END_OP_POP_N(i) NEXT(STEP_OP_POP_N, i)
+#define END_OP_INCREMENT(i) NEXT(STEP_OP_INCREMENT, i)
+
+#define END_OP_EXIT(i) return 0
+#define END_OP_JUMP(i)                                                         \
+	do {                                                                   \
+		ip = (i)->first.target;                                        \
+		DISPATCH();                                                    \
+	} while (0)
+#define END_OP_JUMP_IF_FALSE(i)                                                \
+	do {                                                                   \
+		int cond = tos.integer;                                        \
+		tos = *--sp;                                                   \
+		ip = cond == AQ_FALSE ? (i)->first.target : (i) + 1;           \
+		DISPATCH();                                                    \
+	} while (0)
+// Jumps if the comparison of the top two values holds.
+#define COMPARE_AND_JUMP(i, operator)                                          \
+	do {                                                                   \
+		int right = tos.integer;                                       \
+		int left = sp[-1].integer;                                     \
+		sp -= 2;                                                       \
+		tos = *sp;                                                     \
+		ip = left operator right ? (i)->first.target : (i) + 1;        \
+		DISPATCH();                                                    \
+	} while (0)
+#define END_OP_JUMP_IF_NOT_EQUAL(i) COMPARE_AND_JUMP(i, !=)
+#define END_OP_JUMP_IF_EQUAL(i) COMPARE_AND_JUMP(i, ==)
+#define END_OP_JUMP_IF_NOT_LESS(i) COMPARE_AND_JUMP(i, >=)
+#define END_OP_JUMP_IF_NOT_LESS_EQUAL(i) COMPARE_AND_JUMP(i, >)
+#define END_OP_JUMP_IF_NOT_GREATER(i) COMPARE_AND_JUMP(i, <=)
+#define END_OP_JUMP_IF_NOT_GREATER_EQUAL(i) COMPARE_AND_JUMP(i, <)
+// The callee reads its arguments from memory, so the top is spilled, but
+// it also stays cached.
+#define END_OP_CALL(i)                                                         \
+	do {                                                                   \
+		*sp = tos;                                                     \
+		frame->return_address = (i) + 1;                               \
+		frame->base = fp;                                              \
+		frame++;                                                       \
+		fp = sp + 1 - (i)->second;                                     \
+		ip = (i)->first.target;                                        \
+		DISPATCH();                                                    \
+	} while (0)
+// The return value is the cached top and stays there; only the locals
+// below it are dropped.
+#define END_OP_RETURN(i)                                                       \
+	do {                                                                   \
+		sp -= (i)->first.count;                                        \
+		frame--;                                                       \
+		ip = frame->return_address;                                    \
+		fp = frame->base;                                              \
+		DISPATCH();                                                    \
+	} while (0)
+// The arguments replace the current locals and the callee returns straight
+// to our caller.
+#define END_OP_TAIL_CALL(i)                                                    \
+	do {                                                                   \
+		uint32_t parameter_count = (i)->second;                        \
+		*sp = tos;                                                     \
+		sp = sp + 1 - parameter_count;                                 \
+		for (uint32_t k = 0; k < parameter_count; k++) {               \
+			fp[k] = sp[k];                                         \
+		}                                                              \
+		sp = fp + parameter_count - 1;                                 \
+		tos = *sp;                                                     \
+		ip = (i)->first.target;                                        \
+		DISPATCH();                                                    \
+	} while (0)
+
+#ifdef THREADED_DISPATCH
+#define PAIR_HANDLER(name, a, b)                                               \
+	TARGET(name) {                                                         \
+		STEP_OP_##a(ip);                                               \
+		END_OP_##b(ip + 1);                                            \
+	}
+#define TRIPLE_HANDLER(name, a, b, c)                                          \
+	TARGET(name) {                                                         \
+		STEP_OP_##a(ip);                                               \
+		STEP_OP_##b(ip + 1);                                           \
+		END_OP_##c(ip + 2);                                            \
+	}
+#define PAIR_ENTRY(name, a, b)                                                 \
+	{2, {OP_##a, OP_##b}, __extension__ &&label_##name},
+#define TRIPLE_ENTRY(name, a, b, c)                                            \
+	{3, {OP_##a, OP_##b, OP_##c}, __extension__ &&label_##name},
+#endif
+
 int interpret(Interpreter *interpreter) {
+	// The stack starts with a dummy value so that an empty one still has
+	// a top.
+	DecodedInstruction *ip;
+	Object tos = {0};
+	Object *sp = interpreter->stack;
+	Object *fp = interpreter->stack + 1;
+	Frame *frame = interpreter->frames;
+
+#ifdef THREADED_DISPATCH
+	static const void *const dispatch_table[] = {
+	    [OP_NOOP] = __extension__ &&label_OP_NOOP,
+	    [OP_EXIT] = __extension__ &&label_OP_EXIT,
+	    [OP_POP] = __extension__ &&label_OP_POP,
+	    [OP_PUSH] = __extension__ &&label_OP_PUSH,
+	    [OP_LOAD] = __extension__ &&label_OP_LOAD,
+	    [OP_STORE] = __extension__ &&label_OP_STORE,
+	    [OP_PRINT_UNIT] = __extension__ &&label_OP_PRINT_UNIT,
+	    [OP_PRINT_INTEGER] = __extension__ &&label_OP_PRINT_INTEGER,
+	    [OP_PRINT_BOOLEAN] = __extension__ &&label_OP_PRINT_BOOLEAN,
+	    [OP_ADD] = __extension__ &&label_OP_ADD,
+	    [OP_SUB] = __extension__ &&label_OP_SUB,
+	    [OP_MUL] = __extension__ &&label_OP_MUL,
+	    [OP_DIV] = __extension__ &&label_OP_DIV,
+	    [OP_NEGATE] = __extension__ &&label_OP_NEGATE,
+	    [OP_SHIFT_LEFT] = __extension__ &&label_OP_SHIFT_LEFT,
+	    [OP_DIV_SHIFT] = __extension__ &&label_OP_DIV_SHIFT,
+	    [OP_DIV_MULTIPLY] = __extension__ &&label_OP_DIV_MULTIPLY,
+	    [OP_EQUAL] = __extension__ &&label_OP_EQUAL,
+	    [OP_NOT_EQUAL] = __extension__ &&label_OP_NOT_EQUAL,
+	    [OP_LESS] = __extension__ &&label_OP_LESS,
+	    [OP_LESS_EQUAL] = __extension__ &&label_OP_LESS_EQUAL,
+	    [OP_GREATER] = __extension__ &&label_OP_GREATER,
+	    [OP_GREATER_EQUAL] = __extension__ &&label_OP_GREATER_EQUAL,
+	    [OP_JUMP] = __extension__ &&label_OP_JUMP,
+	    [OP_JUMP_IF_FALSE] = __extension__ &&label_OP_JUMP_IF_FALSE,
+	    [OP_CALL] = __extension__ &&label_OP_CALL,
+	    [OP_RETURN] = __extension__ &&label_OP_RETURN,
+	    [OP_TAIL_CALL] = __extension__ &&label_OP_TAIL_CALL,
+	    [OP_POP_N] = __extension__ &&label_OP_POP_N,
+	    [OP_INCREMENT] = __extension__ &&label_OP_INCREMENT,
+	    [OP_JUMP_IF_NOT_EQUAL] = __extension__ &&label_OP_JUMP_IF_NOT_EQUAL,
+	    [OP_JUMP_IF_EQUAL] = __extension__ &&label_OP_JUMP_IF_EQUAL,
+	    [OP_JUMP_IF_NOT_LESS] = __extension__ &&label_OP_JUMP_IF_NOT_LESS,
+	    [OP_JUMP_IF_NOT_LESS_EQUAL] =
+		__extension__ &&label_OP_JUMP_IF_NOT_LESS_EQUAL,
+	    [OP_JUMP_IF_NOT_GREATER] =
+		__extension__ &&label_OP_JUMP_IF_NOT_GREATER,
+	    [OP_JUMP_IF_NOT_GREATER_EQUAL] =
+		__extension__ &&label_OP_JUMP_IF_NOT_GREATER_EQUAL,
+	};
+	// Longer sequences first, so that they win where several match.
+	static const Superinstruction superinstructions[] = {
+	    SUPERINSTRUCTION_TRIPLES(TRIPLE_ENTRY)
+		SUPERINSTRUCTION_PAIRS(PAIR_ENTRY)};
+
+	// Profiling sends every instruction through the hook below, so the
+	// normal path pays nothing for it. Superinstructions would hide the
+	// opcodes they run from it.
+	const void *profile_table[sizeof(dispatch_table) / sizeof(void *)];
+	if (interpreter->profiler != NULL) {
+		for (size_t i = 0; i < sizeof(dispatch_table) / sizeof(void *);
+		     i++) {
+			profile_table[i] = __extension__ &&label_profile;
+		}
+		decode_chunk(interpreter, profile_table);
+	} else {
+		decode_chunk(interpreter, dispatch_table);
+		if (interpreter->memoizer != NULL) {
+			attach_memoizer(interpreter, __extension__ &&memo_call,
+					__extension__ &&memo_return);
+		}
+		fuse_superinstructions(interpreter, dispatch_table,
+				       superinstructions,
+				       sizeof(superinstructions) /
+					   sizeof(Superinstruction));
+	}
+	DecodedInstruction *code = interpreter->code;
+	ip = code;
+
+	DISPATCH();
+
+label_profile:
+	profile_instruction(interpreter, ip);
+	__extension__({ goto *dispatch_table[ip->op_code]; });
+#else
+	decode_chunk(interpreter, NULL);
+	DecodedInstruction *code = interpreter->code;
+	ip = code;
 	for (;;) {
-#ifdef DEBUG
-		print_op_code(interpreter->chunk, interpreter->index);
+	next_instruction:
+		TRACE();
+		if (interpreter->profiler != NULL) {
+			profile_instruction(interpreter, ip);
+		}
+		switch (ip->op_code) {
 #endif
-		OpCode op_code = next(interpreter);
-		// printf("INDEX: %d, OFFSET: %d\n", interpreter->index-1,
-		// interpreter->offset);
-		switch (op_code) {
-			case OP_NOOP:
-				break;
-			case OP_EXIT:
-				return 0;
-			case OP_PUSH: {
-				int value = next(interpreter);
-				push(interpreter, make_integer(value));
-				break;
-			}
-			case OP_POP: {
-				pop(interpreter);
-				break;
-			}
-			case OP_LOAD: {
-				int index = next(interpreter);
-				int var_index = interpreter->offset + index;
-				Object var_value =
-				    interpreter->stack[var_index];
-				push(interpreter, var_value);
-				break;
-			}
-			case OP_STORE: {
-				int index = next(interpreter);
-				int var_index = interpreter->offset + index;
-				Object *var_location =
-				    &interpreter->stack[var_index];
-				Object object = pop(interpreter);
-				*var_location = object;
-				break;
-			}
-			case OP_PRINT_UNIT: {
-				pop(interpreter);
-				printf("unit\n");
-				break;
-			}
-			case OP_PRINT_INTEGER: {
-				int value = pop(interpreter).integer;
-				printf("%d\n", value);
-				break;
-			}
-			case OP_PRINT_BOOLEAN: {
-				int value = pop(interpreter).integer;
-				if (value == AQ_TRUE) {
-					printf("true\n");
-				} else {
-					printf("false\n");
-				}
-				break;
-			}
-			case OP_ADD: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				int result = b + a;
-				push(interpreter, make_integer(result));
-				break;
-			}
-			case OP_SUB: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				int result = b - a;
-				push(interpreter, make_integer(result));
-				break;
-			}
-			case OP_MUL: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				int result = b * a;
-				push(interpreter, make_integer(result));
-				break;
-			}
-			case OP_DIV: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				int result = b / a;
-				push(interpreter, make_integer(result));
-				break;
+		TARGET(OP_NOOP) {
+			END_OP_NOOP(ip);
+		}
+		TARGET(OP_EXIT) {
+			END_OP_EXIT(ip);
+		}
+		TARGET(OP_PUSH) {
+			END_OP_PUSH(ip);
+		}
+		TARGET(OP_POP) {
+			END_OP_POP(ip);
+		}
+		TARGET(OP_LOAD) {
+			END_OP_LOAD(ip);
+		}
+		TARGET(OP_STORE) {
+			END_OP_STORE(ip);
+		}
+		TARGET(OP_PRINT_UNIT) {
+			END_OP_PRINT_UNIT(ip);
+		}
+		TARGET(OP_PRINT_INTEGER) {
+			END_OP_PRINT_INTEGER(ip);
+		}
+		TARGET(OP_PRINT_BOOLEAN) {
+			END_OP_PRINT_BOOLEAN(ip);
+		}
+		TARGET(OP_ADD) {
+			END_OP_ADD(ip);
+		}
+		TARGET(OP_SUB) {
+			END_OP_SUB(ip);
+		}
+		TARGET(OP_MUL) {
+			END_OP_MUL(ip);
+		}
+		TARGET(OP_DIV) {
+			END_OP_DIV(ip);
+		}
+		TARGET(OP_NEGATE) {
+			END_OP_NEGATE(ip);
+		}
+		TARGET(OP_SHIFT_LEFT) {
+			END_OP_SHIFT_LEFT(ip);
+		}
+		TARGET(OP_DIV_SHIFT) {
+			END_OP_DIV_SHIFT(ip);
+		}
+		TARGET(OP_DIV_MULTIPLY) {
+			END_OP_DIV_MULTIPLY(ip);
+		}
+		TARGET(OP_EQUAL) {
+			END_OP_EQUAL(ip);
+		}
+		TARGET(OP_NOT_EQUAL) {
+			END_OP_NOT_EQUAL(ip);
+		}
+		TARGET(OP_LESS) {
+			END_OP_LESS(ip);
+		}
+		TARGET(OP_LESS_EQUAL) {
+			END_OP_LESS_EQUAL(ip);
+		}
+		TARGET(OP_GREATER) {
+			END_OP_GREATER(ip);
+		}
+		TARGET(OP_GREATER_EQUAL) {
+			END_OP_GREATER_EQUAL(ip);
+		}
+		TARGET(OP_JUMP_IF_FALSE) {
+			END_OP_JUMP_IF_FALSE(ip);
+		}
+		TARGET(OP_JUMP) {
+			END_OP_JUMP(ip);
+		}
+		TARGET(OP_CALL) {
+#ifndef THREADED_DISPATCH
+			if (interpreter->memoizer != NULL) {
+				goto memo_call;
 			}
-			case OP_NEGATE: {
-				int a = pop(interpreter).integer;
-				int result = -a;
-				push(interpreter, make_integer(result));
-				break;
+#endif
+			END_OP_CALL(ip);
+		}
+		TARGET(OP_RETURN) {
+#ifndef THREADED_DISPATCH
+			if (interpreter->memoizer != NULL) {
+				goto memo_return;
 			}
-			case OP_EQUAL: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b == a;
-				push(interpreter, make_boolean(result));
-				break;
+#endif
+			END_OP_RETURN(ip);
+		}
+		TARGET(OP_TAIL_CALL) {
+			END_OP_TAIL_CALL(ip);
+		}
+		TARGET(OP_POP_N) {
+			END_OP_POP_N(ip);
+		}
+		TARGET(OP_INCREMENT) {
+			END_OP_INCREMENT(ip);
+		}
+		TARGET(OP_JUMP_IF_NOT_EQUAL) {
+			END_OP_JUMP_IF_NOT_EQUAL(ip);
+		}
+		TARGET(OP_JUMP_IF_EQUAL) {
+			END_OP_JUMP_IF_EQUAL(ip);
+		}
+		TARGET(OP_JUMP_IF_NOT_LESS) {
+			END_OP_JUMP_IF_NOT_LESS(ip);
+		}
+		TARGET(OP_JUMP_IF_NOT_LESS_EQUAL) {
+			END_OP_JUMP_IF_NOT_LESS_EQUAL(ip);
+		}
+		TARGET(OP_JUMP_IF_NOT_GREATER) {
+			END_OP_JUMP_IF_NOT_GREATER(ip);
+		}
+		TARGET(OP_JUMP_IF_NOT_GREATER_EQUAL) {
+			END_OP_JUMP_IF_NOT_GREATER_EQUAL(ip);
+		}
+		// Calls to pure functions look their result up first. Once a
+		// call misses, the RETURN of the frame it made stores the
+		// result. With tail calls that may be the RETURN of another
+		// function, but it returns the same value.
+		memo_call: {
+			Memoizer *memoizer = interpreter->memoizer;
+			DecodedInstruction *callee = ip->first.target;
+			int index = interpreter->indexes[callee - code];
+			MemoTable *table = memoizer->table_at[index];
+			if (table == NULL || !memo_should_cache(table)) {
+				END_OP_CALL(ip);
 			}
-			case OP_NOT_EQUAL: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b != a;
-				push(interpreter, make_boolean(result));
-				break;
+			MemoCall *call = memo_next_call(memoizer);
+			*sp = tos;
+			Object *arguments = sp + 1 - ip->second;
+			for (int k = 0; k < MEMO_MAX_ARGUMENTS; k++) {
+				call->arguments[k] = k < (int) ip->second
+							 ? arguments[k].integer
+							 : 0;
 			}
-			case OP_LESS: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b < a;
-				push(interpreter, make_boolean(result));
-				break;
+			bool hit;
+			MemoEntry *entry = memo_lookup(table, call, &hit);
+			if (hit) {
+				sp = arguments;
+				tos.integer = entry->result;
+				ip++;
+				DISPATCH();
 			}
-			case OP_LESS_EQUAL: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b <= a;
-				push(interpreter, make_boolean(result));
-				break;
+			call->depth = frame - interpreter->frames;
+			call->entry = entry;
+			memoizer->call_count++;
+			END_OP_CALL(ip);
+		}
+		memo_return: {
+			Memoizer *memoizer = interpreter->memoizer;
+			int depth = frame - 1 - interpreter->frames;
+			int count = memoizer->call_count;
+			if (count > 0 &&
+			    memoizer->calls[count - 1].depth == depth) {
+				memo_store(&memoizer->calls[count - 1],
+					   tos.integer);
+				memoizer->call_count--;
 			}
-			case OP_GREATER: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b > a;
-				push(interpreter, make_boolean(result));
+			END_OP_RETURN(ip);
+		}
+#ifdef THREADED_DISPATCH
+		SUPERINSTRUCTION_TRIPLES(TRIPLE_HANDLER)
+		SUPERINSTRUCTION_PAIRS(PAIR_HANDLER)
+#else
+		default:
+			flush_output(&interpreter->output);
+			fprintf(stderr, "Invalid opcode: %d\n", ip->op_code);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+#endif
+	return 0;
+}
+
+// Translates the chunk into interpreter->code, with the handlers for every
+// opcode in handlers, or none for the switch loop. Running off the end of
+// the code reaches an extra OP_EXIT.
+static void decode_chunk(Interpreter *interpreter,
+			 const void *const *handlers) {
+	Chunk *chunk = interpreter->chunk;
+	int *positions = malloc((chunk->length + 1) * sizeof(int));
+	int count = 0;
+	int index = 0;
+	while (index < chunk->length) {
+		Instruction instruction;
+		positions[index] = count++;
+		index = decode_instruction(chunk, index, &instruction);
+	}
+	positions[chunk->length] = count;
+
+	free(interpreter->code);
+	free(interpreter->indexes);
+	DecodedInstruction *code =
+	    malloc((count + 1) * sizeof(DecodedInstruction));
+	interpreter->code = code;
+	interpreter->code_length = count;
+	interpreter->indexes = malloc((count + 1) * sizeof(int));
+
+	index = 0;
+	for (int i = 0; i <= count; i++) {
+		Instruction instruction;
+		interpreter->indexes[i] = index;
+		if (i < count) {
+			index = decode_instruction(chunk, index, &instruction);
+		} else {
+			instruction.op_code = OP_EXIT;
+		}
+
+		DecodedInstruction *decoded = &code[i];
+		uint32_t *operands = instruction.operands;
+		decoded->op_code = instruction.op_code;
+		decoded->handler =
+		    handlers != NULL ? handlers[instruction.op_code] : NULL;
+		decoded->second = 0;
+		decoded->first.value = 0;
+		switch (instruction.op_code) {
+			case OP_PUSH:
+				decoded->first.value = (int) operands[0];
 				break;
-			}
-			case OP_GREATER_EQUAL: {
-				int a = pop(interpreter).integer;
-				int b = pop(interpreter).integer;
-				bool result = b >= a;
-				push(interpreter, make_boolean(result));
+			case OP_LOAD:
+			case OP_STORE:
+				decoded->first.slot = operands[0];
 				break;
-			}
-			case OP_JUMP_IF_FALSE: {
-				int cond = pop(interpreter).integer;
-				int dest = next(interpreter);
-				if (cond == AQ_FALSE) {
-					interpreter->index = dest;
-				}
+			case OP_RETURN:
+			case OP_POP_N:
+			case OP_SHIFT_LEFT:
+			case OP_DIV_SHIFT:
+				decoded->first.count = operands[0];
 				break;
-			}
-			case OP_JUMP: {
-				int dest = next(interpreter);
-				interpreter->index = dest;
+			case OP_DIV_MULTIPLY:
+				decoded->first.value = (int) operands[0];
+				decoded->second = operands[1];
 				break;
-			}
-			case OP_CALL: {
-				int frame_index = interpreter->frame_count++;
-				Frame *frame =
-				    &interpreter->frames[frame_index];
-				frame->offset = interpreter->offset;
-				interpreter->offset = interpreter->stack_length;
-
-				int dest = next(interpreter);
-				int parameter_count = next(interpreter);
-				interpreter->offset -= parameter_count;
-				frame->return_address = interpreter->index;
-				interpreter->index = dest;
+			case OP_INCREMENT:
+				decoded->first.slot = operands[0];
+				decoded->second = operands[1];
 				break;
-			}
-			case OP_RETURN: {
-				Object return_value = pop(interpreter);
-				int pops = next(interpreter);
-				for (int i = 0; i < pops; i++) {
-					pop(interpreter);
-				}
-				push(interpreter, return_value);
-
-				int frame_index = --interpreter->frame_count;
-				Frame *frame =
-				    &interpreter->frames[frame_index];
-				interpreter->index = frame->return_address;
-				interpreter->offset = frame->offset;
+			case OP_CALL:
+			case OP_TAIL_CALL:
+				decoded->second = operands[1];
+				// Fall through to resolve the target.
+			case OP_JUMP:
+			case OP_JUMP_IF_FALSE:
+			case OP_JUMP_IF_NOT_EQUAL:
+			case OP_JUMP_IF_EQUAL:
+			case OP_JUMP_IF_NOT_LESS:
+			case OP_JUMP_IF_NOT_LESS_EQUAL:
+			case OP_JUMP_IF_NOT_GREATER:
+			case OP_JUMP_IF_NOT_GREATER_EQUAL:
+				decoded->first.target =
+				    &code[positions[operands[0]]];
 				break;
-			}
 			default:
-				fprintf(stderr, "Invalid opcode: %d\n",
-					op_code);
-				exit(EXIT_FAILURE);
 				break;
 		}
-#ifdef DEBUG_STACK
-		for (int i = 0; i < interpreter->frame_count; i++) {
-			printf("    ");
-		}
-		printf("\\- Stack: ");
-		for (int j = 0; j < interpreter->stack_length; ++j) {
-			printf("%d, ", interpreter->stack[j].integer);
+	}
+
+	free(positions);
+}
+
+#ifdef THREADED_DISPATCH
+// Sends calls to memoized functions and every return through the
+// memoizer.
+static void attach_memoizer(Interpreter *interpreter, const void *memo_call,
+			    const void *memo_return) {
+	MemoTable **table_at = interpreter->memoizer->table_at;
+	DecodedInstruction *code = interpreter->code;
+	for (int i = 0; i < interpreter->code_length; i++) {
+		DecodedInstruction *decoded = &code[i];
+		if (decoded->op_code == OP_CALL) {
+			int callee = decoded->first.target - code;
+			if (table_at[interpreter->indexes[callee]] != NULL) {
+				decoded->handler = memo_call;
+			}
+		} else if (decoded->op_code == OP_RETURN) {
+			decoded->handler = memo_return;
 		}
-		printf("\n");
-#endif
 	}
-	return 0;
 }
 
-static uint32_t next(Interpreter *interpreter) {
-	return interpreter->chunk->code[interpreter->index++];
+// The first of the superinstructions that matches at an instruction, if
+// any, replaces its handler, and matching carries on after the sequence.
+// The rest of the sequence keeps its own handlers, so jumping into the
+// middle of it is fine. Instructions with special handlers are left alone.
+static void fuse_superinstructions(Interpreter *interpreter,
+				   const void *const *handlers,
+				   const Superinstruction *superinstructions,
+				   int count) {
+	DecodedInstruction *code = interpreter->code;
+	int length = interpreter->code_length;
+	for (int i = 0; i < length;) {
+		int fused = 1;
+		for (int k = 0; k < count; k++) {
+			if (matches_sequence(&code[i], length - i, handlers,
+					     &superinstructions[k])) {
+				code[i].handler = superinstructions[k].handler;
+				fused = superinstructions[k].length;
+				break;
+			}
+		}
+		i += fused;
+	}
 }
 
-static void push(Interpreter *interpreter, Object value) {
-	interpreter->stack[interpreter->stack_length++] = value;
+static bool matches_sequence(DecodedInstruction *decoded, int remaining,
+			     const void *const *handlers,
+			     const Superinstruction *superinstruction) {
+	if (superinstruction->length > remaining) {
+		return false;
+	}
+	for (int k = 0; k < superinstruction->length; k++) {
+		OpCode op_code = superinstruction->op_codes[k];
+		if (decoded[k].op_code != op_code ||
+		    decoded[k].handler != handlers[op_code]) {
+			return false;
+		}
+	}
+	return true;
 }
+#endif
 
-static Object pop(Interpreter *interpreter) {
-	return interpreter->stack[--interpreter->stack_length];
+// The frame stack only overflows in OP_CALL, after the last frame was
+// filled by the call into the function that is running now.
+static Function *locate_frame_overflow(void *context) {
+	Interpreter *interpreter = context;
+	Frame *last = &interpreter->frames[interpreter->max_depth - 1];
+	DecodedInstruction *callee = last->return_address[-1].first.target;
+	int index = interpreter->indexes[callee - interpreter->code];
+	return find_function_at(interpreter->flist, index);
 }
 
-static Object make_integer(int value) {
-	Object object;
-	object.integer = value;
-	return object;
+// Profiles the instruction the interpreter is about to run.
+static void profile_instruction(Interpreter *interpreter,
+				DecodedInstruction *decoded) {
+	Profiler *profiler = interpreter->profiler;
+	OpCode op_code = decoded->op_code;
+	profiler->op_counts[op_code]++;
+	if (profiler->sequences != NULL) {
+		profile_sequence(profiler, op_code, decoded - interpreter->code);
+	}
+	if (op_code == OP_CALL || op_code == OP_TAIL_CALL) {
+		if (op_code == OP_TAIL_CALL) {
+			profile_return(profiler);
+		}
+		DecodedInstruction *callee = decoded->first.target;
+		profile_call(profiler,
+			     interpreter->indexes[callee - interpreter->code]);
+	} else if (op_code == OP_RETURN) {
+		profile_return(profiler);
+	}
 }
 
-static Object make_boolean(bool value) {
-	Object object;
-	object.integer = value ? AQ_TRUE : AQ_FALSE;
-	return object;
+#if defined(DEBUG_STACK)
+// Leaves out the dummy value at the bottom.
+static void print_stack(Interpreter *interpreter, Object *sp, Object tos,
+			Frame *frame) {
+	for (Frame *f = interpreter->frames; f < frame; f++) {
+		printf("    ");
+	}
+	printf("\\- Stack: ");
+	for (Object *object = interpreter->stack + 1; object < sp; object++) {
+		printf("%d, ", object->integer);
+	}
+	if (sp > interpreter->stack) {
+		printf("%d, ", tos.integer);
+	}
+	printf("\n");
 }
+#endif
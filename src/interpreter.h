@@ -1,29 +1,60 @@
-#ifndef INTERPETER_H
-#define INTERPRETE_H
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
 
 #include "chunk.h"
+#include "function.h"
+#include "memo.h"
+#include "output.h"
+#include "profiler.h"
 #include <stdbool.h>
 
-typedef struct Frame {
-	int return_address;
-	int offset;
-} Frame;
-
 typedef union Object {
 	int integer;
 } Object;
 
+// The chunk is translated into these before it runs: every instruction
+// carries the address of its handler, its operands are unpacked and jump
+// and call targets point straight at the instruction they lead to.
+typedef struct DecodedInstruction {
+	const void *handler;
+	OpCode op_code;
+	// Argument count of calls, amount of increments and the shift of
+	// OP_DIV_MULTIPLY.
+	uint32_t second;
+	union {
+		int value;
+		uint32_t slot;
+		uint32_t count;
+		struct DecodedInstruction *target;
+	} first;
+} DecodedInstruction;
+
+typedef struct Frame {
+	DecodedInstruction *return_address;
+	Object *base;
+} Frame;
+
+#define DEFAULT_MAX_DEPTH 100000
+
 typedef struct Interpreter {
 	Chunk *chunk;
-	int index;
-	int offset;
+	FunctionList *flist;
 	Object *stack;
-	int stack_length;
 	Frame *frames;
-	int frame_count;
+	int max_depth;
+	Profiler *profiler;
+	// Caches the results of pure functions if not NULL.
+	Memoizer *memoizer;
+	Output output;
+	DecodedInstruction *code;
+	// Decoded instructions, without the OP_EXIT after them.
+	int code_length;
+	// Chunk index each decoded instruction came from.
+	int *indexes;
 } Interpreter;
 
-void init_interpreter(Interpreter *interpreter, Chunk *chunk);
+void init_interpreter(Interpreter *interpreter, Chunk *chunk,
+		      FunctionList *flist, int max_depth);
 void free_interpreter(Interpreter *interpreter);
 
 int interpret(Interpreter *interpreter);
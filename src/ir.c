@@ -0,0 +1,484 @@
+#include "ir.h"
+#include "arena.h"
+#include "chunk.h"
+#include "function.h"
+#include "type.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static IrInstruction *append_instruction(IrBuilder *builder);
+static void reserve_instructions(Arena *arena, IrFunction *function,
+				 int count);
+static void reserve_arguments(Arena *arena, IrFunction *function, int count);
+static void init_instruction(IrInstruction *instruction, IrOp op, Type type,
+			     int first, int second, int immediate);
+static void print_ir_function(FILE *file, IrFunction *function,
+			      FunctionList *flist);
+static void print_ir_instruction(FILE *file, IrFunction *function, int index,
+				 FunctionList *flist);
+static const char *ir_op_name(IrOp op);
+
+void init_ir_program(IrProgram *program, Arena *arena) {
+	program->arena = arena;
+	program->functions = arena_alloc(arena, 4 * sizeof(IrFunction));
+	program->count = 0;
+	program->capacity = 4;
+}
+
+void print_ir_program(FILE *file, IrProgram *program, FunctionList *flist) {
+	for (int i = 0; i < program->count; i++) {
+		Function *f = &flist->functions[i];
+		fprintf(file, "%.*s(", f->name.length, f->name.start);
+		for (int j = 0; j < f->parameter_count; j++) {
+			if (j > 0) {
+				fprintf(file, ", ");
+			}
+			print_type(file, f->parameter_types[j]);
+		}
+		fprintf(file, "): ");
+		print_type(file, f->return_type);
+		fprintf(file, "\n");
+		print_ir_function(file, &program->functions[i], flist);
+	}
+}
+
+void init_ir_builder(IrBuilder *builder, Arena *arena) {
+	builder->arena = arena;
+	builder->block_capacity = 16;
+	IrFunction *function = &builder->function;
+	function->instructions =
+	    arena_alloc(arena, 64 * sizeof(IrInstruction));
+	function->instruction_capacity = 64;
+	function->arguments = arena_alloc(arena, 16 * sizeof(int));
+	function->argument_capacity = 16;
+	function->blocks = arena_alloc(arena, 16 * sizeof(IrBlock));
+	begin_ir_function(builder, 0);
+}
+
+void begin_ir_function(IrBuilder *builder, int parameter_count) {
+	IrFunction *function = &builder->function;
+	function->instruction_count = 0;
+	function->argument_count = 0;
+	function->block_count = 0;
+	function->parameter_count = parameter_count;
+	function->slot_count = parameter_count;
+	function->temp_count = 0;
+	builder->current = -1;
+	start_ir_block(builder);
+}
+
+// The last block ends if it has not already, so every block has a
+// terminator.
+void finish_ir_function(IrBuilder *builder, IrProgram *program) {
+	if (builder->current >= 0) {
+		emit_ir(builder, IR_END, TY_UNIT, -1, -1, 0);
+	}
+
+	if (program->count == program->capacity) {
+		program->functions = arena_resize(
+		    program->arena, program->functions,
+		    program->capacity * sizeof(IrFunction),
+		    2 * program->capacity * sizeof(IrFunction));
+		program->capacity *= 2;
+	}
+	IrFunction *built = &builder->function;
+	IrFunction *function = &program->functions[program->count++];
+	*function = *built;
+	size_t size = built->instruction_count * sizeof(IrInstruction);
+	function->instructions = arena_alloc(program->arena, size);
+	function->instruction_capacity = built->instruction_count;
+	memcpy(function->instructions, built->instructions, size);
+	size = built->argument_count * sizeof(int);
+	function->arguments = arena_alloc(program->arena, size);
+	function->argument_capacity = built->argument_count;
+	memcpy(function->arguments, built->arguments, size);
+	size = built->block_count * sizeof(IrBlock);
+	function->blocks = arena_alloc(program->arena, size);
+	memcpy(function->blocks, built->blocks, size);
+}
+
+int start_ir_block(IrBuilder *builder) {
+	IrFunction *function = &builder->function;
+	int block = function->block_count;
+	if (builder->current >= 0) {
+		int jump = emit_ir(builder, IR_JUMP, TY_UNIT, -1, -1, 0);
+		patch_ir_target(builder, jump, 0, block);
+	}
+
+	if (function->block_count == builder->block_capacity) {
+		function->blocks = arena_resize(
+		    builder->arena, function->blocks,
+		    builder->block_capacity * sizeof(IrBlock),
+		    2 * builder->block_capacity * sizeof(IrBlock));
+		builder->block_capacity *= 2;
+	}
+	IrBlock *new_block = &function->blocks[function->block_count++];
+	new_block->first = -1;
+	new_block->last = -1;
+	new_block->is_removed = false;
+	builder->current = block;
+	return block;
+}
+
+int emit_ir(IrBuilder *builder, IrOp op, Type type, int first, int second,
+	    int immediate) {
+	IrInstruction *instruction = append_instruction(builder);
+	init_instruction(instruction, op, type, first, second, immediate);
+	if (is_ir_terminator(op)) {
+		builder->current = -1;
+	}
+	return builder->function.instruction_count - 1;
+}
+
+int emit_ir_call(IrBuilder *builder, Type type, int function,
+		 int *arguments, int argument_count) {
+	IrFunction *built = &builder->function;
+	reserve_arguments(builder->arena, built, argument_count);
+	int first = built->argument_count;
+	memcpy(&built->arguments[first], arguments,
+	       argument_count * sizeof(int));
+	built->argument_count += argument_count;
+
+	int call = emit_ir(builder, IR_CALL, type, first, -1, function);
+	built->instructions[call].count = argument_count;
+	return call;
+}
+
+void patch_ir_target(IrBuilder *builder, int instruction, int which,
+		     int block) {
+	builder->function.instructions[instruction].targets[which] = block;
+}
+
+void set_ir_count(IrBuilder *builder, int instruction, int count) {
+	builder->function.instructions[instruction].count = count;
+}
+
+void note_ir_slots(IrBuilder *builder, int slot_count) {
+	if (slot_count > builder->function.slot_count) {
+		builder->function.slot_count = slot_count;
+	}
+}
+
+int insert_ir(IrProgram *program, IrFunction *function, int block, int after,
+	      IrOp op, Type type, int first, int second, int immediate) {
+	reserve_instructions(program->arena, function, 1);
+	int index = function->instruction_count++;
+	IrInstruction *instruction = &function->instructions[index];
+	init_instruction(instruction, op, type, first, second, immediate);
+
+	IrBlock *inserted_into = &function->blocks[block];
+	if (after >= 0) {
+		instruction->next = function->instructions[after].next;
+		function->instructions[after].next = index;
+	} else {
+		instruction->next = inserted_into->first;
+		inserted_into->first = index;
+	}
+	if (instruction->next < 0) {
+		inserted_into->last = index;
+	}
+	return index;
+}
+
+int add_ir_arguments(IrProgram *program, IrFunction *function,
+		     int *arguments, int count) {
+	reserve_arguments(program->arena, function, count);
+	int first = function->argument_count;
+	memcpy(&function->arguments[first], arguments, count * sizeof(int));
+	function->argument_count += count;
+	return first;
+}
+
+int add_ir_temp(IrFunction *function) {
+	return function->slot_count + function->temp_count++;
+}
+
+int *ir_operands(IrFunction *function, IrInstruction *instruction,
+		 int *count) {
+	if (instruction->op == IR_NOP) {
+		*count = 0;
+		return instruction->operands;
+	}
+	if (instruction->op == IR_CALL) {
+		*count = instruction->count;
+		return &function->arguments[instruction->operands[0]];
+	}
+	*count = 0;
+	while (*count < 2 && instruction->operands[*count] >= 0) {
+		(*count)++;
+	}
+	return instruction->operands;
+}
+
+bool is_ir_terminator(IrOp op) {
+	return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN ||
+	       op == IR_END;
+}
+
+bool is_ir_pure(IrOp op) {
+	switch (op) {
+		case IR_CONSTANT:
+		case IR_LOAD:
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+		case IR_NEGATE:
+		case IR_SHIFT_LEFT:
+		case IR_DIV_SHIFT:
+		case IR_DIV_MULTIPLY:
+		case IR_EQUAL:
+		case IR_NOT_EQUAL:
+		case IR_LESS:
+		case IR_LESS_EQUAL:
+		case IR_GREATER:
+		case IR_GREATER_EQUAL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool fold_ir_binary(IrOp op, int a, int b, int *result) {
+	unsigned int x = (unsigned int) a;
+	unsigned int y = (unsigned int) b;
+	switch (op) {
+		case IR_ADD:
+			*result = (int) (x + y);
+			return true;
+		case IR_SUB:
+			*result = (int) (x - y);
+			return true;
+		case IR_MUL:
+			*result = (int) (x * y);
+			return true;
+		case IR_DIV:
+			if (b == 0 || (a == INT_MIN && b == -1)) {
+				return false;
+			}
+			*result = a / b;
+			return true;
+		case IR_EQUAL:
+			*result = a == b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		case IR_NOT_EQUAL:
+			*result = a != b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		case IR_LESS:
+			*result = a < b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		case IR_LESS_EQUAL:
+			*result = a <= b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		case IR_GREATER:
+			*result = a > b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		case IR_GREATER_EQUAL:
+			*result = a >= b ? AQ_TRUE : AQ_FALSE;
+			return true;
+		default:
+			return false;
+	}
+}
+
+static IrInstruction *append_instruction(IrBuilder *builder) {
+	if (builder->current < 0) {
+		start_ir_block(builder);
+	}
+	IrFunction *function = &builder->function;
+	reserve_instructions(builder->arena, function, 1);
+	int index = function->instruction_count++;
+	IrInstruction *instruction = &function->instructions[index];
+	instruction->next = -1;
+
+	IrBlock *block = &function->blocks[builder->current];
+	if (block->last >= 0) {
+		function->instructions[block->last].next = index;
+	} else {
+		block->first = index;
+	}
+	block->last = index;
+	return instruction;
+}
+
+static void reserve_instructions(Arena *arena, IrFunction *function,
+				 int count) {
+	int capacity = function->instruction_capacity;
+	if (function->instruction_count + count <= capacity) {
+		return;
+	}
+	int grown = capacity > 0 ? 2 * capacity : 16;
+	while (function->instruction_count + count > grown) {
+		grown *= 2;
+	}
+	function->instructions =
+	    arena_resize(arena, function->instructions,
+			 capacity * sizeof(IrInstruction),
+			 grown * sizeof(IrInstruction));
+	function->instruction_capacity = grown;
+}
+
+static void reserve_arguments(Arena *arena, IrFunction *function, int count) {
+	int capacity = function->argument_capacity;
+	if (function->argument_count + count <= capacity) {
+		return;
+	}
+	int grown = capacity > 0 ? 2 * capacity : 16;
+	while (function->argument_count + count > grown) {
+		grown *= 2;
+	}
+	function->arguments = arena_resize(arena, function->arguments,
+					   capacity * sizeof(int),
+					   grown * sizeof(int));
+	function->argument_capacity = grown;
+}
+
+// The instruction has no count, targets or next instruction yet.
+static void init_instruction(IrInstruction *instruction, IrOp op, Type type,
+			     int first, int second, int immediate) {
+	instruction->op = op;
+	instruction->type = type;
+	instruction->operands[0] = first;
+	instruction->operands[1] = second;
+	instruction->immediate = immediate;
+	instruction->count = 0;
+	instruction->targets[0] = -1;
+	instruction->targets[1] = -1;
+}
+
+static void print_ir_function(FILE *file, IrFunction *function,
+			      FunctionList *flist) {
+	for (int i = 0; i < function->block_count; i++) {
+		IrBlock *block = &function->blocks[i];
+		if (block->is_removed) {
+			continue;
+		}
+		fprintf(file, "b%d:\n", i);
+		for (int j = block->first; j >= 0;
+		     j = function->instructions[j].next) {
+			if (function->instructions[j].op != IR_NOP) {
+				print_ir_instruction(file, function, j, flist);
+			}
+		}
+	}
+}
+
+static void print_ir_instruction(FILE *file, IrFunction *function, int index,
+				 FunctionList *flist) {
+	IrInstruction *instruction = &function->instructions[index];
+	fprintf(file, "    ");
+	if (is_ir_pure(instruction->op) || instruction->op == IR_CALL) {
+		fprintf(file, "%%%d: ", index);
+		print_type(file, instruction->type);
+		fprintf(file, " = ");
+	}
+	fprintf(file, "%s", ir_op_name(instruction->op));
+
+	switch (instruction->op) {
+		case IR_CONSTANT:
+			fprintf(file, " %d", instruction->immediate);
+			break;
+		case IR_LOAD:
+		case IR_STORE:
+		case IR_LOCAL:
+			fprintf(file, " [%d]", instruction->immediate);
+			break;
+		case IR_SHIFT_LEFT:
+		case IR_DIV_SHIFT:
+			fprintf(file, " %d", instruction->immediate);
+			break;
+		case IR_DIV_MULTIPLY:
+			fprintf(file, " %u, %d",
+				(unsigned int) instruction->immediate,
+				instruction->count);
+			break;
+		case IR_POP:
+			fprintf(file, " [%d..%d]", instruction->immediate,
+				instruction->immediate + instruction->count -
+				    1);
+			break;
+		case IR_CALL: {
+			Function *callee =
+			    &flist->functions[instruction->immediate];
+			fprintf(file, " %.*s", callee->name.length,
+				callee->name.start);
+			break;
+		}
+		default:
+			break;
+	}
+
+	int count;
+	int *operands = ir_operands(function, instruction, &count);
+	for (int i = 0; i < count; i++) {
+		fprintf(file, "%s%%%d", i > 0 ? ", " : " ", operands[i]);
+	}
+	for (int i = 0; i < 2 && instruction->targets[i] >= 0; i++) {
+		fprintf(file, "%sb%d", i > 0 || count > 0 ? ", " : " ",
+			instruction->targets[i]);
+	}
+	if (instruction->op == IR_RETURN) {
+		fprintf(file, " (drops %d)", instruction->count);
+	}
+	fprintf(file, "\n");
+}
+
+static const char *ir_op_name(IrOp op) {
+	switch (op) {
+		case IR_NOP:
+			return "nop";
+		case IR_CONSTANT:
+			return "constant";
+		case IR_LOAD:
+			return "load";
+		case IR_STORE:
+			return "store";
+		case IR_LOCAL:
+			return "local";
+		case IR_POP:
+			return "pop";
+		case IR_PRINT:
+			return "print";
+		case IR_ADD:
+			return "add";
+		case IR_SUB:
+			return "sub";
+		case IR_MUL:
+			return "mul";
+		case IR_DIV:
+			return "div";
+		case IR_NEGATE:
+			return "negate";
+		case IR_SHIFT_LEFT:
+			return "shift_left";
+		case IR_DIV_SHIFT:
+			return "div_shift";
+		case IR_DIV_MULTIPLY:
+			return "div_multiply";
+		case IR_EQUAL:
+			return "equal";
+		case IR_NOT_EQUAL:
+			return "not_equal";
+		case IR_LESS:
+			return "less";
+		case IR_LESS_EQUAL:
+			return "less_equal";
+		case IR_GREATER:
+			return "greater";
+		case IR_GREATER_EQUAL:
+			return "greater_equal";
+		case IR_CALL:
+			return "call";
+		case IR_JUMP:
+			return "jump";
+		case IR_BRANCH:
+			return "branch";
+		case IR_RETURN:
+			return "return";
+		case IR_END:
+			return "end";
+	}
+	return "?";
+}
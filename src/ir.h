@@ -0,0 +1,168 @@
+#ifndef IR_H
+#define IR_H
+
+#include "arena.h"
+#include "function.h"
+#include "type.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// The compiler turns every function into a control-flow graph of basic
+// blocks. Instructions that produce a value define it exactly once and are
+// named by their index, so values are in SSA form. Variables are not: they
+// live in frame slots, parameters first, that are read with IR_LOAD and
+// written with IR_STORE, and a block creates and drops them with IR_LOCAL
+// and IR_POP as scopes open and close. Values never flow from one block to
+// another except through a slot, which keeps lowering back to the stack
+// machine simple.
+
+typedef enum IrOp {
+	// Removed by a pass.
+	IR_NOP,
+
+	IR_CONSTANT,
+	IR_LOAD,
+	IR_STORE,
+	IR_LOCAL,
+	IR_POP,
+	IR_PRINT,
+
+	IR_ADD,
+	IR_SUB,
+	IR_MUL,
+	IR_DIV,
+	IR_NEGATE,
+	// Multiplication and division by constants, from strength reduction.
+	IR_SHIFT_LEFT,
+	IR_DIV_SHIFT,
+	IR_DIV_MULTIPLY,
+
+	IR_EQUAL,
+	IR_NOT_EQUAL,
+	IR_LESS,
+	IR_LESS_EQUAL,
+	IR_GREATER,
+	IR_GREATER_EQUAL,
+
+	IR_CALL,
+
+	// Every block ends in exactly one of these.
+	IR_JUMP,
+	IR_BRANCH,
+	IR_RETURN,
+	// Runs off the end of the function.
+	IR_END,
+} IrOp;
+
+typedef struct IrInstruction {
+	IrOp op;
+	// Type of the value the instruction defines, if any.
+	Type type;
+	// Values it uses, or -1. A call's arguments are in the function's
+	// argument list instead, starting at operands[0].
+	int operands[2];
+	// The constant, the slot that is read or written, the first slot a
+	// POP drops, the index of the callee in the function list, the shift
+	// of IR_SHIFT_LEFT and IR_DIV_SHIFT or the magic number of
+	// IR_DIV_MULTIPLY.
+	int immediate;
+	// Arguments of a call, slots a POP drops, slots a RETURN drops below
+	// its result or the shift of IR_DIV_MULTIPLY.
+	int count;
+	// Blocks a JUMP or BRANCH continues at. A BRANCH takes the first if
+	// its condition is true.
+	int targets[2];
+	// Next instruction in the block, or -1.
+	int next;
+} IrInstruction;
+
+typedef struct IrBlock {
+	int first;
+	int last;
+	bool is_removed;
+} IrBlock;
+
+// Blocks are in the order their code is laid out, the entry block first.
+typedef struct IrFunction {
+	IrInstruction *instructions;
+	int instruction_count;
+	int instruction_capacity;
+	int *arguments;
+	int argument_count;
+	int argument_capacity;
+	IrBlock *blocks;
+	int block_count;
+	int parameter_count;
+	// Most slots in use at once.
+	int slot_count;
+	// Slots from slot_count on that passes add to keep a value across
+	// blocks. They are there for the whole function.
+	int temp_count;
+} IrFunction;
+
+// One IrFunction per entry of the compiler's function list, in the same
+// order. Everything lives in the arena.
+typedef struct IrProgram {
+	IrFunction *functions;
+	int count;
+	int capacity;
+	Arena *arena;
+} IrProgram;
+
+// Builds one function at a time in arrays that are reused for the next,
+// and copies it into the program once it is complete.
+typedef struct IrBuilder {
+	Arena *arena;
+	IrFunction function;
+	int block_capacity;
+	// Block that instructions are appended to, or -1 after a terminator.
+	int current;
+} IrBuilder;
+
+void init_ir_program(IrProgram *program, Arena *arena);
+void print_ir_program(FILE *file, IrProgram *program, FunctionList *flist);
+
+void init_ir_builder(IrBuilder *builder, Arena *arena);
+void begin_ir_function(IrBuilder *builder, int parameter_count);
+void finish_ir_function(IrBuilder *builder, IrProgram *program);
+// Ends the current block with a jump to a new one, unless it has already
+// ended, and returns the new block.
+int start_ir_block(IrBuilder *builder);
+// Appends an instruction to the current block, which is started first if
+// the last one has ended, and returns its index.
+int emit_ir(IrBuilder *builder, IrOp op, Type type, int first, int second,
+	    int immediate);
+int emit_ir_call(IrBuilder *builder, Type type, int function,
+		 int *arguments, int argument_count);
+// Sets where a JUMP or BRANCH goes once the block is known.
+void patch_ir_target(IrBuilder *builder, int instruction, int which,
+		     int block);
+// Sets the count of an instruction that has one.
+void set_ir_count(IrBuilder *builder, int instruction, int count);
+// Records that slot_count slots are in use.
+void note_ir_slots(IrBuilder *builder, int slot_count);
+
+// Adds an instruction to a function of the program, right after another
+// one of the block or first if after is -1, and returns its index. The
+// instructions may move.
+int insert_ir(IrProgram *program, IrFunction *function, int block, int after,
+	      IrOp op, Type type, int first, int second, int immediate);
+// Adds the arguments of a call to a function of the program and returns
+// where they start.
+int add_ir_arguments(IrProgram *program, IrFunction *function,
+		     int *arguments, int count);
+// Adds a temporary slot to the function and returns it.
+int add_ir_temp(IrFunction *function);
+
+// Values used by an instruction. A removed one uses none, whatever its
+// fields still say.
+int *ir_operands(IrFunction *function, IrInstruction *instruction,
+		 int *count);
+bool is_ir_terminator(IrOp op);
+// Whether the instruction does nothing but compute its value.
+bool is_ir_pure(IrOp op);
+// Integer arithmetic wraps around like it does at runtime. Division that
+// would trap is left for the interpreter.
+bool fold_ir_binary(IrOp op, int a, int b, int *result);
+
+#endif
@@ -0,0 +1,656 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "chunk.h"
+#include "function.h"
+#include "guard.h"
+#include "interpreter.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// A baseline template JIT: every bytecode instruction is translated into a
+// fixed x86-64 sequence. The VM value stack stays in memory, with rbx
+// pointing at the next free slot and r14 at the first local of the current
+// function. Aquila calls become native calls, so call frames live on the
+// machine stack as the saved r14 plus the return address. That machine
+// stack is a guarded one of its own, sized for the interpreter's maximum
+// depth, and r12 keeps the C stack pointer to return to.
+
+#if defined(__x86_64__)
+
+typedef int (*JitEntry)(Object *stack, void *machine_stack);
+
+// Every Aquila call pushes r14 and a return address.
+#define JIT_FRAME_SIZE 16
+// Room for the print helpers, which run on the same machine stack.
+#define JIT_HELPER_STACK_SIZE (64 * 1024)
+
+typedef struct Patch {
+	int position;
+	int target;
+	bool is_call;
+} Patch;
+
+typedef struct Jit {
+	Chunk *chunk;
+	FunctionList *flist;
+	// Passed to the print helpers; it outlives the generated code.
+	Output *output;
+
+	uint8_t *code;
+	int length;
+	int capacity;
+
+	// Native offset of the first instruction at every bytecode index, and
+	// of the prologue of every function that starts at that index.
+	int *offsets;
+	int *entries;
+
+	Patch *patches;
+	int patch_count;
+	int patch_capacity;
+} Jit;
+
+enum {
+	RAX = 0,
+	RDX = 2,
+	RSI = 6,
+	RDI = 7,
+	RBX = 3,
+	R12 = 12,
+	R14 = 14,
+};
+
+// What the overflow handler needs to find the running function.
+typedef struct JitOverflow {
+	uint8_t *code;
+	int length;
+	int *entries;
+	FunctionList *flist;
+	uint8_t *stack;
+	size_t stack_size;
+} JitOverflow;
+
+static bool translate_chunk(Jit *jit);
+static bool translate_instruction(Jit *jit, Instruction *instruction);
+static void emit_prologue(Jit *jit);
+static void emit_epilogue(Jit *jit);
+static void emit_binary(Jit *jit, uint8_t opcode);
+static void emit_comparison(Jit *jit, uint8_t setcc);
+static void emit_compare_and_jump(Jit *jit, uint8_t jcc, int target);
+static void emit_print(Jit *jit, intptr_t helper, bool has_argument);
+static void emit_jump(Jit *jit, uint8_t *opcode, int opcode_length, int target,
+		      bool is_call);
+static void emit_push_reg(Jit *jit, int reg);
+static void emit_pop_reg(Jit *jit, int reg);
+static void emit_memory(Jit *jit, bool wide, uint8_t *opcode, int opcode_length,
+			int reg, int base, int32_t disp);
+static void emit_adjust_stack(Jit *jit, int32_t amount);
+static void emit_byte(Jit *jit, uint8_t byte);
+static void emit_bytes(Jit *jit, uint8_t *bytes, int count);
+static void emit_int32(Jit *jit, int32_t value);
+static void emit_int64(Jit *jit, int64_t value);
+static bool apply_patches(Jit *jit);
+static void free_jit(Jit *jit);
+static Function *locate_jit_overflow(void *context);
+
+int jit_interpret(Interpreter *interpreter, FunctionList *flist) {
+	Jit jit;
+	jit.chunk = interpreter->chunk;
+	jit.flist = flist;
+	jit.output = &interpreter->output;
+	jit.capacity = 64 + interpreter->chunk->length * 16;
+	jit.code = malloc(jit.capacity);
+	jit.length = 0;
+	jit.offsets = malloc((jit.chunk->length + 1) * sizeof(int));
+	jit.entries = malloc((jit.chunk->length + 1) * sizeof(int));
+	jit.patches = malloc(16 * sizeof(Patch));
+	jit.patch_count = 0;
+	jit.patch_capacity = 16;
+
+	if (!translate_chunk(&jit) || !apply_patches(&jit)) {
+		free_jit(&jit);
+		fprintf(stderr, "JIT: falling back to the interpreter\n");
+		return interpret(interpreter);
+	}
+
+	void *memory = mmap(NULL, jit.length, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(memory, jit.code, jit.length);
+	if (mprotect(memory, jit.length, PROT_READ | PROT_EXEC) != 0) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+
+	JitOverflow overflow;
+	overflow.code = memory;
+	overflow.length = jit.length;
+	overflow.entries = jit.entries;
+	overflow.flist = flist;
+	overflow.stack_size = (size_t) interpreter->max_depth * JIT_FRAME_SIZE +
+			      JIT_HELPER_STACK_SIZE;
+	overflow.stack = map_guarded_stack(overflow.stack_size, true,
+					   locate_jit_overflow, &overflow);
+
+	JitEntry entry;
+	// ISO C has no conversion from object to function pointers; POSIX
+	// guarantees this one works.
+	memcpy(&entry, &memory, sizeof(entry));
+	int result =
+	    entry(interpreter->stack, overflow.stack + overflow.stack_size);
+
+	unmap_guarded_stack(overflow.stack);
+	munmap(memory, jit.length);
+	free_jit(&jit);
+	return result;
+}
+
+static bool translate_chunk(Jit *jit) {
+	Chunk *chunk = jit->chunk;
+	for (int i = 0; i <= chunk->length; i++) {
+		jit->offsets[i] = -1;
+		jit->entries[i] = -1;
+	}
+
+	bool *is_entry = calloc(chunk->length + 1, sizeof(bool));
+	int *parameter_counts = malloc((chunk->length + 1) * sizeof(int));
+	for (int i = 0; i < jit->flist->count; i++) {
+		Function *f = &jit->flist->functions[i];
+		is_entry[f->index] = true;
+		parameter_counts[f->index] = f->parameter_count;
+	}
+
+	emit_prologue(jit);
+
+	bool ok = true;
+	int index = 0;
+	while (index < chunk->length) {
+		if (is_entry[index]) {
+			// Jumps back to the first instruction of a function
+			// must not run the prologue again, so calls and jumps
+			// have separate landing points.
+			jit->entries[index] = jit->length;
+			int32_t disp = -4 * parameter_counts[index];
+			uint8_t lea[] = {0x4C, 0x8D, 0xB3};
+			emit_bytes(jit, lea, 3);
+			emit_int32(jit, disp);
+		}
+		jit->offsets[index] = jit->length;
+
+		Instruction instruction;
+		index = decode_instruction(chunk, index, &instruction);
+		if (!translate_instruction(jit, &instruction)) {
+			ok = false;
+			break;
+		}
+	}
+	// Reached only by jumps out of a final block that never returns.
+	jit->offsets[chunk->length] = jit->length;
+	uint8_t ud2[] = {0x0F, 0x0B};
+	emit_bytes(jit, ud2, 2);
+
+	free(is_entry);
+	free(parameter_counts);
+	return ok;
+}
+
+static bool translate_instruction(Jit *jit, Instruction *instruction) {
+	uint32_t *operands = instruction->operands;
+	switch (instruction->op_code) {
+		case OP_NOOP:
+			return true;
+		case OP_EXIT:
+			emit_epilogue(jit);
+			return true;
+		case OP_POP:
+			emit_adjust_stack(jit, -4);
+			return true;
+		case OP_POP_N:
+			emit_adjust_stack(jit, -4 * (int32_t) operands[0]);
+			return true;
+		case OP_PUSH: {
+			// mov dword [rbx], imm32
+			uint8_t mov[] = {0xC7};
+			emit_memory(jit, false, mov, 1, 0, RBX, 0);
+			emit_int32(jit, (int32_t) operands[0]);
+			emit_adjust_stack(jit, 4);
+			return true;
+		}
+		case OP_LOAD: {
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			emit_memory(jit, false, load, 1, RAX, R14,
+				    4 * (int32_t) operands[0]);
+			emit_memory(jit, false, store, 1, RAX, RBX, 0);
+			emit_adjust_stack(jit, 4);
+			return true;
+		}
+		case OP_STORE: {
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			emit_adjust_stack(jit, -4);
+			emit_memory(jit, false, load, 1, RAX, RBX, 0);
+			emit_memory(jit, false, store, 1, RAX, R14,
+				    4 * (int32_t) operands[0]);
+			return true;
+		}
+		case OP_INCREMENT: {
+			// add dword [r14 + 4 * slot], imm32
+			uint8_t add[] = {0x81};
+			emit_memory(jit, false, add, 1, 0, R14,
+				    4 * (int32_t) operands[0]);
+			emit_int32(jit, (int32_t) operands[1]);
+			return true;
+		}
+		case OP_PRINT_UNIT:
+			emit_adjust_stack(jit, -4);
+			emit_print(jit, (intptr_t) print_unit, false);
+			return true;
+		case OP_PRINT_INTEGER:
+			emit_print(jit, (intptr_t) print_integer, true);
+			return true;
+		case OP_PRINT_BOOLEAN:
+			emit_print(jit, (intptr_t) print_boolean, true);
+			return true;
+		case OP_ADD:
+			emit_binary(jit, 0x01);
+			return true;
+		case OP_SUB:
+			emit_binary(jit, 0x29);
+			return true;
+		case OP_MUL: {
+			uint8_t load[] = {0x8B};
+			uint8_t imul[] = {0x0F, 0xAF};
+			uint8_t store[] = {0x89};
+			emit_adjust_stack(jit, -4);
+			emit_memory(jit, false, load, 1, RAX, RBX, -4);
+			emit_memory(jit, false, imul, 2, RAX, RBX, 0);
+			emit_memory(jit, false, store, 1, RAX, RBX, -4);
+			return true;
+		}
+		case OP_DIV: {
+			uint8_t load[] = {0x8B};
+			uint8_t idiv[] = {0xF7};
+			uint8_t store[] = {0x89};
+			emit_adjust_stack(jit, -4);
+			emit_memory(jit, false, load, 1, RAX, RBX, -4);
+			emit_byte(jit, 0x99); // cdq
+			emit_memory(jit, false, idiv, 1, 7, RBX, 0);
+			emit_memory(jit, false, store, 1, RAX, RBX, -4);
+			return true;
+		}
+		case OP_NEGATE: {
+			uint8_t neg[] = {0xF7};
+			emit_memory(jit, false, neg, 1, 3, RBX, -4);
+			return true;
+		}
+		case OP_SHIFT_LEFT: {
+			// shl dword [rbx - 4], imm8
+			uint8_t shl[] = {0xC1};
+			emit_memory(jit, false, shl, 1, 4, RBX, -4);
+			emit_byte(jit, (uint8_t) operands[0]);
+			return true;
+		}
+		case OP_DIV_SHIFT: {
+			// Negative values are biased by 2^k - 1, taken from the
+			// sign in edx: shr edx, 32 - k; add eax, edx; sar eax, k
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			uint8_t shift = (uint8_t) operands[0];
+			uint8_t bias[] = {0x99, 0xC1, 0xEA, 32 - shift,
+					  0x01, 0xD0, 0xC1, 0xF8, shift};
+			emit_memory(jit, false, load, 1, RAX, RBX, -4);
+			emit_bytes(jit, bias, 9);
+			emit_memory(jit, false, store, 1, RAX, RBX, -4);
+			return true;
+		}
+		case OP_DIV_MULTIPLY: {
+			// movsxd rax, [rbx - 4]; mov edx, magic; imul rax, rdx;
+			// sar rax, 32 + shift, and one more for negative values
+			// from the sign of the dividend.
+			uint8_t movsxd[] = {0x63};
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			uint8_t mov_edx[] = {0xBA};
+			uint8_t shift = (uint8_t) (32 + operands[1]);
+			uint8_t multiply[] = {0x48, 0x0F, 0xAF, 0xC2,
+					      0x48, 0xC1, 0xF8, shift};
+			uint8_t add_sign[] = {0xC1, 0xEA, 0x1F, 0x01, 0xD0};
+			emit_memory(jit, true, movsxd, 1, RAX, RBX, -4);
+			emit_bytes(jit, mov_edx, 1);
+			emit_int32(jit, (int32_t) operands[0]);
+			emit_bytes(jit, multiply, 8);
+			emit_memory(jit, false, load, 1, RDX, RBX, -4);
+			emit_bytes(jit, add_sign, 5);
+			emit_memory(jit, false, store, 1, RAX, RBX, -4);
+			return true;
+		}
+		case OP_EQUAL:
+			emit_comparison(jit, 0x94);
+			return true;
+		case OP_NOT_EQUAL:
+			emit_comparison(jit, 0x95);
+			return true;
+		case OP_LESS:
+			emit_comparison(jit, 0x9C);
+			return true;
+		case OP_LESS_EQUAL:
+			emit_comparison(jit, 0x9E);
+			return true;
+		case OP_GREATER:
+			emit_comparison(jit, 0x9F);
+			return true;
+		case OP_GREATER_EQUAL:
+			emit_comparison(jit, 0x9D);
+			return true;
+		case OP_JUMP: {
+			uint8_t jmp[] = {0xE9};
+			emit_jump(jit, jmp, 1, operands[0], false);
+			return true;
+		}
+		case OP_JUMP_IF_FALSE: {
+			// cmp dword [rbx], 0; je target
+			uint8_t cmp[] = {0x83};
+			uint8_t je[] = {0x0F, 0x84};
+			emit_adjust_stack(jit, -4);
+			emit_memory(jit, false, cmp, 1, 7, RBX, 0);
+			emit_byte(jit, AQ_FALSE);
+			emit_jump(jit, je, 2, operands[0], false);
+			return true;
+		}
+		case OP_JUMP_IF_NOT_EQUAL:
+			emit_compare_and_jump(jit, 0x85, operands[0]);
+			return true;
+		case OP_JUMP_IF_EQUAL:
+			emit_compare_and_jump(jit, 0x84, operands[0]);
+			return true;
+		case OP_JUMP_IF_NOT_LESS:
+			emit_compare_and_jump(jit, 0x8D, operands[0]);
+			return true;
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+			emit_compare_and_jump(jit, 0x8F, operands[0]);
+			return true;
+		case OP_JUMP_IF_NOT_GREATER:
+			emit_compare_and_jump(jit, 0x8E, operands[0]);
+			return true;
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			emit_compare_and_jump(jit, 0x8C, operands[0]);
+			return true;
+		case OP_CALL: {
+			// The callee's prologue sets r14 from its own parameter
+			// count, so only the caller's frame base is saved here.
+			uint8_t call[] = {0xE8};
+			emit_push_reg(jit, R14);
+			emit_jump(jit, call, 1, operands[0], true);
+			emit_pop_reg(jit, R14);
+			return true;
+		}
+		case OP_RETURN: {
+			// Move the return value down over the locals and return
+			// to the native caller.
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			emit_memory(jit, false, load, 1, RAX, RBX, -4);
+			emit_adjust_stack(jit, -4 * (int32_t) operands[0]);
+			emit_memory(jit, false, store, 1, RAX, RBX, -4);
+			emit_byte(jit, 0xC3);
+			return true;
+		}
+		case OP_TAIL_CALL: {
+			// Copy the arguments over the locals and jump to the
+			// callee's prologue, which recomputes the same r14.
+			uint8_t load[] = {0x8B};
+			uint8_t store[] = {0x89};
+			uint8_t lea[] = {0x8D};
+			uint8_t jmp[] = {0xE9};
+			int32_t count = (int32_t) operands[1];
+			for (int32_t i = 0; i < count; i++) {
+				emit_memory(jit, false, load, 1, RAX, RBX,
+					    4 * (i - count));
+				emit_memory(jit, false, store, 1, RAX, R14,
+					    4 * i);
+			}
+			emit_memory(jit, true, lea, 1, RBX, R14, 4 * count);
+			emit_jump(jit, jmp, 1, operands[0], true);
+			return true;
+		}
+		default:
+			fprintf(stderr, "JIT: unsupported opcode %s\n",
+				op_code_name(instruction->op_code));
+			return false;
+	}
+}
+
+static void emit_prologue(Jit *jit) {
+	// The machine stack passed in rsi is 16-byte aligned. Every Aquila
+	// call pushes r14 and a return address, so it stays aligned for the
+	// print helpers at any depth.
+	emit_push_reg(jit, RBX);
+	emit_push_reg(jit, R12);
+	emit_push_reg(jit, R14);
+	uint8_t mov_rbx_rdi[] = {0x48, 0x89, 0xFB};
+	uint8_t mov_r14_rdi[] = {0x49, 0x89, 0xFE};
+	uint8_t mov_r12_rsp[] = {0x49, 0x89, 0xE4};
+	uint8_t mov_rsp_rsi[] = {0x48, 0x89, 0xF4};
+	emit_bytes(jit, mov_rbx_rdi, 3);
+	emit_bytes(jit, mov_r14_rdi, 3);
+	emit_bytes(jit, mov_r12_rsp, 3);
+	emit_bytes(jit, mov_rsp_rsi, 3);
+}
+
+static void emit_epilogue(Jit *jit) {
+	uint8_t mov_rsp_r12[] = {0x4C, 0x89, 0xE4};
+	emit_bytes(jit, mov_rsp_r12, 3);
+	emit_pop_reg(jit, R14);
+	emit_pop_reg(jit, R12);
+	emit_pop_reg(jit, RBX);
+	uint8_t xor_eax_eax[] = {0x31, 0xC0};
+	emit_bytes(jit, xor_eax_eax, 2);
+	emit_byte(jit, 0xC3);
+}
+
+// op dword [rbx - 4], eax after popping the right operand into eax.
+static void emit_binary(Jit *jit, uint8_t opcode) {
+	uint8_t load[] = {0x8B};
+	emit_adjust_stack(jit, -4);
+	emit_memory(jit, false, load, 1, RAX, RBX, 0);
+	emit_memory(jit, false, &opcode, 1, RAX, RBX, -4);
+}
+
+static void emit_comparison(Jit *jit, uint8_t setcc) {
+	uint8_t load[] = {0x8B};
+	uint8_t cmp[] = {0x3B};
+	uint8_t store[] = {0x89};
+	emit_adjust_stack(jit, -4);
+	emit_memory(jit, false, load, 1, RAX, RBX, -4);
+	emit_memory(jit, false, cmp, 1, RAX, RBX, 0);
+	uint8_t set_and_extend[] = {0x0F, setcc, 0xC0, 0x0F, 0xB6, 0xC0};
+	emit_bytes(jit, set_and_extend, 6);
+	emit_memory(jit, false, store, 1, RAX, RBX, -4);
+}
+
+static void emit_compare_and_jump(Jit *jit, uint8_t jcc, int target) {
+	uint8_t load[] = {0x8B};
+	uint8_t cmp[] = {0x3B};
+	emit_adjust_stack(jit, -8);
+	emit_memory(jit, false, load, 1, RAX, RBX, 0);
+	emit_memory(jit, false, cmp, 1, RAX, RBX, 4);
+	uint8_t jump[] = {0x0F, jcc};
+	emit_jump(jit, jump, 2, target, false);
+}
+
+static void emit_print(Jit *jit, intptr_t helper, bool has_argument) {
+	if (has_argument) {
+		uint8_t load[] = {0x8B};
+		emit_adjust_stack(jit, -4);
+		emit_memory(jit, false, load, 1, RSI, RBX, 0);
+	}
+	// mov rdi, output
+	uint8_t mov_rdi[] = {0x48, 0xBF};
+	emit_bytes(jit, mov_rdi, 2);
+	emit_int64(jit, (int64_t) (intptr_t) jit->output);
+	// mov rax, helper; call rax
+	uint8_t mov_rax[] = {0x48, 0xB8};
+	emit_bytes(jit, mov_rax, 2);
+	emit_int64(jit, (int64_t) helper);
+	uint8_t call_rax[] = {0xFF, 0xD0};
+	emit_bytes(jit, call_rax, 2);
+}
+
+static void emit_jump(Jit *jit, uint8_t *opcode, int opcode_length, int target,
+		      bool is_call) {
+	emit_bytes(jit, opcode, opcode_length);
+	if (jit->patch_count == jit->patch_capacity) {
+		jit->patch_capacity *= 2;
+		jit->patches =
+		    realloc(jit->patches, jit->patch_capacity * sizeof(Patch));
+	}
+	Patch *patch = &jit->patches[jit->patch_count++];
+	patch->position = jit->length;
+	patch->target = target;
+	patch->is_call = is_call;
+	emit_int32(jit, 0);
+}
+
+static void emit_push_reg(Jit *jit, int reg) {
+	if (reg >= 8) {
+		emit_byte(jit, 0x41);
+	}
+	emit_byte(jit, 0x50 + (reg & 7));
+}
+
+static void emit_pop_reg(Jit *jit, int reg) {
+	if (reg >= 8) {
+		emit_byte(jit, 0x41);
+	}
+	emit_byte(jit, 0x58 + (reg & 7));
+}
+
+// Emits an instruction with a [base + disp32] memory operand. reg is either
+// a register or the opcode extension of the ModRM byte. Neither rbx nor r14
+// needs a SIB byte as a base.
+static void emit_memory(Jit *jit, bool wide, uint8_t *opcode, int opcode_length,
+			int reg, int base, int32_t disp) {
+	uint8_t rex = 0x40;
+	if (wide) {
+		rex |= 0x08;
+	}
+	if (reg >= 8) {
+		rex |= 0x04;
+	}
+	if (base >= 8) {
+		rex |= 0x01;
+	}
+	if (rex != 0x40) {
+		emit_byte(jit, rex);
+	}
+	emit_bytes(jit, opcode, opcode_length);
+	emit_byte(jit, 0x80 | ((reg & 7) << 3) | (base & 7));
+	emit_int32(jit, disp);
+}
+
+// lea rbx, [rbx + amount]
+static void emit_adjust_stack(Jit *jit, int32_t amount) {
+	uint8_t lea[] = {0x8D};
+	emit_memory(jit, true, lea, 1, RBX, RBX, amount);
+}
+
+static void emit_byte(Jit *jit, uint8_t byte) {
+	if (jit->length == jit->capacity) {
+		jit->capacity = 2 * jit->capacity + 64;
+		jit->code = realloc(jit->code, jit->capacity);
+	}
+	jit->code[jit->length++] = byte;
+}
+
+static void emit_bytes(Jit *jit, uint8_t *bytes, int count) {
+	for (int i = 0; i < count; i++) {
+		emit_byte(jit, bytes[i]);
+	}
+}
+
+static void emit_int32(Jit *jit, int32_t value) {
+	uint32_t bits = (uint32_t) value;
+	for (int i = 0; i < 4; i++) {
+		emit_byte(jit, (bits >> (8 * i)) & 0xFF);
+	}
+}
+
+static void emit_int64(Jit *jit, int64_t value) {
+	uint64_t bits = (uint64_t) value;
+	for (int i = 0; i < 8; i++) {
+		emit_byte(jit, (bits >> (8 * i)) & 0xFF);
+	}
+}
+
+static bool apply_patches(Jit *jit) {
+	for (int i = 0; i < jit->patch_count; i++) {
+		Patch *patch = &jit->patches[i];
+		int destination = patch->is_call ? jit->entries[patch->target]
+						 : jit->offsets[patch->target];
+		if (destination < 0) {
+			fprintf(stderr, "JIT: no code for target %d\n",
+				patch->target);
+			return false;
+		}
+		int32_t relative = destination - (patch->position + 4);
+		uint32_t bits = (uint32_t) relative;
+		for (int j = 0; j < 4; j++) {
+			jit->code[patch->position + j] = (bits >> (8 * j)) & 0xFF;
+		}
+	}
+	return true;
+}
+
+static void free_jit(Jit *jit) {
+	free(jit->code);
+	free(jit->offsets);
+	free(jit->entries);
+	free(jit->patches);
+}
+
+// The most recent Aquila call left the first return address above the
+// guard page that follows a call rel32 into a function prologue. Its
+// target is the function that overflowed.
+static Function *locate_jit_overflow(void *context) {
+	JitOverflow *overflow = context;
+	uintptr_t code = (uintptr_t) overflow->code;
+	for (size_t i = 0; i + 8 <= overflow->stack_size; i += 8) {
+		uint64_t word;
+		memcpy(&word, overflow->stack + i, sizeof(word));
+		if (word < code + 5 || word > code + overflow->length) {
+			continue;
+		}
+		int offset = (int) (word - code);
+		if (overflow->code[offset - 5] != 0xE8) {
+			continue;
+		}
+		int32_t relative;
+		memcpy(&relative, &overflow->code[offset - 4], sizeof(relative));
+		for (int j = 0; j < overflow->flist->count; j++) {
+			Function *f = &overflow->flist->functions[j];
+			if (overflow->entries[f->index] == offset + relative) {
+				return f;
+			}
+		}
+	}
+	return NULL;
+}
+
+#else
+
+int jit_interpret(Interpreter *interpreter, FunctionList *flist) {
+	fprintf(stderr, "JIT: only supported on x86-64, "
+			"falling back to the interpreter\n");
+	return interpret(interpreter);
+}
+
+#endif
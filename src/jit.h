@@ -0,0 +1,10 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "function.h"
+#include "interpreter.h"
+#include <stdbool.h>
+
+int jit_interpret(Interpreter *interpreter, FunctionList *flist);
+
+#endif
@@ -1,31 +1,62 @@
 #include "lexer.h"
+#include "symbol.h"
 #include "token.h"
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
-static const char *KW_LET = "let";
-static const char *KW_FUNC = "func";
-static const char *KW_RETURN = "return";
-static const char *KW_PRINT = "print";
-static const char *KW_IF = "if";
-static const char *KW_WHILE = "while";
-static const char *KW_TRUE = "true";
-static const char *KW_FALSE = "false";
-static const char *KW_UNIT = "unit";
-static const char *KW_INTEGER = "integer";
-static const char *KW_BOOLEAN = "boolean";
+// Character classes, indexed by the unsigned value of a source byte. Unlike
+// the <ctype.h> functions they do not depend on the locale.
+enum {
+	CC_SPACE = 1 << 0,
+	CC_DIGIT = 1 << 1,
+	CC_ALPHA = 1 << 2,
+};
+
+static const unsigned char char_classes[256] = {
+    [' '] = CC_SPACE,  ['\t'] = CC_SPACE, ['\n'] = CC_SPACE, ['\v'] = CC_SPACE,
+    ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+
+    ['0'] = CC_DIGIT,  ['1'] = CC_DIGIT,  ['2'] = CC_DIGIT,  ['3'] = CC_DIGIT,
+    ['4'] = CC_DIGIT,  ['5'] = CC_DIGIT,  ['6'] = CC_DIGIT,  ['7'] = CC_DIGIT,
+    ['8'] = CC_DIGIT,  ['9'] = CC_DIGIT,
+
+    ['a'] = CC_ALPHA,  ['b'] = CC_ALPHA,  ['c'] = CC_ALPHA,  ['d'] = CC_ALPHA,
+    ['e'] = CC_ALPHA,  ['f'] = CC_ALPHA,  ['g'] = CC_ALPHA,  ['h'] = CC_ALPHA,
+    ['i'] = CC_ALPHA,  ['j'] = CC_ALPHA,  ['k'] = CC_ALPHA,  ['l'] = CC_ALPHA,
+    ['m'] = CC_ALPHA,  ['n'] = CC_ALPHA,  ['o'] = CC_ALPHA,  ['p'] = CC_ALPHA,
+    ['q'] = CC_ALPHA,  ['r'] = CC_ALPHA,  ['s'] = CC_ALPHA,  ['t'] = CC_ALPHA,
+    ['u'] = CC_ALPHA,  ['v'] = CC_ALPHA,  ['w'] = CC_ALPHA,  ['x'] = CC_ALPHA,
+    ['y'] = CC_ALPHA,  ['z'] = CC_ALPHA,
+
+    ['A'] = CC_ALPHA,  ['B'] = CC_ALPHA,  ['C'] = CC_ALPHA,  ['D'] = CC_ALPHA,
+    ['E'] = CC_ALPHA,  ['F'] = CC_ALPHA,  ['G'] = CC_ALPHA,  ['H'] = CC_ALPHA,
+    ['I'] = CC_ALPHA,  ['J'] = CC_ALPHA,  ['K'] = CC_ALPHA,  ['L'] = CC_ALPHA,
+    ['M'] = CC_ALPHA,  ['N'] = CC_ALPHA,  ['O'] = CC_ALPHA,  ['P'] = CC_ALPHA,
+    ['Q'] = CC_ALPHA,  ['R'] = CC_ALPHA,  ['S'] = CC_ALPHA,  ['T'] = CC_ALPHA,
+    ['U'] = CC_ALPHA,  ['V'] = CC_ALPHA,  ['W'] = CC_ALPHA,  ['X'] = CC_ALPHA,
+    ['Y'] = CC_ALPHA,  ['Z'] = CC_ALPHA,
+};
+
+#define HAS_CLASS(ch, class)                                                   \
+	((char_classes[(unsigned char) (ch)] & (class)) != 0)
 
 static Token make_token(Lexer *lexer, TokenType type);
 static Token advance_lexer(Lexer *lexer);
+static TokenType keyword_type(const char *name, int length);
+static TokenType match_keyword(const char *name, int length,
+			       const char *keyword, TokenType type);
 static char next_char(Lexer *lexer);
+static char peek_char(Lexer *lexer);
 
-void init_lexer(Lexer *lexer, char *source) {
+void init_lexer(Lexer *lexer, char *source, size_t length,
+		SymbolTable *symbols) {
 	lexer->start = source;
 	lexer->current = source;
+	lexer->end = source + length;
 	lexer->has_peeked = false;
 	lexer->line_number = 1;
+	lexer->symbols = symbols;
 }
 
 Token make_token(Lexer *lexer, TokenType type) {
@@ -33,6 +64,11 @@ Token make_token(Lexer *lexer, TokenType type) {
 	token.type = type;
 	token.start = lexer->start;
 	token.length = (int) (lexer->current - lexer->start);
+	token.symbol = -1;
+	if (type == TT_NAME) {
+		token.symbol =
+		    intern_symbol(lexer->symbols, token.start, token.length);
+	}
 
 	return token;
 }
@@ -57,7 +93,8 @@ Token peek_next_token(Lexer *lexer) {
 
 Token advance_lexer(Lexer *lexer) {
 	for (;;) {
-		if (*lexer->current == '\0') {
+		if (lexer->current == lexer->end) {
+			lexer->start = lexer->current;
 			return make_token(lexer, TT_END);
 		}
 
@@ -65,7 +102,7 @@ Token advance_lexer(Lexer *lexer) {
 			lexer->line_number++;
 		}
 
-		if (!isspace(*lexer->current)) {
+		if (!HAS_CLASS(peek_char(lexer), CC_SPACE)) {
 			break;
 		}
 
@@ -91,7 +128,7 @@ Token advance_lexer(Lexer *lexer) {
 		case '}':
 			return make_token(lexer, TT_RCURLY);
 		case '=':
-			if (*lexer->current == '=') {
+			if (peek_char(lexer) == '=') {
 				next_char(lexer);
 				return make_token(lexer, TT_DOUBLE_EQUAL);
 			}
@@ -105,19 +142,19 @@ Token advance_lexer(Lexer *lexer) {
 		case '/':
 			return make_token(lexer, TT_SLASH);
 		case '!':
-			if (*lexer->current == '=') {
+			if (peek_char(lexer) == '=') {
 				next_char(lexer);
 				return make_token(lexer, TT_NOT_EQUAL);
 			}
 			break;
 		case '<':
-			if (*lexer->current == '=') {
+			if (peek_char(lexer) == '=') {
 				next_char(lexer);
 				return make_token(lexer, TT_LESS_EQUAL);
 			}
 			return make_token(lexer, TT_LESS);
 		case '>':
-			if (*lexer->current == '=') {
+			if (peek_char(lexer) == '=') {
 				next_char(lexer);
 				return make_token(lexer, TT_GREATER_EQUAL);
 			}
@@ -126,49 +163,86 @@ Token advance_lexer(Lexer *lexer) {
 			break;
 	}
 
-	if (isdigit(ch)) {
-		while (isdigit(*lexer->current)) {
+	if (HAS_CLASS(ch, CC_DIGIT)) {
+		while (HAS_CLASS(peek_char(lexer), CC_DIGIT)) {
 			next_char(lexer);
 		}
 		return make_token(lexer, TT_NUMBER);
 	}
 
-	if (isalpha(ch)) {
-		while (isalpha(*lexer->current)) {
+	if (HAS_CLASS(ch, CC_ALPHA)) {
+		while (HAS_CLASS(peek_char(lexer), CC_ALPHA)) {
 			next_char(lexer);
 		}
+		int length = (int) (lexer->current - lexer->start);
+		return make_token(lexer, keyword_type(lexer->start, length));
+	}
 
-		char *name = lexer->start;
-		if (strncmp(name, KW_LET, strlen(KW_LET)) == 0) {
-			return make_token(lexer, TT_LET);
-		} else if (strncmp(name, KW_FUNC, strlen(KW_FUNC)) == 0) {
-			return make_token(lexer, TT_FUNC);
-		} else if (strncmp(name, KW_RETURN, strlen(KW_RETURN)) == 0) {
-			return make_token(lexer, TT_RETURN);
-		} else if (strncmp(name, KW_PRINT, strlen(KW_PRINT)) == 0) {
-			return make_token(lexer, TT_PRINT);
-		} else if (strncmp(name, KW_IF, strlen(KW_IF)) == 0) {
-			return make_token(lexer, TT_IF);
-		} else if (strncmp(name, KW_WHILE, strlen(KW_WHILE)) == 0) {
-			return make_token(lexer, TT_WHILE);
-		} else if (strncmp(name, KW_TRUE, strlen(KW_TRUE)) == 0) {
-			return make_token(lexer, TT_TRUE);
-		} else if (strncmp(name, KW_FALSE, strlen(KW_FALSE)) == 0) {
-			return make_token(lexer, TT_FALSE);
-		} else if (strncmp(name, KW_UNIT, strlen(KW_UNIT)) == 0) {
-			return make_token(lexer, TT_UNIT);
-		} else if (strncmp(name, KW_INTEGER, strlen(KW_INTEGER)) == 0) {
-			return make_token(lexer, TT_INTEGER);
-		} else if (strncmp(name, KW_BOOLEAN, strlen(KW_BOOLEAN)) == 0) {
-			return make_token(lexer, TT_BOOLEAN);
-		}
+	return make_token(lexer, TT_UNKNOWN);
+}
 
-		return make_token(lexer, TT_NAME);
+// The length and first character leave at most one candidate keyword,
+// which then has to match exactly.
+static TokenType keyword_type(const char *name, int length) {
+	switch (length) {
+		case 2:
+			return match_keyword(name, length, "if", TT_IF);
+		case 3:
+			return match_keyword(name, length, "let", TT_LET);
+		case 4:
+			switch (name[0]) {
+				case 'f':
+					return match_keyword(name, length,
+							     "func", TT_FUNC);
+				case 't':
+					return match_keyword(name, length,
+							     "true", TT_TRUE);
+				case 'u':
+					return match_keyword(name, length,
+							     "unit", TT_UNIT);
+			}
+			break;
+		case 5:
+			switch (name[0]) {
+				case 'p':
+					return match_keyword(name, length,
+							     "print", TT_PRINT);
+				case 'w':
+					return match_keyword(name, length,
+							     "while", TT_WHILE);
+				case 'f':
+					return match_keyword(name, length,
+							     "false", TT_FALSE);
+			}
+			break;
+		case 6:
+			return match_keyword(name, length, "return", TT_RETURN);
+		case 7:
+			switch (name[0]) {
+				case 'i':
+					return match_keyword(name, length,
+							     "integer",
+							     TT_INTEGER);
+				case 'b':
+					return match_keyword(name, length,
+							     "boolean",
+							     TT_BOOLEAN);
+			}
+			break;
 	}
+	return TT_NAME;
+}
 
-	return make_token(lexer, TT_UNKNOWN);
+static TokenType match_keyword(const char *name, int length,
+			       const char *keyword, TokenType type) {
+	return memcmp(name, keyword, length) == 0 ? type : TT_NAME;
 }
 
 static char next_char(Lexer *lexer) {
 	return *lexer->current++;
 }
+
+// Returns '\0' at the end of the source, which no token continues with.
+static char peek_char(Lexer *lexer) {
+	return lexer->current < lexer->end ? *lexer->current : '\0';
+}
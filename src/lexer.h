@@ -1,18 +1,24 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "symbol.h"
 #include "token.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct Lexer {
 	char *start;
 	char *current;
+	// The source is not NUL-terminated; lexing stops here.
+	char *end;
 	bool has_peeked;
 	Token peeked_token;
 	int line_number;
+	SymbolTable *symbols;
 } Lexer;
 
-void init_lexer(Lexer *lexer, char *source);
+void init_lexer(Lexer *lexer, char *source, size_t length,
+		SymbolTable *symbols);
 Token get_next_token(Lexer *lexer);
 Token peek_next_token(Lexer *lexer);
 
@@ -0,0 +1,861 @@
+#include "loops.h"
+#include "ir.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The compiler lays a while loop out as a header block that tests the
+// condition, the blocks of the body and a last block of the body that
+// jumps back to the header, so a loop is the range of blocks from its
+// header to that jump and contains the loops nested in it. The block right
+// before the header only jumps to it and runs once every time the loop is
+// entered: code that has to run before the loop goes at its end. A value
+// that is computed there for the loop, or kept up to date next to a loop
+// counter, is handed over in a temporary slot of its own.
+//
+// Loops are done innermost first, so that what an inner loop moved in
+// front of it can move on out of the loops around it.
+
+// A store of a counter, counter + amount, in a block of a loop.
+typedef struct Step {
+	int block;
+	int store;
+	int slot;
+	int amount;
+} Step;
+
+// A multiplication of a counter by a constant, until it is replaced.
+typedef struct Product {
+	int value;
+	int slot;
+	int factor;
+} Product;
+
+typedef struct Loops {
+	IrProgram *program;
+	IrFunction *function;
+	// Per function, whether calling it does nothing but compute a
+	// value. Known for the functions done so far.
+	bool *is_pure_function;
+
+	// Per value.
+	bool *is_invariant;
+	int *clones;
+	int *clone_stamps;
+	// Slot known to hold the value and the version it holds it in.
+	int *homes;
+	int *home_versions;
+	int value_capacity;
+	int stamp;
+
+	// Per slot.
+	bool *is_written;
+	bool *is_counter;
+	int *store_counts;
+	int *versions;
+	int slot_capacity;
+
+	// Per block, the last block of the loop it is the header of, or -1.
+	int *loop_ends;
+	int block_capacity;
+
+	// Where code in front of the loop goes: after this instruction of
+	// the block before it, or first in it if -1.
+	int preheader;
+	int after;
+
+	Step *steps;
+	int step_count;
+	Product *products;
+	int product_count;
+} Loops;
+
+static void init_loops(Loops *loops, IrProgram *program);
+static void free_loops(Loops *loops);
+static void start_function(Loops *loops, int index);
+static void find_purity(Loops *loops, int index);
+static bool enter_loop(Loops *loops, int header);
+static void reserve_values(Loops *loops);
+static void hoist_loop(Loops *loops, int header, int end);
+static bool is_invariant(Loops *loops, IrInstruction *instruction);
+static bool may_trap(IrFunction *function, IrInstruction *instruction);
+static bool is_worth_hoisting(Loops *loops, int value);
+static void hoist_value(Loops *loops, int value);
+static int clone_value(Loops *loops, int value);
+static int add_before_loop(Loops *loops, IrOp op, int first, int second,
+			   int immediate);
+static void reduce_counters(Loops *loops, int header, int end);
+static bool is_step(Loops *loops, int value, int slot, int *amount);
+static int find_factor(Loops *loops, IrInstruction *instruction, int *slot);
+static void reduce_product(Loops *loops, int first);
+static void reduce_constants(Loops *loops);
+static void reduce_multiplication(IrFunction *function,
+				  IrInstruction *instruction);
+static void reduce_division(Loops *loops, int block, int previous,
+			    int index);
+static bool constant_operand(IrFunction *function, IrInstruction *instruction,
+			     int which, int *constant);
+static int exact_log2(uint32_t value);
+static void find_magic(int divisor, uint32_t *magic, int *shift);
+static void set_home(Loops *loops, int value, int slot);
+static int home(Loops *loops, int value);
+static void to_load(IrInstruction *instruction, int slot);
+static void remove_instruction(IrInstruction *instruction);
+
+// Values that are worth moving are those that take more than a constant
+// or a load: a pure call in the condition, say, or n * n in i < n * n.
+// Everything in the body is computed in front of the loop even if the
+// body never runs, so what may trap only moves if it comes first thing in
+// the header, which runs at least once anyway.
+void hoist_loop_invariants(IrProgram *program) {
+	Loops loops;
+	init_loops(&loops, program);
+	for (int i = 0; i < program->count; i++) {
+		find_purity(&loops, i);
+		start_function(&loops, i);
+		IrFunction *function = loops.function;
+		for (int header = function->block_count - 1; header > 0;
+		     header--) {
+			if (enter_loop(&loops, header)) {
+				hoist_loop(&loops, header,
+					   loops.loop_ends[header]);
+			}
+		}
+	}
+	free_loops(&loops);
+}
+
+// Runs last, on code that the other passes have cleaned up: a counter is
+// then a slot that the loop only ever adds constants to, and its products
+// are found through the values that its loads were replaced with.
+void reduce_strength(IrProgram *program) {
+	Loops loops;
+	init_loops(&loops, program);
+	for (int i = 0; i < program->count; i++) {
+		start_function(&loops, i);
+		IrFunction *function = loops.function;
+		for (int header = function->block_count - 1; header > 0;
+		     header--) {
+			if (enter_loop(&loops, header)) {
+				reduce_counters(&loops, header,
+						loops.loop_ends[header]);
+			}
+		}
+		reduce_constants(&loops);
+	}
+	free_loops(&loops);
+}
+
+static void init_loops(Loops *loops, IrProgram *program) {
+	loops->program = program;
+	loops->function = NULL;
+	loops->is_pure_function = malloc((program->count + 1) * sizeof(bool));
+	loops->is_invariant = NULL;
+	loops->clones = NULL;
+	loops->clone_stamps = NULL;
+	loops->homes = NULL;
+	loops->home_versions = NULL;
+	loops->steps = NULL;
+	loops->products = NULL;
+	loops->value_capacity = 0;
+	loops->stamp = 0;
+	loops->is_written = NULL;
+	loops->is_counter = NULL;
+	loops->store_counts = NULL;
+	loops->versions = NULL;
+	loops->slot_capacity = 0;
+	loops->loop_ends = NULL;
+	loops->block_capacity = 0;
+}
+
+static void free_loops(Loops *loops) {
+	free(loops->is_pure_function);
+	free(loops->is_invariant);
+	free(loops->clones);
+	free(loops->clone_stamps);
+	free(loops->homes);
+	free(loops->home_versions);
+	free(loops->steps);
+	free(loops->products);
+	free(loops->is_written);
+	free(loops->is_counter);
+	free(loops->store_counts);
+	free(loops->versions);
+	free(loops->loop_ends);
+}
+
+// Finds the loops of a function by the jumps back to their headers.
+static void start_function(Loops *loops, int index) {
+	IrFunction *function = &loops->program->functions[index];
+	loops->function = function;
+	if (function->block_count > loops->block_capacity) {
+		loops->block_capacity = function->block_count;
+		loops->loop_ends = realloc(
+		    loops->loop_ends, loops->block_capacity * sizeof(int));
+	}
+	for (int i = 0; i < function->block_count; i++) {
+		loops->loop_ends[i] = -1;
+	}
+	for (int i = 0; i < function->block_count; i++) {
+		IrBlock *block = &function->blocks[i];
+		IrInstruction *terminator =
+		    &function->instructions[block->last];
+		if (block->is_removed || terminator->op != IR_JUMP) {
+			continue;
+		}
+		int target = terminator->targets[0];
+		if (target <= i && i > loops->loop_ends[target]) {
+			loops->loop_ends[target] = i;
+		}
+	}
+}
+
+// A function is pure if it prints nothing and only calls pure functions,
+// itself included. Calls to functions that come later are not known yet.
+static void find_purity(Loops *loops, int index) {
+	IrFunction *function = &loops->program->functions[index];
+	bool is_pure = true;
+	for (int i = 0; i < function->instruction_count; i++) {
+		IrInstruction *instruction = &function->instructions[i];
+		int callee = instruction->immediate;
+		if (instruction->op == IR_PRINT ||
+		    (instruction->op == IR_CALL && callee != index &&
+		     (callee > index || !loops->is_pure_function[callee]))) {
+			is_pure = false;
+			break;
+		}
+	}
+	loops->is_pure_function[index] = is_pure;
+}
+
+// Returns false unless the block is the header of a loop that is entered
+// from the block before it, and otherwise gets ready to work on the loop.
+static bool enter_loop(Loops *loops, int header) {
+	IrFunction *function = loops->function;
+	int end = loops->loop_ends[header];
+	IrBlock *preheader = &function->blocks[header - 1];
+	if (end < 0 || function->blocks[header].is_removed ||
+	    preheader->is_removed) {
+		return false;
+	}
+	IrInstruction *jump = &function->instructions[preheader->last];
+	if (jump->op != IR_JUMP || jump->targets[0] != header) {
+		return false;
+	}
+	loops->preheader = header - 1;
+	loops->after = -1;
+	for (int i = preheader->first; i != preheader->last;
+	     i = function->instructions[i].next) {
+		loops->after = i;
+	}
+
+	reserve_values(loops);
+	loops->stamp++;
+	int slot_count = function->slot_count + function->temp_count;
+	for (int i = 0; i < slot_count; i++) {
+		loops->is_written[i] = false;
+	}
+	for (int block = header; block <= end; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		for (int i = function->blocks[block].first; i >= 0;
+		     i = function->instructions[i].next) {
+			IrInstruction *instruction = &function->instructions[i];
+			int slot = instruction->immediate;
+			switch (instruction->op) {
+				case IR_STORE:
+				case IR_LOCAL:
+					loops->is_written[slot] = true;
+					break;
+				case IR_POP:
+					for (int j = 0; j < instruction->count;
+					     j++) {
+						loops->is_written[slot + j] =
+						    true;
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	return true;
+}
+
+// Makes room for every value and slot of the function, which grow as
+// code is put in front of loops.
+static void reserve_values(Loops *loops) {
+	IrFunction *function = loops->function;
+	int value_count = function->instruction_count;
+	if (value_count > loops->value_capacity) {
+		int old = loops->value_capacity;
+		int capacity = 2 * value_count;
+		loops->is_invariant =
+		    realloc(loops->is_invariant, capacity * sizeof(bool));
+		loops->clones = realloc(loops->clones, capacity * sizeof(int));
+		loops->clone_stamps =
+		    realloc(loops->clone_stamps, capacity * sizeof(int));
+		loops->homes = realloc(loops->homes, capacity * sizeof(int));
+		loops->home_versions =
+		    realloc(loops->home_versions, capacity * sizeof(int));
+		loops->steps = realloc(loops->steps, capacity * sizeof(Step));
+		loops->products =
+		    realloc(loops->products, capacity * sizeof(Product));
+		for (int i = old; i < capacity; i++) {
+			loops->is_invariant[i] = false;
+			loops->clones[i] = -1;
+			loops->clone_stamps[i] = 0;
+			loops->homes[i] = -1;
+			loops->home_versions[i] = 0;
+		}
+		loops->value_capacity = capacity;
+	}
+
+	int slot_count = function->slot_count + function->temp_count;
+	if (slot_count > loops->slot_capacity) {
+		int old = loops->slot_capacity;
+		int capacity = 2 * slot_count;
+		loops->is_written =
+		    realloc(loops->is_written, capacity * sizeof(bool));
+		loops->is_counter =
+		    realloc(loops->is_counter, capacity * sizeof(bool));
+		loops->store_counts =
+		    realloc(loops->store_counts, capacity * sizeof(int));
+		loops->versions =
+		    realloc(loops->versions, capacity * sizeof(int));
+		memset(&loops->versions[old], 0,
+		       (capacity - old) * sizeof(int));
+		loops->slot_capacity = capacity;
+	}
+}
+
+// Finds the values of the loop that are the same on every iteration, and
+// then moves those that a value of the loop uses out of it. Values of the
+// loop only use values that come before them in their block, so one pass
+// in order finds them all, and every invariant value that is still there
+// afterwards is only used by others that are.
+static void hoist_loop(Loops *loops, int header, int end) {
+	IrFunction *function = loops->function;
+	for (int block = header; block <= end; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		// Nothing that may trap or do something else has come
+		// before in this iteration.
+		bool is_clean = block == header;
+		for (int i = function->blocks[block].first; i >= 0;
+		     i = function->instructions[i].next) {
+			IrInstruction *instruction = &function->instructions[i];
+			bool invariant = is_invariant(loops, instruction);
+			bool trap = may_trap(function, instruction);
+			if (trap) {
+				invariant = invariant && is_clean;
+			}
+			if (!invariant &&
+			    (trap || !is_ir_pure(instruction->op))) {
+				is_clean = false;
+			}
+			loops->is_invariant[i] = invariant;
+		}
+	}
+
+	for (int block = header; block <= end; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		for (int i = function->blocks[block].first; i >= 0;
+		     i = function->instructions[i].next) {
+			if (loops->is_invariant[i]) {
+				continue;
+			}
+			int count;
+			ir_operands(function, &function->instructions[i],
+				    &count);
+			for (int j = 0; j < count; j++) {
+				// Hoisting moves the instructions.
+				int *operands = ir_operands(
+				    function, &function->instructions[i],
+				    &count);
+				if (is_worth_hoisting(loops, operands[j])) {
+					hoist_value(loops, operands[j]);
+				}
+			}
+		}
+	}
+
+	// What is left of the invariant values only feeds other values that
+	// are left, so none of them is needed any more. Pure calls would be
+	// kept by dead code elimination, and the rest goes with them.
+	for (int block = header; block <= end; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		for (int i = function->blocks[block].first; i >= 0;
+		     i = function->instructions[i].next) {
+			IrInstruction *instruction = &function->instructions[i];
+			if (loops->is_invariant[i] &&
+			    instruction->op != IR_CONSTANT &&
+			    instruction->op != IR_LOAD) {
+				remove_instruction(instruction);
+			}
+		}
+	}
+}
+
+static bool is_invariant(Loops *loops, IrInstruction *instruction) {
+	switch (instruction->op) {
+		case IR_NOP:
+			return false;
+		case IR_CONSTANT:
+			return true;
+		case IR_LOAD:
+			return !loops->is_written[instruction->immediate];
+		case IR_CALL:
+			if (!loops->is_pure_function[instruction->immediate]) {
+				return false;
+			}
+			break;
+		default:
+			if (!is_ir_pure(instruction->op)) {
+				return false;
+			}
+			break;
+	}
+	int count;
+	int *operands = ir_operands(loops->function, instruction, &count);
+	for (int i = 0; i < count; i++) {
+		if (!loops->is_invariant[operands[i]]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Calls may not return, and division traps on a zero divisor or on
+// INT_MIN / -1.
+static bool may_trap(IrFunction *function, IrInstruction *instruction) {
+	if (instruction->op == IR_CALL) {
+		return true;
+	}
+	if (instruction->op != IR_DIV) {
+		return false;
+	}
+	IrInstruction *divisor =
+	    &function->instructions[instruction->operands[1]];
+	return divisor->op != IR_CONSTANT || divisor->immediate == 0 ||
+	       divisor->immediate == -1;
+}
+
+static bool is_worth_hoisting(Loops *loops, int value) {
+	IrOp op = loops->function->instructions[value].op;
+	return loops->is_invariant[value] && op != IR_CONSTANT &&
+	       op != IR_LOAD;
+}
+
+// Computes the value in front of the loop into a new temporary, and turns
+// it into a load of that.
+static void hoist_value(Loops *loops, int value) {
+	int temp = add_ir_temp(loops->function);
+	int clone = clone_value(loops, value);
+	int store = add_before_loop(loops, IR_STORE, clone, -1, temp);
+	IrInstruction *instructions = loops->function->instructions;
+	instructions[store].type = instructions[clone].type;
+	to_load(&instructions[value], temp);
+}
+
+// Copies the code of a value in front of the loop, once per loop.
+static int clone_value(Loops *loops, int value) {
+	if (loops->clone_stamps[value] == loops->stamp) {
+		return loops->clones[value];
+	}
+	IrFunction *function = loops->function;
+	IrInstruction original = function->instructions[value];
+	int clone;
+	if (original.op == IR_CALL) {
+		int *arguments = malloc((original.count + 1) * sizeof(int));
+		for (int i = 0; i < original.count; i++) {
+			arguments[i] = clone_value(
+			    loops,
+			    function->arguments[original.operands[0] + i]);
+		}
+		int first = add_ir_arguments(loops->program, function,
+					     arguments, original.count);
+		free(arguments);
+		clone = add_before_loop(loops, IR_CALL, first, -1,
+					original.immediate);
+	} else {
+		int first = original.operands[0];
+		int second = original.operands[1];
+		if (first >= 0) {
+			first = clone_value(loops, first);
+		}
+		if (second >= 0) {
+			second = clone_value(loops, second);
+		}
+		clone = add_before_loop(loops, original.op, first, second,
+					original.immediate);
+	}
+	function->instructions[clone].type = original.type;
+	function->instructions[clone].count = original.count;
+	loops->clones[value] = clone;
+	loops->clone_stamps[value] = loops->stamp;
+	return clone;
+}
+
+static int add_before_loop(Loops *loops, IrOp op, int first, int second,
+			   int immediate) {
+	int index = insert_ir(loops->program, loops->function,
+			      loops->preheader, loops->after, op, TY_INTEGER,
+			      first, second, immediate);
+	loops->after = index;
+	return index;
+}
+
+// A counter only ever has a constant added to it in the loop. A product of
+// it and a constant is then kept in a temporary that starts out as the
+// product in front of the loop and has the constant times the step added
+// to it after every step. This is only worth it if the loop multiplies at
+// least as often as it steps.
+static void reduce_counters(Loops *loops, int header, int end) {
+	IrFunction *function = loops->function;
+	int slot_count = function->slot_count + function->temp_count;
+	for (int i = 0; i < slot_count; i++) {
+		loops->is_counter[i] = true;
+		loops->store_counts[i] = 0;
+	}
+	loops->step_count = 0;
+	loops->product_count = 0;
+
+	for (int block = header; block <= end; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		for (int i = function->blocks[block].first; i >= 0;
+		     i = function->instructions[i].next) {
+			IrInstruction *instruction = &function->instructions[i];
+			int slot = instruction->immediate;
+			int value = instruction->operands[0];
+			int amount;
+			loops->homes[i] = -1;
+			switch (instruction->op) {
+				case IR_LOAD:
+					set_home(loops, i, slot);
+					break;
+				case IR_STORE:
+					if (is_step(loops, value, slot,
+						    &amount)) {
+						loops->steps
+						    [loops->step_count++] =
+						    (Step){block, i, slot,
+							   amount};
+					} else {
+						loops->is_counter[slot] = false;
+					}
+					loops->store_counts[slot]++;
+					loops->versions[slot]++;
+					set_home(loops, value, slot);
+					break;
+				case IR_LOCAL:
+					loops->is_counter[slot] = false;
+					loops->versions[slot]++;
+					set_home(loops, value, slot);
+					break;
+				case IR_POP:
+					for (int j = 0; j < instruction->count;
+					     j++) {
+						loops->is_counter[slot + j] =
+						    false;
+						loops->versions[slot + j]++;
+					}
+					break;
+				case IR_MUL: {
+					int factor = find_factor(
+					    loops, instruction, &slot);
+					if (slot >= 0) {
+						loops->products
+						    [loops->product_count++] =
+						    (Product){i, slot, factor};
+					}
+					break;
+				}
+				default:
+					break;
+			}
+		}
+	}
+
+	for (int i = 0; i < loops->product_count; i++) {
+		int slot = loops->products[i].slot;
+		if (slot >= 0 && loops->is_counter[slot] &&
+		    loops->store_counts[slot] > 0) {
+			reduce_product(loops, i);
+		}
+	}
+}
+
+// Whether the value is what the slot holds plus or minus a constant.
+static bool is_step(Loops *loops, int value, int slot, int *amount) {
+	IrFunction *function = loops->function;
+	IrInstruction *instruction = &function->instructions[value];
+	int constant;
+	if (instruction->op == IR_ADD) {
+		for (int i = 0; i < 2; i++) {
+			if (constant_operand(function, instruction, 1 - i,
+					     &constant) &&
+			    home(loops, instruction->operands[i]) == slot) {
+				*amount = constant;
+				return true;
+			}
+		}
+	} else if (instruction->op == IR_SUB &&
+		   constant_operand(function, instruction, 1, &constant) &&
+		   home(loops, instruction->operands[0]) == slot) {
+		*amount = (int) (0u - (uint32_t) constant);
+		return true;
+	}
+	return false;
+}
+
+// Returns the constant that a multiplication multiplies what a slot holds
+// by, and sets the slot, or -1 if it is something else.
+static int find_factor(Loops *loops, IrInstruction *instruction, int *slot) {
+	int constant;
+	for (int i = 0; i < 2; i++) {
+		*slot = home(loops, instruction->operands[i]);
+		if (*slot >= 0 && constant_operand(loops->function,
+						   instruction, 1 - i,
+						   &constant)) {
+			return constant;
+		}
+	}
+	*slot = -1;
+	return 0;
+}
+
+// Replaces every product of the loop with the same counter and factor as
+// the first, if there are enough of them.
+static void reduce_product(Loops *loops, int first) {
+	int slot = loops->products[first].slot;
+	int factor = loops->products[first].factor;
+	int count = 0;
+	for (int i = first; i < loops->product_count; i++) {
+		if (loops->products[i].slot == slot &&
+		    loops->products[i].factor == factor) {
+			count++;
+		}
+	}
+	if (count < loops->store_counts[slot]) {
+		loops->products[first].slot = -1;
+		return;
+	}
+
+	IrFunction *function = loops->function;
+	int temp = add_ir_temp(function);
+	int load = add_before_loop(loops, IR_LOAD, -1, -1, slot);
+	int constant = add_before_loop(loops, IR_CONSTANT, -1, -1, factor);
+	int product = add_before_loop(loops, IR_MUL, load, constant, 0);
+	add_before_loop(loops, IR_STORE, product, -1, temp);
+
+	for (int i = 0; i < loops->step_count; i++) {
+		Step *step = &loops->steps[i];
+		if (step->slot != slot) {
+			continue;
+		}
+		uint32_t amount = (uint32_t) step->amount * (uint32_t) factor;
+		IrProgram *program = loops->program;
+		int block = step->block;
+		load = insert_ir(program, function, block, step->store,
+				 IR_LOAD, TY_INTEGER, -1, -1, temp);
+		constant = insert_ir(program, function, block, load,
+				     IR_CONSTANT, TY_INTEGER, -1, -1,
+				     (int) amount);
+		int sum = insert_ir(program, function, block, constant,
+				    IR_ADD, TY_INTEGER, load, constant, 0);
+		insert_ir(program, function, block, sum, IR_STORE, TY_INTEGER,
+			  sum, -1, temp);
+	}
+
+	for (int i = first; i < loops->product_count; i++) {
+		Product *product = &loops->products[i];
+		if (product->slot == slot && product->factor == factor) {
+			to_load(&function->instructions[product->value], temp);
+			product->slot = -1;
+		}
+	}
+}
+
+// Multiplication by a power of two becomes a shift, and division by a
+// constant a shift or a multiplication by its reciprocal.
+static void reduce_constants(Loops *loops) {
+	IrFunction *function = loops->function;
+	for (int block = 0; block < function->block_count; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		int previous = -1;
+		for (int i = function->blocks[block].first; i >= 0;
+		     previous = i, i = function->instructions[i].next) {
+			IrInstruction *instruction = &function->instructions[i];
+			if (instruction->op == IR_MUL) {
+				reduce_multiplication(function, instruction);
+			} else if (instruction->op == IR_DIV) {
+				reduce_division(loops, block, previous, i);
+			}
+		}
+	}
+}
+
+static void reduce_multiplication(IrFunction *function,
+				  IrInstruction *instruction) {
+	int constant;
+	int other;
+	for (int i = 0; i < 2; i++) {
+		if (!constant_operand(function, instruction, i, &constant) ||
+		    constant_operand(function, instruction, 1 - i, &other)) {
+			continue;
+		}
+		int shift = exact_log2((uint32_t) constant);
+		if (shift > 0) {
+			instruction->op = IR_SHIFT_LEFT;
+			instruction->operands[0] = instruction->operands[1 - i];
+			instruction->operands[1] = -1;
+			instruction->immediate = shift;
+		}
+		return;
+	}
+}
+
+// Division by a negative constant divides by its absolute value, in an
+// instruction put before the division, and the division negates that.
+static void reduce_division(Loops *loops, int block, int previous,
+			    int index) {
+	IrFunction *function = loops->function;
+	IrInstruction *instruction = &function->instructions[index];
+	int constant;
+	int dividend;
+	if (!constant_operand(function, instruction, 1, &constant) ||
+	    constant_operand(function, instruction, 0, &dividend) ||
+	    constant == 0 || constant == 1 || constant == -1 ||
+	    constant == INT_MIN) {
+		return;
+	}
+	dividend = instruction->operands[0];
+	int divisor = constant < 0 ? -constant : constant;
+	int shift = exact_log2((uint32_t) divisor);
+	IrOp op = IR_DIV_SHIFT;
+	int immediate = shift;
+	if (shift < 0) {
+		uint32_t magic;
+		find_magic(divisor, &magic, &shift);
+		op = IR_DIV_MULTIPLY;
+		immediate = (int) magic;
+	}
+	if (constant < 0) {
+		int quotient =
+		    insert_ir(loops->program, function, block, previous, op,
+			      TY_INTEGER, dividend, -1, immediate);
+		function->instructions[quotient].count = shift;
+		instruction = &function->instructions[index];
+		op = IR_NEGATE;
+		dividend = quotient;
+		immediate = 0;
+	}
+	instruction->op = op;
+	instruction->operands[0] = dividend;
+	instruction->operands[1] = -1;
+	instruction->immediate = immediate;
+	instruction->count = op == IR_DIV_MULTIPLY ? shift : 0;
+}
+
+// Sets the constant if an operand is one.
+static bool constant_operand(IrFunction *function, IrInstruction *instruction,
+			     int which, int *constant) {
+	IrInstruction *operand =
+	    &function->instructions[instruction->operands[which]];
+	if (operand->op != IR_CONSTANT) {
+		return false;
+	}
+	*constant = operand->immediate;
+	return true;
+}
+
+// Returns the power of two that the value is, or -1.
+static int exact_log2(uint32_t value) {
+	if (value == 0 || (value & (value - 1)) != 0) {
+		return -1;
+	}
+	int log = 0;
+	while (value > 1) {
+		value >>= 1;
+		log++;
+	}
+	return log;
+}
+
+// Finds the magic number and shift that divide_by_multiply in chunk.h
+// divides by a divisor of at least 3 that is not a power of two with, the
+// way Hacker's Delight does: the smallest power 2^p from 2^32 on for
+// which the rounded-up reciprocal 2^p / divisor is close enough for every
+// dividend.
+static void find_magic(int divisor, uint32_t *magic, int *shift) {
+	const uint32_t two31 = 0x80000000u;
+	uint32_t d = (uint32_t) divisor;
+	uint32_t anc = two31 - 1 - two31 % d;
+	uint32_t q1 = two31 / anc;
+	uint32_t r1 = two31 - q1 * anc;
+	uint32_t q2 = two31 / d;
+	uint32_t r2 = two31 - q2 * d;
+	uint32_t delta;
+	int p = 31;
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= d) {
+			q2++;
+			r2 -= d;
+		}
+		delta = d - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	*magic = q2 + 1;
+	*shift = p - 32;
+}
+
+static void set_home(Loops *loops, int value, int slot) {
+	loops->homes[value] = slot;
+	loops->home_versions[value] = loops->versions[slot];
+}
+
+// Returns the slot that still holds the value, or -1.
+static int home(Loops *loops, int value) {
+	int slot = loops->homes[value];
+	if (slot < 0 || loops->home_versions[value] != loops->versions[slot]) {
+		return -1;
+	}
+	return slot;
+}
+
+static void to_load(IrInstruction *instruction, int slot) {
+	instruction->op = IR_LOAD;
+	instruction->operands[0] = -1;
+	instruction->operands[1] = -1;
+	instruction->immediate = slot;
+	instruction->count = 0;
+}
+
+static void remove_instruction(IrInstruction *instruction) {
+	instruction->op = IR_NOP;
+	instruction->operands[0] = -1;
+	instruction->operands[1] = -1;
+	instruction->immediate = 0;
+	instruction->count = 0;
+}
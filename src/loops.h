@@ -0,0 +1,14 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include "ir.h"
+
+// Moves computations that give the same value on every iteration of a loop
+// out of it, in front of the loop.
+void hoist_loop_invariants(IrProgram *program);
+// Replaces multiplications of a loop counter by a constant with a sum kept
+// up to date next to the counter, and multiplication and division by other
+// constants with cheaper operations.
+void reduce_strength(IrProgram *program);
+
+#endif
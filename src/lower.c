@@ -0,0 +1,718 @@
+#include "lower.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include "ir.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Lowering turns every block into stack code on its own, since values never
+// live across blocks. A value is normally computed where it is defined and
+// left on the stack for its first use, which works whenever the uses come
+// in the order the values were pushed, as they do for code straight from
+// the compiler. Any other use pushes the value again: a constant, from a
+// slot that still holds it or, failing that, from a temporary slot that
+// holds nothing else. Such a push goes right before the code of the next
+// operand that is already on the stack, so a block is built as a list that
+// instructions can be put into. Temporaries sit between the parameters and
+// the locals, after the temporary slots of the IR.
+//
+// Where a value goes is only found out by lowering the block: a use that
+// cannot be served changes the value's placement and the block is lowered
+// again. Every such change is for good, so this ends.
+
+typedef enum Placement {
+	// Computed where it is defined and left on the stack.
+	ON_STACK,
+	// Pushed at every use: a constant, or a load whose slot has not
+	// changed.
+	REMATERIALIZED,
+	// Computed where it is defined and stored in a temporary.
+	IN_TEMP,
+} Placement;
+
+// An instruction of the function being lowered. Jumps hold a block instead
+// of a chunk index, and variables and RETURN counts do not yet make room
+// for the temporaries. Keys order the items of a block that were appended;
+// one that was put before another has the same key.
+typedef struct Item {
+	Instruction instruction;
+	bool is_variable;
+	int key;
+	int previous;
+	int next;
+} Item;
+
+typedef struct Jump {
+	int index;
+	int block;
+} Jump;
+
+typedef struct Lowering {
+	Chunk *chunk;
+	FunctionList *flist;
+	IrFunction *function;
+
+	// Per value.
+	Placement *placements;
+	// Uses by instructions that are lowered, and how many are done.
+	int *uses;
+	int *consumed;
+	bool *is_needed;
+	int *temps;
+	int *temp_keys;
+	// Slot known to hold the value, the version it holds it in and the
+	// key from which on it does.
+	int *homes;
+	int *home_versions;
+	int *home_keys;
+	// First item of the code that computes a value left on the stack.
+	int *start_items;
+
+	// Per slot, bumped on every write.
+	int *versions;
+
+	// Instructions of the block being lowered.
+	int *order;
+	int order_count;
+	// Values on the stack.
+	int *stack;
+	int stack_count;
+	int block_temp_count;
+	int temp_count;
+	// The call that a RETURN right after it has turned into a tail call.
+	int tail_call;
+	// First item of the operands of the instruction being lowered.
+	int operand_start;
+
+	Item *items;
+	int item_count;
+	int item_capacity;
+	// Items of the block being lowered.
+	int first_item;
+	int last_item;
+	int clock;
+
+	// Per block.
+	int *block_items;
+	int *block_starts;
+	Jump *jumps;
+	int jump_count;
+	int jump_capacity;
+} Lowering;
+
+static void lower_function(Lowering *lowering, IrFunction *function,
+			   Function *f);
+static void collect_block(Lowering *lowering, int block);
+static bool lower_block(Lowering *lowering, int block);
+static int add_variable_item(Lowering *lowering, OpCode op_code, int slot,
+			     int before);
+static void lower_instruction(Lowering *lowering, int position, int next);
+static bool take_operands(Lowering *lowering, int index);
+static bool is_first_stack_use(Lowering *lowering, int *operands, int k);
+static int push_value(Lowering *lowering, int value, int before);
+static void demote(Lowering *lowering, int value);
+static void write_slot(Lowering *lowering, int slot, int value);
+static int frame_slot(Lowering *lowering, int slot);
+static int temp_slot(Lowering *lowering, int temp);
+static int next_block(IrFunction *function, int block);
+
+static int add_item(Lowering *lowering, OpCode op_code, uint32_t first,
+		    uint32_t second, int before);
+static void write_items(Lowering *lowering, int first);
+static OpCode lowered_op_code(IrOp op);
+
+void lower_program(IrProgram *program, FunctionList *flist, Chunk *chunk) {
+	Lowering lowering;
+	lowering.chunk = chunk;
+	lowering.flist = flist;
+
+	int max_instructions = 1;
+	int max_slots = 1;
+	int max_blocks = 1;
+	for (int i = 0; i < program->count; i++) {
+		IrFunction *function = &program->functions[i];
+		if (function->instruction_count > max_instructions) {
+			max_instructions = function->instruction_count;
+		}
+		if (function->slot_count + function->temp_count > max_slots) {
+			max_slots = function->slot_count + function->temp_count;
+		}
+		if (function->block_count > max_blocks) {
+			max_blocks = function->block_count;
+		}
+	}
+	lowering.placements = malloc(max_instructions * sizeof(Placement));
+	lowering.uses = malloc(max_instructions * sizeof(int));
+	lowering.consumed = malloc(max_instructions * sizeof(int));
+	lowering.is_needed = malloc(max_instructions * sizeof(bool));
+	lowering.temps = malloc(max_instructions * sizeof(int));
+	lowering.temp_keys = malloc(max_instructions * sizeof(int));
+	lowering.homes = malloc(max_instructions * sizeof(int));
+	lowering.home_versions = malloc(max_instructions * sizeof(int));
+	lowering.home_keys = malloc(max_instructions * sizeof(int));
+	lowering.start_items = malloc(max_instructions * sizeof(int));
+	lowering.versions = calloc(max_slots, sizeof(int));
+	lowering.order = malloc(max_instructions * sizeof(int));
+	lowering.stack = malloc(max_instructions * sizeof(int));
+	lowering.item_capacity = 64;
+	lowering.items = malloc(lowering.item_capacity * sizeof(Item));
+	lowering.block_items = malloc(max_blocks * sizeof(int));
+	lowering.block_starts = malloc(max_blocks * sizeof(int));
+	lowering.jump_capacity = 16;
+	lowering.jumps = malloc(lowering.jump_capacity * sizeof(Jump));
+
+	// A short CALL: the target is patched in once main is known.
+	write_into_chunk(chunk, OP_CALL);
+	int main_function_index = reserve_place_in_chunk(chunk);
+	write_into_chunk(chunk, 0);
+	write_into_chunk(chunk, OP_EXIT);
+
+	for (int i = 0; i < program->count; i++) {
+		lower_function(&lowering, &program->functions[i],
+			       &flist->functions[i]);
+	}
+
+	patch_chunk(chunk, main_function_index,
+		    find_main_function(flist)->index);
+	infer_purity(chunk, flist);
+
+	free(lowering.placements);
+	free(lowering.uses);
+	free(lowering.consumed);
+	free(lowering.is_needed);
+	free(lowering.temps);
+	free(lowering.temp_keys);
+	free(lowering.homes);
+	free(lowering.home_versions);
+	free(lowering.home_keys);
+	free(lowering.start_items);
+	free(lowering.versions);
+	free(lowering.order);
+	free(lowering.stack);
+	free(lowering.items);
+	free(lowering.block_items);
+	free(lowering.block_starts);
+	free(lowering.jumps);
+}
+
+static void lower_function(Lowering *lowering, IrFunction *function,
+			   Function *f) {
+	lowering->function = function;
+	// Nothing is written until every block is lowered, so calls to the
+	// function itself can already use where it starts.
+	Chunk *chunk = lowering->chunk;
+	f->index = chunk->length;
+	for (int i = 0; i < function->instruction_count; i++) {
+		bool is_constant = function->instructions[i].op == IR_CONSTANT;
+		lowering->placements[i] =
+		    is_constant ? REMATERIALIZED : ON_STACK;
+	}
+
+	// Temporaries are numbered per block, so a function needs as many
+	// as its most demanding block. Their number moves the locals, so
+	// the blocks are only written once it is known.
+	lowering->temp_count = 0;
+	lowering->item_count = 0;
+	for (int i = 0; i < function->block_count; i++) {
+		if (function->blocks[i].is_removed) {
+			continue;
+		}
+		collect_block(lowering, i);
+		int mark = lowering->item_count;
+		while (!lower_block(lowering, i)) {
+			lowering->item_count = mark;
+		}
+		lowering->block_items[i] = lowering->first_item;
+		if (lowering->block_temp_count > lowering->temp_count) {
+			lowering->temp_count = lowering->block_temp_count;
+		}
+	}
+
+	for (int i = 0; i < function->temp_count + lowering->temp_count; i++) {
+		Instruction push = {.op_code = OP_PUSH, .operands = {0, 0}};
+		write_instruction(chunk, &push);
+	}
+	lowering->jump_count = 0;
+	for (int i = 0; i < function->block_count; i++) {
+		if (function->blocks[i].is_removed) {
+			continue;
+		}
+		lowering->block_starts[i] = chunk->length;
+		write_items(lowering, lowering->block_items[i]);
+	}
+	for (int i = 0; i < lowering->jump_count; i++) {
+		Jump *jump = &lowering->jumps[i];
+		patch_chunk(chunk, jump->index,
+			    lowering->block_starts[jump->block]);
+	}
+}
+
+// Lists the instructions of a block and finds the values that are used,
+// starting from the instructions that do more than compute a value.
+static void collect_block(Lowering *lowering, int block) {
+	IrFunction *function = lowering->function;
+	lowering->order_count = 0;
+	for (int i = function->blocks[block].first; i >= 0;
+	     i = function->instructions[i].next) {
+		if (function->instructions[i].op != IR_NOP) {
+			lowering->order[lowering->order_count++] = i;
+			lowering->uses[i] = 0;
+		}
+	}
+
+	for (int i = lowering->order_count - 1; i >= 0; i--) {
+		int index = lowering->order[i];
+		IrInstruction *instruction = &function->instructions[index];
+		bool is_needed =
+		    !is_ir_pure(instruction->op) || lowering->uses[index] > 0;
+		lowering->is_needed[index] = is_needed;
+		if (!is_needed) {
+			continue;
+		}
+		int count;
+		int *operands = ir_operands(function, instruction, &count);
+		for (int j = 0; j < count; j++) {
+			lowering->uses[operands[j]]++;
+		}
+	}
+}
+
+// Returns false if a value had to be placed differently.
+static bool lower_block(Lowering *lowering, int block) {
+	for (int i = 0; i < lowering->order_count; i++) {
+		int index = lowering->order[i];
+		lowering->consumed[index] = 0;
+		lowering->homes[index] = -1;
+	}
+	lowering->stack_count = 0;
+	lowering->block_temp_count = 0;
+	lowering->tail_call = -1;
+	lowering->first_item = -1;
+	lowering->last_item = -1;
+	lowering->clock = 0;
+
+	int next = next_block(lowering->function, block);
+	for (int i = 0; i < lowering->order_count; i++) {
+		int index = lowering->order[i];
+		if (!lowering->is_needed[index]) {
+			continue;
+		}
+		if (!take_operands(lowering, index)) {
+			return false;
+		}
+		lower_instruction(lowering, i, next);
+	}
+	return true;
+}
+
+static void lower_instruction(Lowering *lowering, int position, int next) {
+	IrFunction *function = lowering->function;
+	int index = lowering->order[position];
+	IrInstruction *instruction = &function->instructions[index];
+	int slot = instruction->immediate;
+	int item = -1;
+
+	switch (instruction->op) {
+		case IR_NOP:
+		case IR_CONSTANT:
+		case IR_END:
+			break;
+		case IR_LOAD:
+			lowering->homes[index] = slot;
+			lowering->home_versions[index] =
+			    lowering->versions[slot];
+			lowering->home_keys[index] = lowering->clock;
+			if (lowering->placements[index] != REMATERIALIZED) {
+				item = add_variable_item(lowering, OP_LOAD,
+							 slot, -1);
+			}
+			break;
+		case IR_STORE:
+			add_variable_item(lowering, OP_STORE, slot, -1);
+			write_slot(lowering, slot, instruction->operands[0]);
+			break;
+		case IR_LOCAL:
+			// The value is already where the local lives.
+			write_slot(lowering, slot, instruction->operands[0]);
+			break;
+		case IR_POP:
+			for (int i = 0; i < instruction->count; i++) {
+				add_item(lowering, OP_POP, 0, 0, -1);
+				write_slot(lowering, slot + i, -1);
+			}
+			break;
+		case IR_PRINT:
+			switch (instruction->type) {
+				case TY_UNIT:
+					add_item(lowering, OP_PRINT_UNIT, 0, 0,
+						 -1);
+					break;
+				case TY_INTEGER:
+					add_item(lowering, OP_PRINT_INTEGER, 0,
+						 0, -1);
+					break;
+				case TY_BOOLEAN:
+					add_item(lowering, OP_PRINT_BOOLEAN, 0,
+						 0, -1);
+					break;
+			}
+			break;
+		case IR_CALL: {
+			// Nothing is left to do in this frame after a call
+			// that is returned right away, so the callee can take
+			// it over instead of pushing a new one.
+			OpCode op_code = OP_CALL;
+			if (position + 1 < lowering->order_count) {
+				IrInstruction *after =
+				    &function->instructions
+					 [lowering->order[position + 1]];
+				if (after->op == IR_RETURN &&
+				    after->operands[0] == index &&
+				    lowering->uses[index] == 1 &&
+				    lowering->placements[index] == ON_STACK) {
+					op_code = OP_TAIL_CALL;
+					lowering->tail_call = index;
+				}
+			}
+			Function *callee =
+			    &lowering->flist->functions[instruction->immediate];
+			item = add_item(lowering, op_code, callee->index,
+					instruction->count, -1);
+			break;
+		}
+		case IR_JUMP:
+			if (instruction->targets[0] != next) {
+				add_item(lowering, OP_JUMP,
+					 instruction->targets[0], 0, -1);
+			}
+			break;
+		case IR_BRANCH:
+			add_item(lowering, OP_JUMP_IF_FALSE,
+				 instruction->targets[1], 0, -1);
+			if (instruction->targets[0] != next) {
+				add_item(lowering, OP_JUMP,
+					 instruction->targets[0], 0, -1);
+			}
+			break;
+		case IR_SHIFT_LEFT:
+		case IR_DIV_SHIFT:
+		case IR_DIV_MULTIPLY:
+			item = add_item(lowering,
+					lowered_op_code(instruction->op),
+					(uint32_t) instruction->immediate,
+					(uint32_t) instruction->count, -1);
+			break;
+		case IR_RETURN:
+			if (lowering->tail_call != instruction->operands[0]) {
+				add_item(lowering, OP_RETURN,
+					 instruction->count, 0, -1);
+			}
+			break;
+		default:
+			item = add_item(lowering,
+					lowered_op_code(instruction->op), 0, 0,
+					-1);
+			break;
+	}
+
+	if (!is_ir_pure(instruction->op) && instruction->op != IR_CALL) {
+		return;
+	}
+	if (lowering->uses[index] == 0) {
+		// Only calls are lowered without being used.
+		add_item(lowering, OP_POP, 0, 0, -1);
+		return;
+	}
+	switch (lowering->placements[index]) {
+		case ON_STACK:
+			lowering->start_items[index] =
+			    lowering->operand_start >= 0
+				? lowering->operand_start
+				: item;
+			lowering->stack[lowering->stack_count++] = index;
+			break;
+		case IN_TEMP: {
+			int temp = lowering->block_temp_count++;
+			lowering->temps[index] = temp;
+			add_item(lowering, OP_STORE, temp_slot(lowering, temp),
+				 0, -1);
+			lowering->temp_keys[index] = lowering->clock;
+			break;
+		}
+		case REMATERIALIZED:
+			break;
+	}
+}
+
+// Operands that were left on the stack for this use have to be right at
+// the top, in order. Any other operand is pushed right before the code of
+// the next one that was, or last. Locals, scopes and block ends also need
+// the stack to hold nothing else.
+static bool take_operands(Lowering *lowering, int index) {
+	IrInstruction *instruction = &lowering->function->instructions[index];
+	int count;
+	int *operands = ir_operands(lowering->function, instruction, &count);
+	int taken = 0;
+	for (int k = 0; k < count; k++) {
+		if (is_first_stack_use(lowering, operands, k)) {
+			taken++;
+		}
+	}
+	int base = lowering->stack_count - taken;
+	int position = base;
+	for (int k = 0; k < count; k++) {
+		if (!is_first_stack_use(lowering, operands, k)) {
+			continue;
+		}
+		if (position < 0 ||
+		    lowering->stack[position] != operands[k]) {
+			demote(lowering, operands[k]);
+			return false;
+		}
+		position++;
+	}
+	bool needs_empty_stack = instruction->op == IR_LOCAL ||
+				 instruction->op == IR_POP ||
+				 is_ir_terminator(instruction->op);
+	if (needs_empty_stack && base > 0) {
+		for (int i = 0; i < base; i++) {
+			demote(lowering, lowering->stack[i]);
+		}
+		return false;
+	}
+
+	lowering->operand_start = -1;
+	position = base;
+	for (int k = 0; k < count; k++) {
+		int item;
+		if (is_first_stack_use(lowering, operands, k)) {
+			lowering->consumed[operands[k]]++;
+			item = lowering->start_items[operands[k]];
+			position++;
+		} else {
+			int before = position < lowering->stack_count
+					 ? lowering->stack[position]
+					 : -1;
+			item = push_value(lowering, operands[k], before);
+			if (item < 0) {
+				return false;
+			}
+		}
+		if (k == 0) {
+			lowering->operand_start = item;
+		}
+	}
+	lowering->stack_count = base;
+	return true;
+}
+
+static bool is_first_stack_use(Lowering *lowering, int *operands, int k) {
+	int value = operands[k];
+	if (lowering->placements[value] != ON_STACK ||
+	    lowering->consumed[value] > 0) {
+		return false;
+	}
+	for (int i = 0; i < k; i++) {
+		if (operands[i] == value) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Pushes a value right before the code of another value on the stack, or
+// last if that is -1, and returns the item that does. A value that cannot
+// be pushed there is placed differently and -1 is returned; one that
+// already has a temporary can only have been computed too late, so the
+// other value has to move out of the way instead.
+static int push_value(Lowering *lowering, int value, int before) {
+	IrInstruction *instruction = &lowering->function->instructions[value];
+	int before_item = before >= 0 ? lowering->start_items[before] : -1;
+	int key = before_item >= 0 ? lowering->items[before_item].key
+				   : lowering->clock;
+	lowering->consumed[value]++;
+	if (instruction->op == IR_CONSTANT) {
+		return add_item(lowering, OP_PUSH, instruction->immediate, 0,
+				before_item);
+	}
+	if (lowering->placements[value] == IN_TEMP) {
+		if (lowering->temp_keys[value] <= key) {
+			return add_item(lowering, OP_LOAD,
+					temp_slot(lowering,
+						  lowering->temps[value]),
+					0, before_item);
+		}
+		demote(lowering, before);
+		return -1;
+	}
+	int home = lowering->homes[value];
+	if (home >= 0 &&
+	    lowering->versions[home] == lowering->home_versions[value] &&
+	    lowering->home_keys[value] <= key) {
+		return add_variable_item(lowering, OP_LOAD, home,
+					 before_item);
+	}
+	demote(lowering, value);
+	return -1;
+}
+
+// Loads can be pushed again while their slot is unchanged; anything else
+// that cannot stay on the stack goes into a temporary.
+static void demote(Lowering *lowering, int value) {
+	IrInstruction *instruction = &lowering->function->instructions[value];
+	Placement *placement = &lowering->placements[value];
+	if (*placement == ON_STACK && instruction->op == IR_LOAD) {
+		*placement = REMATERIALIZED;
+	} else {
+		*placement = IN_TEMP;
+	}
+}
+
+// A value of -1 means the slot is gone.
+static void write_slot(Lowering *lowering, int slot, int value) {
+	lowering->versions[slot]++;
+	if (value >= 0) {
+		lowering->homes[value] = slot;
+		lowering->home_versions[value] = lowering->versions[slot];
+		lowering->home_keys[value] = lowering->clock;
+	}
+}
+
+// The frame holds the parameters, the temporary slots of the IR, those of
+// the lowering and then the locals.
+static int frame_slot(Lowering *lowering, int slot) {
+	IrFunction *function = lowering->function;
+	if (slot < function->parameter_count) {
+		return slot;
+	}
+	if (slot >= function->slot_count) {
+		return function->parameter_count + slot - function->slot_count;
+	}
+	return slot + function->temp_count + lowering->temp_count;
+}
+
+static int temp_slot(Lowering *lowering, int temp) {
+	IrFunction *function = lowering->function;
+	return function->parameter_count + function->temp_count + temp;
+}
+
+static int next_block(IrFunction *function, int block) {
+	for (int i = block + 1; i < function->block_count; i++) {
+		if (!function->blocks[i].is_removed) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Adds an instruction at the end of the block, or right before another
+// item if that is not -1. Operands the opcode does not take are ignored.
+static int add_item(Lowering *lowering, OpCode op_code, uint32_t first,
+		    uint32_t second, int before) {
+	if (lowering->item_count == lowering->item_capacity) {
+		lowering->item_capacity *= 2;
+		lowering->items =
+		    realloc(lowering->items,
+			    lowering->item_capacity * sizeof(Item));
+	}
+	int index = lowering->item_count++;
+	Item *item = &lowering->items[index];
+	item->instruction.op_code = op_code;
+	item->instruction.operands[0] = first;
+	item->instruction.operands[1] = second;
+	item->is_variable = false;
+
+	if (before < 0) {
+		item->key = lowering->clock++;
+		item->previous = lowering->last_item;
+		item->next = -1;
+		lowering->last_item = index;
+	} else {
+		item->key = lowering->items[before].key;
+		item->previous = lowering->items[before].previous;
+		item->next = before;
+		lowering->items[before].previous = index;
+	}
+	if (item->previous >= 0) {
+		lowering->items[item->previous].next = index;
+	} else {
+		lowering->first_item = index;
+	}
+	return index;
+}
+
+static int add_variable_item(Lowering *lowering, OpCode op_code, int slot,
+			     int before) {
+	int index = add_item(lowering, op_code, slot, 0, before);
+	lowering->items[index].is_variable = true;
+	return index;
+}
+
+// Writes the items of a block from the first one on. Jump targets are
+// patched in once every block of the function has a place.
+static void write_items(Lowering *lowering, int first) {
+	Chunk *chunk = lowering->chunk;
+	for (int i = first; i >= 0; i = lowering->items[i].next) {
+		Instruction instruction = lowering->items[i].instruction;
+		if (lowering->items[i].is_variable) {
+			instruction.operands[0] =
+			    frame_slot(lowering, instruction.operands[0]);
+		} else if (instruction.op_code == OP_RETURN) {
+			instruction.operands[0] +=
+			    lowering->function->temp_count +
+			    lowering->temp_count;
+		}
+		if (instruction.op_code != OP_JUMP &&
+		    instruction.op_code != OP_JUMP_IF_FALSE) {
+			write_instruction(chunk, &instruction);
+			continue;
+		}
+		write_into_chunk(chunk, instruction.op_code);
+		if (lowering->jump_count == lowering->jump_capacity) {
+			lowering->jump_capacity *= 2;
+			lowering->jumps =
+			    realloc(lowering->jumps,
+				    lowering->jump_capacity * sizeof(Jump));
+		}
+		Jump *jump = &lowering->jumps[lowering->jump_count++];
+		jump->index = reserve_place_in_chunk(chunk);
+		jump->block = (int) instruction.operands[0];
+	}
+}
+
+static OpCode lowered_op_code(IrOp op) {
+	switch (op) {
+		case IR_ADD:
+			return OP_ADD;
+		case IR_SUB:
+			return OP_SUB;
+		case IR_MUL:
+			return OP_MUL;
+		case IR_DIV:
+			return OP_DIV;
+		case IR_NEGATE:
+			return OP_NEGATE;
+		case IR_SHIFT_LEFT:
+			return OP_SHIFT_LEFT;
+		case IR_DIV_SHIFT:
+			return OP_DIV_SHIFT;
+		case IR_DIV_MULTIPLY:
+			return OP_DIV_MULTIPLY;
+		case IR_EQUAL:
+			return OP_EQUAL;
+		case IR_NOT_EQUAL:
+			return OP_NOT_EQUAL;
+		case IR_LESS:
+			return OP_LESS;
+		case IR_LESS_EQUAL:
+			return OP_LESS_EQUAL;
+		case IR_GREATER:
+			return OP_GREATER;
+		case IR_GREATER_EQUAL:
+			return OP_GREATER_EQUAL;
+		default:
+			return OP_NOOP;
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "chunk.h"
+#include "function.h"
+#include "ir.h"
+
+// Writes the bytecode of every function in the program into the empty
+// chunk, after a call to main, and sets where each function starts.
+void lower_program(IrProgram *program, FunctionList *flist, Chunk *chunk);
+
+#endif
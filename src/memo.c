@@ -0,0 +1,162 @@
+#include "memo.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool *find_costly_functions(Chunk *chunk, FunctionList *flist);
+static uint32_t hash_arguments(int *arguments);
+static bool same_arguments(int *a, int *b);
+
+void init_memoizer(Memoizer *memoizer, Chunk *chunk, FunctionList *flist) {
+	memoizer->flist = flist;
+	memoizer->tables = calloc(flist->count, sizeof(MemoTable));
+	memoizer->table_at = calloc(chunk->length + 1, sizeof(MemoTable *));
+	bool *is_costly = find_costly_functions(chunk, flist);
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		MemoTable *table = &memoizer->tables[i];
+		table->parameter_count = f->parameter_count;
+		table->state = MEMO_COUNTING;
+		table->entries = NULL;
+		if (f->is_pure && is_costly[i] &&
+		    f->parameter_count <= MEMO_MAX_ARGUMENTS) {
+			memoizer->table_at[f->index] = table;
+		}
+	}
+	free(is_costly);
+	memoizer->calls = malloc(16 * sizeof(MemoCall));
+	memoizer->call_count = 0;
+	memoizer->call_capacity = 16;
+}
+
+void free_memoizer(Memoizer *memoizer) {
+	for (int i = 0; i < memoizer->flist->count; i++) {
+		free(memoizer->tables[i].entries);
+	}
+	free(memoizer->tables);
+	free(memoizer->table_at);
+	free(memoizer->calls);
+}
+
+bool memo_should_cache(MemoTable *table) {
+	table->calls++;
+	if (table->state == MEMO_COUNTING && table->calls > MEMO_THRESHOLD) {
+		table->entries = calloc(MEMO_ENTRIES, sizeof(MemoEntry));
+		table->state = MEMO_CACHING;
+	}
+	return table->state == MEMO_CACHING;
+}
+
+MemoEntry *memo_lookup(MemoTable *table, MemoCall *call, bool *hit) {
+	MemoEntry *entry =
+	    &table->entries[hash_arguments(call->arguments) % MEMO_ENTRIES];
+	*hit = entry->used && same_arguments(entry->arguments, call->arguments);
+	if (*hit) {
+		table->hits++;
+	} else {
+		table->misses++;
+	}
+	// Pending calls may still store into a dropped cache, so its entries
+	// stay around.
+	uint64_t lookups = table->hits + table->misses;
+	if (lookups == MEMO_TRIAL && table->hits * 4 < lookups) {
+		table->state = MEMO_DROPPED;
+	}
+	return entry;
+}
+
+MemoCall *memo_next_call(Memoizer *memoizer) {
+	if (memoizer->call_count == memoizer->call_capacity) {
+		memoizer->call_capacity *= 2;
+		memoizer->calls =
+		    realloc(memoizer->calls,
+			    memoizer->call_capacity * sizeof(MemoCall));
+	}
+	return &memoizer->calls[memoizer->call_count];
+}
+
+void memo_store(MemoCall *call, int result) {
+	MemoEntry *entry = call->entry;
+	for (int i = 0; i < MEMO_MAX_ARGUMENTS; i++) {
+		entry->arguments[i] = call->arguments[i];
+	}
+	entry->result = result;
+	entry->used = true;
+}
+
+void print_memo_stats(FILE *file, Memoizer *memoizer) {
+	FunctionList *flist = memoizer->flist;
+	fprintf(file, "== Memoization ==\n");
+	fprintf(file, "%-20s %12s %12s %12s\n", "function", "calls", "hits",
+		"misses");
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		MemoTable *table = &memoizer->tables[i];
+		if (memoizer->table_at[f->index] != table || table->calls == 0) {
+			continue;
+		}
+		fprintf(file, "%-20.*s %12" PRIu64 " %12" PRIu64 " %12" PRIu64,
+			f->name.length, f->name.start, table->calls,
+			table->hits, table->misses);
+		if (table->state == MEMO_DROPPED) {
+			fprintf(file, " (dropped)");
+		}
+		fprintf(file, "\n");
+	}
+}
+
+// A function that neither calls nor loops runs each instruction at most
+// once, which is about as fast as looking its result up.
+static bool *find_costly_functions(Chunk *chunk, FunctionList *flist) {
+	bool *is_costly = calloc(flist->count, sizeof(bool));
+	int *function_at = malloc((chunk->length + 1) * sizeof(int));
+	for (int i = 0; i <= chunk->length; i++) {
+		function_at[i] = -1;
+	}
+	for (int i = 0; i < flist->count; i++) {
+		function_at[flist->functions[i].index] = i;
+	}
+
+	int function = -1;
+	int index = 0;
+	while (index < chunk->length) {
+		if (function_at[index] >= 0) {
+			function = function_at[index];
+		}
+		Instruction instruction;
+		int next = decode_instruction(chunk, index, &instruction);
+		bool calls = instruction.op_code == OP_CALL ||
+			     instruction.op_code == OP_TAIL_CALL;
+		int target = jump_target(&instruction);
+		bool loops = target >= 0 && target <= index;
+		if (function >= 0 && (calls || loops)) {
+			is_costly[function] = true;
+		}
+		index = next;
+	}
+
+	free(function_at);
+	return is_costly;
+}
+
+// Unused arguments are zero, so every key has the same length.
+static uint32_t hash_arguments(int *arguments) {
+	uint32_t hash = 0;
+	for (int i = 0; i < MEMO_MAX_ARGUMENTS; i++) {
+		hash = (hash ^ (uint32_t) arguments[i]) * 0x9e3779b1u;
+	}
+	return hash ^ hash >> 16;
+}
+
+static bool same_arguments(int *a, int *b) {
+	for (int i = 0; i < MEMO_MAX_ARGUMENTS; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
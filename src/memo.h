@@ -0,0 +1,80 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "chunk.h"
+#include "function.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Pure functions with up to this many arguments can be memoized.
+#define MEMO_MAX_ARGUMENTS 4
+// Results each function keeps, a power of two. A new result replaces
+// whatever is in its slot, so the cache never grows.
+#define MEMO_ENTRIES 1024
+// Calls a function takes before its results are cached, so that functions
+// that are hardly called cost no memory.
+#define MEMO_THRESHOLD 32
+// Lookups after which a cache that hits less than a quarter of the time is
+// given up on.
+#define MEMO_TRIAL 4096
+
+typedef struct MemoEntry {
+	int arguments[MEMO_MAX_ARGUMENTS];
+	int result;
+	bool used;
+} MemoEntry;
+
+typedef enum MemoState {
+	MEMO_COUNTING,
+	MEMO_CACHING,
+	MEMO_DROPPED,
+} MemoState;
+
+typedef struct MemoTable {
+	int parameter_count;
+	MemoState state;
+	uint64_t calls;
+	uint64_t hits;
+	uint64_t misses;
+	// NULL until the function is cached.
+	MemoEntry *entries;
+} MemoTable;
+
+// A call that missed the cache, waiting for its result. depth is the
+// number of frames below the call.
+typedef struct MemoCall {
+	int depth;
+	MemoEntry *entry;
+	int arguments[MEMO_MAX_ARGUMENTS];
+} MemoCall;
+
+typedef struct Memoizer {
+	FunctionList *flist;
+	// One per function, used only by the pure ones.
+	MemoTable *tables;
+	// Table of the function starting at each chunk index, or NULL where
+	// no memoized function starts.
+	MemoTable **table_at;
+	// At most one per frame. Grows with the recursion rather than being
+	// sized for the deepest stack that --max-depth allows.
+	MemoCall *calls;
+	int call_count;
+	int call_capacity;
+} Memoizer;
+
+void init_memoizer(Memoizer *memoizer, Chunk *chunk, FunctionList *flist);
+void free_memoizer(Memoizer *memoizer);
+
+// Counts a call and returns whether its result should be looked up.
+bool memo_should_cache(MemoTable *table);
+// Returns the entry for the arguments, which holds their result if it is
+// used and has the same arguments, and is where it goes otherwise.
+MemoEntry *memo_lookup(MemoTable *table, MemoCall *call, bool *hit);
+// Returns the place for the next pending call, which becomes pending once
+// call_count is incremented.
+MemoCall *memo_next_call(Memoizer *memoizer);
+void memo_store(MemoCall *call, int result);
+void print_memo_stats(FILE *file, Memoizer *memoizer);
+
+#endif
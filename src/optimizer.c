@@ -0,0 +1,372 @@
+#include "optimizer.h"
+#include "chunk.h"
+#include "function.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The optimizer decodes the finished chunk into a list of instructions,
+// rewrites that list in place and encodes it back. While it works on the
+// list, jump and call operands hold list indices instead of byte offsets,
+// and removed instructions stay in the list so that a target pointing at
+// one simply falls through to the next live instruction.
+
+typedef struct Entry {
+	Instruction instruction;
+	bool removed;
+	bool is_target;
+} Entry;
+
+typedef struct Optimizer {
+	Entry *entries;
+	int count;
+	FunctionList *flist;
+} Optimizer;
+
+static void decode_chunk(Optimizer *optimizer, Chunk *chunk);
+static void encode_chunk(Optimizer *optimizer, Chunk *chunk);
+static void mark_targets(Optimizer *optimizer);
+static int next_live(Optimizer *optimizer, int index);
+
+static bool fuse_comparisons(Optimizer *optimizer);
+static bool fuse_increments(Optimizer *optimizer);
+static bool fuse_pops(Optimizer *optimizer);
+static bool thread_jumps(Optimizer *optimizer);
+
+static bool is_jump(OpCode op_code);
+static bool has_code_target(OpCode op_code);
+static OpCode negated_jump(OpCode comparison);
+
+void optimize_chunk(Chunk *chunk, FunctionList *flist) {
+	Optimizer optimizer;
+	optimizer.flist = flist;
+	decode_chunk(&optimizer, chunk);
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		mark_targets(&optimizer);
+		changed |= thread_jumps(&optimizer);
+		mark_targets(&optimizer);
+		changed |= fuse_comparisons(&optimizer);
+		mark_targets(&optimizer);
+		changed |= fuse_increments(&optimizer);
+		mark_targets(&optimizer);
+		changed |= fuse_pops(&optimizer);
+	}
+
+	mark_targets(&optimizer);
+	encode_chunk(&optimizer, chunk);
+	free(optimizer.entries);
+}
+
+static void decode_chunk(Optimizer *optimizer, Chunk *chunk) {
+	// One entry per byte is an upper bound on the instruction count.
+	optimizer->entries = malloc((chunk->length + 1) * sizeof(Entry));
+	int *entry_of = malloc((chunk->length + 1) * sizeof(int));
+
+	int count = 0;
+	int index = 0;
+	while (index < chunk->length) {
+		Entry *entry = &optimizer->entries[count];
+		entry->removed = false;
+		entry->is_target = false;
+		entry_of[index] = count++;
+		index = decode_instruction(chunk, index, &entry->instruction);
+	}
+	// Jumps out of the last block of the last function land here.
+	entry_of[chunk->length] = count;
+	optimizer->count = count;
+
+	for (int i = 0; i < count; i++) {
+		Instruction *instruction = &optimizer->entries[i].instruction;
+		if (has_code_target(instruction->op_code)) {
+			instruction->operands[0] = entry_of[instruction->operands[0]];
+		}
+	}
+	FunctionList *flist = optimizer->flist;
+	for (int i = 0; i < flist->count; i++) {
+		flist->functions[i].index = entry_of[flist->functions[i].index];
+	}
+
+	free(entry_of);
+}
+
+static void encode_chunk(Optimizer *optimizer, Chunk *chunk) {
+	int *position = malloc((optimizer->count + 1) * sizeof(int));
+	int length = 0;
+	for (int i = 0; i < optimizer->count; i++) {
+		position[i] = length;
+		Entry *entry = &optimizer->entries[i];
+		if (!entry->removed) {
+			length += instruction_size(&entry->instruction);
+		}
+	}
+	position[optimizer->count] = length;
+
+	chunk->length = 0;
+	for (int i = 0; i < optimizer->count; i++) {
+		Entry *entry = &optimizer->entries[i];
+		if (entry->removed) {
+			continue;
+		}
+		Instruction instruction = entry->instruction;
+		if (has_code_target(instruction.op_code)) {
+			instruction.operands[0] =
+			    position[instruction.operands[0]];
+		}
+		write_instruction(chunk, &instruction);
+	}
+
+	FunctionList *flist = optimizer->flist;
+	for (int i = 0; i < flist->count; i++) {
+		flist->functions[i].index = position[flist->functions[i].index];
+	}
+
+	free(position);
+}
+
+static void mark_targets(Optimizer *optimizer) {
+	for (int i = 0; i < optimizer->count; i++) {
+		optimizer->entries[i].is_target = false;
+	}
+
+	for (int i = 0; i < optimizer->count; i++) {
+		Entry *entry = &optimizer->entries[i];
+		if (entry->removed ||
+		    !has_code_target(entry->instruction.op_code)) {
+			continue;
+		}
+		int target = next_live(optimizer, entry->instruction.operands[0]);
+		entry->instruction.operands[0] = target;
+		if (target < optimizer->count) {
+			optimizer->entries[target].is_target = true;
+		}
+	}
+
+	FunctionList *flist = optimizer->flist;
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[i];
+		f->index = next_live(optimizer, f->index);
+		if (f->index < optimizer->count) {
+			optimizer->entries[f->index].is_target = true;
+		}
+	}
+}
+
+static int next_live(Optimizer *optimizer, int index) {
+	while (index < optimizer->count && optimizer->entries[index].removed) {
+		index++;
+	}
+	return index;
+}
+
+// A comparison followed by a conditional jump becomes one compare-and-branch
+// that jumps when the comparison does not hold.
+static bool fuse_comparisons(Optimizer *optimizer) {
+	bool changed = false;
+	for (int a = next_live(optimizer, 0); a < optimizer->count;
+	     a = next_live(optimizer, a + 1)) {
+		Entry *comparison = &optimizer->entries[a];
+		OpCode fused = negated_jump(comparison->instruction.op_code);
+		if (fused == OP_NOOP) {
+			continue;
+		}
+
+		int b = next_live(optimizer, a + 1);
+		if (b == optimizer->count) {
+			break;
+		}
+		Entry *jump = &optimizer->entries[b];
+		if (jump->instruction.op_code != OP_JUMP_IF_FALSE ||
+		    jump->is_target) {
+			continue;
+		}
+
+		comparison->instruction.op_code = fused;
+		comparison->instruction.operands[0] =
+		    jump->instruction.operands[0];
+		jump->removed = true;
+		changed = true;
+	}
+	return changed;
+}
+
+// LOAD i; PUSH k; ADD; STORE i (or PUSH k; LOAD i; ADD; STORE i, or the same
+// with SUB and the first form) becomes INCREMENT i k.
+static bool fuse_increments(Optimizer *optimizer) {
+	bool changed = false;
+	for (int a = next_live(optimizer, 0); a < optimizer->count;
+	     a = next_live(optimizer, a + 1)) {
+		int b = next_live(optimizer, a + 1);
+		int c = next_live(optimizer, b + 1);
+		int d = next_live(optimizer, c + 1);
+		if (d >= optimizer->count) {
+			break;
+		}
+
+		Entry *entries = optimizer->entries;
+		if (entries[b].is_target || entries[c].is_target ||
+		    entries[d].is_target) {
+			continue;
+		}
+
+		Instruction *first = &entries[a].instruction;
+		Instruction *second = &entries[b].instruction;
+		Instruction *operation = &entries[c].instruction;
+		Instruction *store = &entries[d].instruction;
+		if (store->op_code != OP_STORE) {
+			continue;
+		}
+
+		Instruction *load;
+		Instruction *push;
+		if (first->op_code == OP_LOAD && second->op_code == OP_PUSH) {
+			load = first;
+			push = second;
+		} else if (first->op_code == OP_PUSH &&
+			   second->op_code == OP_LOAD &&
+			   operation->op_code == OP_ADD) {
+			load = second;
+			push = first;
+		} else {
+			continue;
+		}
+
+		if (load->operands[0] != store->operands[0]) {
+			continue;
+		}
+
+		int amount = (int) push->operands[0];
+		if (operation->op_code == OP_SUB) {
+			amount = (int) (0u - (uint32_t) amount);
+		} else if (operation->op_code != OP_ADD) {
+			continue;
+		}
+
+		uint32_t slot = load->operands[0];
+		first->op_code = OP_INCREMENT;
+		first->operands[0] = slot;
+		first->operands[1] = (uint32_t) amount;
+		entries[b].removed = true;
+		entries[c].removed = true;
+		entries[d].removed = true;
+		changed = true;
+	}
+	return changed;
+}
+
+// Runs of POP, typically emitted when several nested blocks end together,
+// become a single POP_N.
+static bool fuse_pops(Optimizer *optimizer) {
+	bool changed = false;
+	for (int a = next_live(optimizer, 0); a < optimizer->count;
+	     a = next_live(optimizer, a + 1)) {
+		Instruction *first = &optimizer->entries[a].instruction;
+		// b moves along the run, so long runs stay linear.
+		for (int b = next_live(optimizer, a + 1);;
+		     b = next_live(optimizer, b + 1)) {
+			if (first->op_code != OP_POP &&
+			    first->op_code != OP_POP_N) {
+				break;
+			}
+
+			if (b == optimizer->count) {
+				break;
+			}
+			Entry *next = &optimizer->entries[b];
+			OpCode op_code = next->instruction.op_code;
+			if (next->is_target ||
+			    (op_code != OP_POP && op_code != OP_POP_N)) {
+				break;
+			}
+
+			uint32_t pops = first->op_code == OP_POP
+					    ? 1
+					    : first->operands[0];
+			pops += op_code == OP_POP ? 1 : next->instruction.operands[0];
+			first->op_code = OP_POP_N;
+			first->operands[0] = pops;
+			next->removed = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Jumps whose target is an unconditional jump go straight to its final
+// destination, and unconditional jumps to the next instruction disappear.
+static bool thread_jumps(Optimizer *optimizer) {
+	bool changed = false;
+	for (int a = next_live(optimizer, 0); a < optimizer->count;
+	     a = next_live(optimizer, a + 1)) {
+		Instruction *jump = &optimizer->entries[a].instruction;
+		if (!is_jump(jump->op_code)) {
+			continue;
+		}
+
+		int target = next_live(optimizer, jump->operands[0]);
+		// The step limit guards against a loop made only of jumps.
+		for (int steps = 0; steps < optimizer->count; steps++) {
+			if (target == optimizer->count) {
+				break;
+			}
+			Instruction *next = &optimizer->entries[target].instruction;
+			if (next->op_code != OP_JUMP || target == a) {
+				break;
+			}
+			target = next_live(optimizer, next->operands[0]);
+		}
+
+		if (target != (int) jump->operands[0]) {
+			jump->operands[0] = target;
+			changed = true;
+		}
+
+		if (jump->op_code == OP_JUMP &&
+		    target == next_live(optimizer, a + 1)) {
+			optimizer->entries[a].removed = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+static bool is_jump(OpCode op_code) {
+	switch (op_code) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool has_code_target(OpCode op_code) {
+	return is_jump(op_code) || op_code == OP_CALL ||
+	       op_code == OP_TAIL_CALL;
+}
+
+static OpCode negated_jump(OpCode comparison) {
+	switch (comparison) {
+		case OP_EQUAL:
+			return OP_JUMP_IF_NOT_EQUAL;
+		case OP_NOT_EQUAL:
+			return OP_JUMP_IF_EQUAL;
+		case OP_LESS:
+			return OP_JUMP_IF_NOT_LESS;
+		case OP_LESS_EQUAL:
+			return OP_JUMP_IF_NOT_LESS_EQUAL;
+		case OP_GREATER:
+			return OP_JUMP_IF_NOT_GREATER;
+		case OP_GREATER_EQUAL:
+			return OP_JUMP_IF_NOT_GREATER_EQUAL;
+		default:
+			return OP_NOOP;
+	}
+}
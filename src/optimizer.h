@@ -0,0 +1,9 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "chunk.h"
+#include "function.h"
+
+void optimize_chunk(Chunk *chunk, FunctionList *flist);
+
+#endif
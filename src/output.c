@@ -0,0 +1,96 @@
+#include "output.h"
+#include "chunk.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void append(Output *output, const char *text, size_t length);
+static void end_line(Output *output);
+
+static Output *active_output = NULL;
+
+void init_output(Output *output) {
+	output->buffer = malloc(OUTPUT_BUFFER_SIZE);
+	output->length = 0;
+	output->flush_lines = isatty(STDOUT_FILENO);
+	// Anything already printed through stdio comes first.
+	fflush(stdout);
+	active_output = output;
+}
+
+void flush_output(Output *output) {
+	char *data = output->buffer;
+	size_t length = output->length;
+	while (length > 0) {
+		ssize_t written = write(STDOUT_FILENO, data, length);
+		if (written <= 0) {
+			break;
+		}
+		data += written;
+		length -= written;
+	}
+	output->length = 0;
+}
+
+void free_output(Output *output) {
+	flush_output(output);
+	free(output->buffer);
+	if (active_output == output) {
+		active_output = NULL;
+	}
+}
+
+void flush_active_output(void) {
+	if (active_output != NULL) {
+		flush_output(active_output);
+	}
+}
+
+void print_unit(Output *output) {
+	append(output, "unit\n", 5);
+	end_line(output);
+}
+
+void print_integer(Output *output, int value) {
+	// Digits are written backwards from the end. The magnitude is taken
+	// as unsigned so that INT_MIN needs no special case.
+	char digits[16];
+	char *start = digits + sizeof(digits);
+	*--start = '\n';
+	unsigned int magnitude =
+	    value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+	do {
+		*--start = (char) ('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0) {
+		*--start = '-';
+	}
+	append(output, start, digits + sizeof(digits) - start);
+	end_line(output);
+}
+
+void print_boolean(Output *output, int value) {
+	if (value == AQ_TRUE) {
+		append(output, "true\n", 5);
+	} else {
+		append(output, "false\n", 6);
+	}
+	end_line(output);
+}
+
+static void append(Output *output, const char *text, size_t length) {
+	if (OUTPUT_BUFFER_SIZE - output->length < length) {
+		flush_output(output);
+	}
+	memcpy(output->buffer + output->length, text, length);
+	output->length += length;
+}
+
+static void end_line(Output *output) {
+	if (output->flush_lines) {
+		flush_output(output);
+	}
+}
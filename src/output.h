@@ -0,0 +1,31 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// What a program prints. It is formatted by hand into a buffer and written
+// to standard output with write(), bypassing stdio. The buffer is flushed
+// when it fills up, when the output is freed, after every line if standard
+// output is a terminal, and by the stack overflow handler.
+typedef struct Output {
+	char *buffer;
+	size_t length;
+	bool flush_lines;
+} Output;
+
+void init_output(Output *output);
+void flush_output(Output *output);
+void free_output(Output *output);
+
+// Flushes the most recently initialized output that has not been freed.
+// Only calls write(), so it is safe in a signal handler.
+void flush_active_output(void);
+
+void print_unit(Output *output);
+void print_integer(Output *output, int value);
+void print_boolean(Output *output, int value);
+
+#endif
@@ -0,0 +1,742 @@
+#include "passes.h"
+#include "chunk.h"
+#include "ir.h"
+#include "loops.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Values are only used in the block that defines them, so copy propagation
+// and common subexpression elimination look at one block at a time. Dead
+// code elimination also removes stores to slots that are never read again,
+// which takes the whole control-flow graph.
+//
+// Every pass keeps what it knows about the slots in a table that is reset
+// per block by bumping a stamp instead of clearing it.
+
+typedef struct Passes {
+	IrFunction *function;
+
+	// Per value.
+	int *replacements;
+	int *numbers;
+	int *sizes;
+	int *homes;
+	int *home_versions;
+	int *load_versions;
+	int *uses;
+	bool *is_needed;
+
+	// Per slot.
+	int *slot_values;
+	int *slot_stamps;
+	int *versions;
+	int stamp;
+
+	// Values computed so far in the block, by hash.
+	int *table;
+	int *table_stamps;
+	int table_capacity;
+
+	// Instructions of one block, in order.
+	int *order;
+	int order_count;
+
+	// Per block.
+	bool *is_reachable;
+	int *worklist;
+	uint64_t *live;
+	// Slots a block reads before it writes them, and slots it writes.
+	uint64_t *reads;
+	uint64_t *writes;
+	int live_words;
+} Passes;
+
+static void propagate_copies(Passes *passes);
+static bool fold_instruction(IrFunction *function, IrInstruction *instruction);
+static void eliminate_common_subexpressions(Passes *passes);
+static bool is_worth_sharing(Passes *passes, int value);
+static int find_equal(Passes *passes, int value);
+static bool is_equal(Passes *passes, int a, int b);
+static int number(Passes *passes, int value);
+static uint32_t hash_value(Passes *passes, int value);
+static bool is_commutative(IrOp op);
+static void eliminate_dead_code(Passes *passes);
+static void fold_branches(Passes *passes);
+static void remove_unreachable_blocks(Passes *passes);
+static void remove_dead_stores(Passes *passes);
+static void summarize_block(Passes *passes, int block);
+static void live_at_end(Passes *passes, int block, uint64_t *live);
+static void transfer_liveness(Passes *passes, uint64_t *live);
+static bool is_removable_store(Passes *passes, IrInstruction *store);
+static void remove_unused_values(Passes *passes);
+
+static void collect_block(Passes *passes, int block);
+static void count_uses(Passes *passes);
+static void replace_operands(Passes *passes, IrInstruction *instruction);
+static int slot_value(Passes *passes, int slot);
+static void set_slot_value(Passes *passes, int slot, int value);
+static int successors(IrInstruction *terminator, int *blocks);
+
+bool parse_passes(const char *list, int *passes) {
+	*passes = 0;
+	if (strcmp(list, "none") == 0) {
+		return true;
+	}
+	while (*list != '\0') {
+		size_t length = strcspn(list, ",");
+		if (length == 3 && strncmp(list, "dce", 3) == 0) {
+			*passes |= PASS_DCE;
+		} else if (length == 3 && strncmp(list, "cse", 3) == 0) {
+			*passes |= PASS_CSE;
+		} else if (length == 4 && strncmp(list, "licm", 4) == 0) {
+			*passes |= PASS_LICM;
+		} else if (length == 16 &&
+			   strncmp(list, "copy-propagation", 16) == 0) {
+			*passes |= PASS_COPY_PROPAGATION;
+		} else if (length == 18 &&
+			   strncmp(list, "strength-reduction", 18) == 0) {
+			*passes |= PASS_STRENGTH_REDUCTION;
+		} else {
+			return false;
+		}
+		list += length;
+		if (*list == ',') {
+			list++;
+		}
+	}
+	return true;
+}
+
+void run_passes(IrProgram *program, int selected) {
+	if (selected & PASS_LICM) {
+		hoist_loop_invariants(program);
+	}
+
+	int max_instructions = 1;
+	int max_slots = 1;
+	int max_blocks = 1;
+	for (int i = 0; i < program->count; i++) {
+		IrFunction *function = &program->functions[i];
+		if (function->instruction_count > max_instructions) {
+			max_instructions = function->instruction_count;
+		}
+		if (function->slot_count + function->temp_count > max_slots) {
+			max_slots = function->slot_count + function->temp_count;
+		}
+		if (function->block_count > max_blocks) {
+			max_blocks = function->block_count;
+		}
+	}
+
+	Passes passes;
+	passes.replacements = malloc(max_instructions * sizeof(int));
+	passes.numbers = malloc(max_instructions * sizeof(int));
+	passes.sizes = malloc(max_instructions * sizeof(int));
+	passes.homes = malloc(max_instructions * sizeof(int));
+	passes.home_versions = malloc(max_instructions * sizeof(int));
+	passes.load_versions = malloc(max_instructions * sizeof(int));
+	passes.uses = malloc(max_instructions * sizeof(int));
+	passes.is_needed = malloc(max_instructions * sizeof(bool));
+	passes.slot_values = malloc(max_slots * sizeof(int));
+	passes.slot_stamps = calloc(max_slots, sizeof(int));
+	passes.versions = calloc(max_slots, sizeof(int));
+	passes.stamp = 0;
+	passes.table_capacity = 16;
+	while (passes.table_capacity < 2 * max_instructions) {
+		passes.table_capacity *= 2;
+	}
+	passes.table = malloc(passes.table_capacity * sizeof(int));
+	passes.table_stamps = calloc(passes.table_capacity, sizeof(int));
+	passes.order = malloc(max_instructions * sizeof(int));
+	passes.is_reachable = malloc(max_blocks * sizeof(bool));
+	passes.worklist = malloc(max_blocks * sizeof(int));
+	passes.live_words = (max_slots + 63) / 64;
+	passes.live = malloc((size_t) (max_blocks + 1) * passes.live_words *
+			     sizeof(uint64_t));
+	passes.reads = malloc((size_t) max_blocks * passes.live_words *
+			      sizeof(uint64_t));
+	passes.writes = malloc((size_t) max_blocks * passes.live_words *
+			       sizeof(uint64_t));
+
+	for (int i = 0; i < program->count; i++) {
+		passes.function = &program->functions[i];
+		// Every value stands for itself until a pass replaces it.
+		for (int j = 0; j < passes.function->instruction_count; j++) {
+			passes.replacements[j] = j;
+		}
+		if (selected & PASS_COPY_PROPAGATION) {
+			propagate_copies(&passes);
+		}
+		if (selected & PASS_CSE) {
+			eliminate_common_subexpressions(&passes);
+		}
+		if (selected & PASS_DCE) {
+			eliminate_dead_code(&passes);
+		}
+	}
+	if (selected & PASS_STRENGTH_REDUCTION) {
+		reduce_strength(program);
+	}
+
+	free(passes.replacements);
+	free(passes.numbers);
+	free(passes.sizes);
+	free(passes.homes);
+	free(passes.home_versions);
+	free(passes.load_versions);
+	free(passes.uses);
+	free(passes.is_needed);
+	free(passes.slot_values);
+	free(passes.slot_stamps);
+	free(passes.versions);
+	free(passes.table);
+	free(passes.table_stamps);
+	free(passes.order);
+	free(passes.is_reachable);
+	free(passes.worklist);
+	free(passes.live);
+	free(passes.reads);
+	free(passes.writes);
+}
+
+// A load of a slot that was written earlier in the block is replaced by
+// the value written, and operations whose operands become constants are
+// folded.
+static void propagate_copies(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int block = 0; block < function->block_count; block++) {
+		collect_block(passes, block);
+		passes->stamp++;
+		for (int i = 0; i < passes->order_count; i++) {
+			int index = passes->order[i];
+			IrInstruction *instruction =
+			    &function->instructions[index];
+			passes->replacements[index] = index;
+			replace_operands(passes, instruction);
+
+			int slot = instruction->immediate;
+			switch (instruction->op) {
+				case IR_LOAD: {
+					int value = slot_value(passes, slot);
+					if (value >= 0) {
+						passes->replacements[index] =
+						    value;
+						instruction->op = IR_NOP;
+					} else {
+						set_slot_value(passes, slot,
+							       index);
+					}
+					break;
+				}
+				case IR_STORE:
+				case IR_LOCAL:
+					set_slot_value(
+					    passes, slot,
+					    instruction->operands[0]);
+					break;
+				case IR_POP:
+					for (int j = 0; j < instruction->count;
+					     j++) {
+						set_slot_value(passes, slot + j,
+							       -1);
+					}
+					break;
+				default:
+					fold_instruction(function, instruction);
+					break;
+			}
+		}
+	}
+}
+
+// Turns an operation on constants into a constant.
+static bool fold_instruction(IrFunction *function, IrInstruction *instruction) {
+	if (!is_ir_pure(instruction->op) || instruction->op == IR_CONSTANT ||
+	    instruction->op == IR_LOAD) {
+		return false;
+	}
+	int count;
+	int *operands = ir_operands(function, instruction, &count);
+	int values[2];
+	for (int i = 0; i < count; i++) {
+		IrInstruction *operand = &function->instructions[operands[i]];
+		if (operand->op != IR_CONSTANT) {
+			return false;
+		}
+		values[i] = operand->immediate;
+	}
+
+	int result;
+	if (instruction->op == IR_NEGATE) {
+		result = (int) (0u - (unsigned int) values[0]);
+	} else if (!fold_ir_binary(instruction->op, values[0], values[1],
+				   &result)) {
+		return false;
+	}
+	instruction->op = IR_CONSTANT;
+	instruction->operands[0] = -1;
+	instruction->operands[1] = -1;
+	instruction->immediate = result;
+	return true;
+}
+
+// A value that was already computed in the block replaces a later copy of
+// it. Loads and constants cost nothing to push again, and neither does a
+// value still held in a variable, but anything else has to be worth a
+// temporary. Values are compared by number, the first value equal to them,
+// so that larger values match even where their parts are not replaced.
+static void eliminate_common_subexpressions(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int block = 0; block < function->block_count; block++) {
+		collect_block(passes, block);
+		passes->stamp++;
+		for (int i = 0; i < passes->order_count; i++) {
+			int index = passes->order[i];
+			IrInstruction *instruction =
+			    &function->instructions[index];
+			passes->replacements[index] = index;
+			passes->numbers[index] = index;
+			passes->homes[index] = -1;
+			replace_operands(passes, instruction);
+
+			int slot = instruction->immediate;
+			switch (instruction->op) {
+				case IR_STORE:
+				case IR_LOCAL: {
+					int value = instruction->operands[0];
+					passes->versions[slot]++;
+					passes->homes[value] = slot;
+					passes->home_versions[value] =
+					    passes->versions[slot];
+					continue;
+				}
+				case IR_POP:
+					for (int j = 0; j < instruction->count;
+					     j++) {
+						passes->versions[slot + j]++;
+					}
+					continue;
+				default:
+					break;
+			}
+			passes->sizes[index] = 1;
+			if (!is_ir_pure(instruction->op)) {
+				continue;
+			}
+
+			int size = 1;
+			int count;
+			int *operands =
+			    ir_operands(function, instruction, &count);
+			for (int j = 0; j < count; j++) {
+				size += passes->sizes[operands[j]];
+			}
+			if (size > CSE_MIN_SIZE) {
+				size = CSE_MIN_SIZE;
+			}
+			passes->sizes[index] = size;
+			if (instruction->op == IR_LOAD) {
+				passes->load_versions[index] =
+				    passes->versions[slot];
+			}
+
+			int equal = find_equal(passes, index);
+			passes->numbers[index] = equal;
+			if (equal != index && is_worth_sharing(passes, equal)) {
+				passes->replacements[index] = equal;
+				instruction->op = IR_NOP;
+			}
+		}
+	}
+}
+
+static bool is_worth_sharing(Passes *passes, int value) {
+	IrInstruction *instruction = &passes->function->instructions[value];
+	if (instruction->op == IR_CONSTANT || instruction->op == IR_LOAD ||
+	    passes->sizes[value] >= CSE_MIN_SIZE) {
+		return true;
+	}
+	int home = passes->homes[value];
+	return home >= 0 &&
+	       passes->versions[home] == passes->home_versions[value];
+}
+
+// Returns an equal value already in the table, or adds the value and
+// returns it.
+static int find_equal(Passes *passes, int value) {
+	int mask = passes->table_capacity - 1;
+	int i = (int) (hash_value(passes, value) & (uint32_t) mask);
+	for (;;) {
+		if (passes->table_stamps[i] != passes->stamp) {
+			passes->table_stamps[i] = passes->stamp;
+			passes->table[i] = value;
+			return value;
+		}
+		if (is_equal(passes, passes->table[i], value)) {
+			return passes->table[i];
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static bool is_equal(Passes *passes, int a, int b) {
+	IrInstruction *x = &passes->function->instructions[a];
+	IrInstruction *y = &passes->function->instructions[b];
+	if (x->op != y->op || x->type != y->type) {
+		return false;
+	}
+	switch (x->op) {
+		case IR_CONSTANT:
+			return x->immediate == y->immediate;
+		case IR_LOAD:
+			return x->immediate == y->immediate &&
+			       passes->load_versions[a] ==
+				   passes->load_versions[b];
+		default:
+			break;
+	}
+	int x0 = number(passes, x->operands[0]);
+	int x1 = number(passes, x->operands[1]);
+	int y0 = number(passes, y->operands[0]);
+	int y1 = number(passes, y->operands[1]);
+	if (x0 == y0 && x1 == y1) {
+		return true;
+	}
+	return is_commutative(x->op) && x0 == y1 && x1 == y0;
+}
+
+static int number(Passes *passes, int value) {
+	return value >= 0 ? passes->numbers[value] : -1;
+}
+
+// Commutative operations hash the same either way round.
+static uint32_t hash_value(Passes *passes, int value) {
+	IrInstruction *instruction = &passes->function->instructions[value];
+	uint32_t hash = (uint32_t) instruction->op * 0x9e3779b1u;
+	switch (instruction->op) {
+		case IR_CONSTANT:
+			hash ^= (uint32_t) instruction->immediate;
+			break;
+		case IR_LOAD:
+			hash ^= (uint32_t) instruction->immediate * 31u +
+				(uint32_t) passes->load_versions[value];
+			break;
+		default:
+			hash ^= (uint32_t) number(passes,
+						  instruction->operands[0]) +
+				(uint32_t) number(passes,
+						  instruction->operands[1]);
+			break;
+	}
+	hash *= 0x85ebca6bu;
+	return hash ^ hash >> 16;
+}
+
+static bool is_commutative(IrOp op) {
+	return op == IR_ADD || op == IR_MUL || op == IR_EQUAL ||
+	       op == IR_NOT_EQUAL;
+}
+
+static void eliminate_dead_code(Passes *passes) {
+	fold_branches(passes);
+	remove_unreachable_blocks(passes);
+	remove_dead_stores(passes);
+	remove_unused_values(passes);
+}
+
+// A branch on a constant always goes the same way.
+static void fold_branches(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int i = 0; i < function->block_count; i++) {
+		IrBlock *block = &function->blocks[i];
+		IrInstruction *terminator =
+		    &function->instructions[block->last];
+		if (terminator->op != IR_BRANCH) {
+			continue;
+		}
+		IrInstruction *condition =
+		    &function->instructions[terminator->operands[0]];
+		if (condition->op != IR_CONSTANT) {
+			continue;
+		}
+		terminator->op = IR_JUMP;
+		terminator->operands[0] = -1;
+		if (condition->immediate == AQ_FALSE) {
+			terminator->targets[0] = terminator->targets[1];
+		}
+		terminator->targets[1] = -1;
+	}
+}
+
+static void remove_unreachable_blocks(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int i = 0; i < function->block_count; i++) {
+		passes->is_reachable[i] = false;
+	}
+	int count = 0;
+	passes->is_reachable[0] = true;
+	passes->worklist[count++] = 0;
+	while (count > 0) {
+		IrBlock *block = &function->blocks[passes->worklist[--count]];
+		int blocks[2];
+		int successor_count = successors(
+		    &function->instructions[block->last], blocks);
+		for (int i = 0; i < successor_count; i++) {
+			if (!passes->is_reachable[blocks[i]]) {
+				passes->is_reachable[blocks[i]] = true;
+				passes->worklist[count++] = blocks[i];
+			}
+		}
+	}
+	for (int i = 0; i < function->block_count; i++) {
+		if (!passes->is_reachable[i]) {
+			function->blocks[i].is_removed = true;
+		}
+	}
+}
+
+// Finds the slots that may still be read at the start of every block,
+// going backwards until nothing changes, and then drops the stores to
+// slots that are not read before they are written again or go away. Every
+// block is summed up once by the slots it reads and writes, so going round
+// again only takes a few words per block.
+static void remove_dead_stores(Passes *passes) {
+	IrFunction *function = passes->function;
+	int words = passes->live_words;
+	size_t size = words * sizeof(uint64_t);
+	// One set per block plus a scratch set at the end.
+	uint64_t *scratch = &passes->live[function->block_count * words];
+	memset(passes->live, 0, function->block_count * size);
+	for (int i = 0; i < function->block_count; i++) {
+		if (!function->blocks[i].is_removed) {
+			collect_block(passes, i);
+			summarize_block(passes, i);
+		}
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = function->block_count - 1; i >= 0; i--) {
+			if (function->blocks[i].is_removed) {
+				continue;
+			}
+			uint64_t *live = &passes->live[i * words];
+			uint64_t *reads = &passes->reads[i * words];
+			uint64_t *writes = &passes->writes[i * words];
+			live_at_end(passes, i, scratch);
+			for (int j = 0; j < words; j++) {
+				uint64_t word =
+				    reads[j] | (scratch[j] & ~writes[j]);
+				if (word != live[j]) {
+					live[j] = word;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < function->block_count; i++) {
+		if (function->blocks[i].is_removed) {
+			continue;
+		}
+		collect_block(passes, i);
+		live_at_end(passes, i, scratch);
+		count_uses(passes);
+		transfer_liveness(passes, scratch);
+	}
+}
+
+// Finds the slots the collected block reads before writing them, going
+// backwards, and the slots it writes.
+static void summarize_block(Passes *passes, int block) {
+	IrFunction *function = passes->function;
+	int words = passes->live_words;
+	uint64_t *reads = &passes->reads[block * words];
+	uint64_t *writes = &passes->writes[block * words];
+	memset(reads, 0, words * sizeof(uint64_t));
+	memset(writes, 0, words * sizeof(uint64_t));
+	for (int i = passes->order_count - 1; i >= 0; i--) {
+		IrInstruction *instruction =
+		    &function->instructions[passes->order[i]];
+		int slot = instruction->immediate;
+		int count = 1;
+		switch (instruction->op) {
+			case IR_LOAD:
+				reads[slot / 64] |= (uint64_t) 1 << (slot % 64);
+				continue;
+			case IR_STORE:
+			case IR_LOCAL:
+				break;
+			case IR_POP:
+				count = instruction->count;
+				break;
+			default:
+				continue;
+		}
+		for (int j = slot; j < slot + count; j++) {
+			uint64_t bit = (uint64_t) 1 << (j % 64);
+			writes[j / 64] |= bit;
+			reads[j / 64] &= ~bit;
+		}
+	}
+}
+
+// The slots live at the end of a block are those live at the start of any
+// of its successors.
+static void live_at_end(Passes *passes, int block, uint64_t *live) {
+	IrFunction *function = passes->function;
+	int words = passes->live_words;
+	int blocks[2];
+	int count = successors(
+	    &function->instructions[function->blocks[block].last], blocks);
+	memset(live, 0, words * sizeof(uint64_t));
+	for (int i = 0; i < count; i++) {
+		uint64_t *next = &passes->live[blocks[i] * words];
+		for (int j = 0; j < words; j++) {
+			live[j] |= next[j];
+		}
+	}
+}
+
+// Takes the slots live at the end of the collected block to those live at
+// its start, and removes the stores on the way that nothing reads. A store
+// is only removed if nothing else uses its value: otherwise the slot is
+// the cheapest place to keep the value until then.
+static void transfer_liveness(Passes *passes, uint64_t *live) {
+	IrFunction *function = passes->function;
+	for (int i = passes->order_count - 1; i >= 0; i--) {
+		IrInstruction *instruction =
+		    &function->instructions[passes->order[i]];
+		int slot = instruction->immediate;
+		uint64_t bit = (uint64_t) 1 << (slot % 64);
+		switch (instruction->op) {
+			case IR_LOAD:
+				live[slot / 64] |= bit;
+				break;
+			case IR_STORE: {
+				int value = instruction->operands[0];
+				if (!(live[slot / 64] & bit) &&
+				    is_removable_store(passes, instruction)) {
+					passes->uses[value]--;
+					instruction->op = IR_NOP;
+				}
+				live[slot / 64] &= ~bit;
+				break;
+			}
+			case IR_LOCAL:
+				live[slot / 64] &= ~bit;
+				break;
+			case IR_POP:
+				for (int j = 0; j < instruction->count; j++) {
+					int dropped = slot + j;
+					live[dropped / 64] &=
+					    ~((uint64_t) 1 << (dropped % 64));
+				}
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static bool is_removable_store(Passes *passes, IrInstruction *store) {
+	int value = store->operands[0];
+	return passes->uses[value] == 1 ||
+	       passes->function->instructions[value].op == IR_CONSTANT;
+}
+
+// Removes values that nothing uses, which takes one backward sweep per
+// block since values are used after they are defined.
+static void remove_unused_values(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int block = 0; block < function->block_count; block++) {
+		if (function->blocks[block].is_removed) {
+			continue;
+		}
+		collect_block(passes, block);
+		for (int i = 0; i < passes->order_count; i++) {
+			passes->is_needed[passes->order[i]] = false;
+		}
+		for (int i = passes->order_count - 1; i >= 0; i--) {
+			int index = passes->order[i];
+			IrInstruction *instruction =
+			    &function->instructions[index];
+			if (is_ir_pure(instruction->op) &&
+			    !passes->is_needed[index]) {
+				instruction->op = IR_NOP;
+				continue;
+			}
+			int count;
+			int *operands =
+			    ir_operands(function, instruction, &count);
+			for (int j = 0; j < count; j++) {
+				passes->is_needed[operands[j]] = true;
+			}
+		}
+	}
+}
+
+static void collect_block(Passes *passes, int block) {
+	IrFunction *function = passes->function;
+	passes->order_count = 0;
+	for (int i = function->blocks[block].first; i >= 0;
+	     i = function->instructions[i].next) {
+		if (function->instructions[i].op != IR_NOP) {
+			passes->order[passes->order_count++] = i;
+		}
+	}
+}
+
+// Counts the uses of every value of the collected block.
+static void count_uses(Passes *passes) {
+	IrFunction *function = passes->function;
+	for (int i = 0; i < passes->order_count; i++) {
+		passes->uses[passes->order[i]] = 0;
+	}
+	for (int i = 0; i < passes->order_count; i++) {
+		IrInstruction *instruction =
+		    &function->instructions[passes->order[i]];
+		int count;
+		int *operands = ir_operands(function, instruction, &count);
+		for (int j = 0; j < count; j++) {
+			passes->uses[operands[j]]++;
+		}
+	}
+}
+
+static void replace_operands(Passes *passes, IrInstruction *instruction) {
+	int count;
+	int *operands = ir_operands(passes->function, instruction, &count);
+	for (int i = 0; i < count; i++) {
+		operands[i] = passes->replacements[operands[i]];
+	}
+}
+
+static int slot_value(Passes *passes, int slot) {
+	if (passes->slot_stamps[slot] != passes->stamp) {
+		return -1;
+	}
+	return passes->slot_values[slot];
+}
+
+static void set_slot_value(Passes *passes, int slot, int value) {
+	passes->slot_stamps[slot] = passes->stamp;
+	passes->slot_values[slot] = value;
+}
+
+static int successors(IrInstruction *terminator, int *blocks) {
+	switch (terminator->op) {
+		case IR_JUMP:
+			blocks[0] = terminator->targets[0];
+			return 1;
+		case IR_BRANCH:
+			blocks[0] = terminator->targets[0];
+			blocks[1] = terminator->targets[1];
+			return 2;
+		default:
+			return 0;
+	}
+}
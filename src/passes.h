@@ -0,0 +1,26 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "ir.h"
+#include <stdbool.h>
+
+// Passes over the IR, as bits of a set. They run in this order.
+#define PASS_LICM 1
+#define PASS_COPY_PROPAGATION 2
+#define PASS_CSE 4
+#define PASS_DCE 8
+#define PASS_STRENGTH_REDUCTION 16
+#define ALL_PASSES                                                             \
+	(PASS_LICM | PASS_COPY_PROPAGATION | PASS_CSE | PASS_DCE |             \
+	 PASS_STRENGTH_REDUCTION)
+
+// A value must take at least this many instructions to compute before it
+// is worth keeping in a temporary slot to share it.
+#define CSE_MIN_SIZE 5
+
+// Parses a comma-separated list of pass names, or "none". Returns false if
+// a name is unknown.
+bool parse_passes(const char *list, int *passes);
+void run_passes(IrProgram *program, int passes);
+
+#endif
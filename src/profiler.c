@@ -0,0 +1,240 @@
+#include "profiler.h"
+#include "chunk.h"
+#include "function.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct Sequence {
+	uint64_t count;
+	int length;
+	OpCode op_codes[3];
+} Sequence;
+
+static uint64_t now_ns(void);
+static int compare_op_counts(const void *a, const void *b);
+static int compare_functions(const void *a, const void *b);
+static int compare_sequences(const void *a, const void *b);
+
+// qsort has no context argument, so the comparators read the profiler
+// being printed from here.
+static Profiler *sorting;
+
+void init_profiler(Profiler *profiler, Chunk *chunk, FunctionList *flist) {
+	profiler->flist = flist;
+	for (int i = 0; i < 256; i++) {
+		profiler->op_counts[i] = 0;
+	}
+	profiler->functions = calloc(flist->count, sizeof(FunctionProfile));
+	profiler->function_at = malloc((chunk->length + 1) * sizeof(int));
+	for (int i = 0; i <= chunk->length; i++) {
+		profiler->function_at[i] = -1;
+	}
+	for (int i = 0; i < flist->count; i++) {
+		profiler->function_at[flist->functions[i].index] = i;
+	}
+	profiler->calls = malloc(16 * sizeof(ActiveCall));
+	profiler->call_count = 0;
+	profiler->call_capacity = 16;
+	profiler->start_ns = now_ns();
+	profiler->sequences = NULL;
+}
+
+void free_profiler(Profiler *profiler) {
+	if (profiler->sequences != NULL) {
+		free(profiler->sequences->pair_counts);
+		free(profiler->sequences->triple_counts);
+		free(profiler->sequences);
+	}
+	free(profiler->functions);
+	free(profiler->function_at);
+	free(profiler->calls);
+}
+
+void profile_call(Profiler *profiler, uint32_t dest) {
+	int function = profiler->function_at[dest];
+	if (function >= 0) {
+		profiler->functions[function].calls++;
+		profiler->functions[function].active++;
+	}
+
+	if (profiler->call_count == profiler->call_capacity) {
+		profiler->call_capacity *= 2;
+		profiler->calls = realloc(
+		    profiler->calls, profiler->call_capacity * sizeof(ActiveCall));
+	}
+	ActiveCall *call = &profiler->calls[profiler->call_count++];
+	call->function = function;
+	call->child_ns = 0;
+	call->start_ns = now_ns();
+}
+
+void profile_return(Profiler *profiler) {
+	uint64_t end_ns = now_ns();
+	ActiveCall *call = &profiler->calls[--profiler->call_count];
+	uint64_t elapsed = end_ns - call->start_ns;
+
+	if (call->function >= 0) {
+		FunctionProfile *f = &profiler->functions[call->function];
+		f->exclusive_ns += elapsed - call->child_ns;
+		// Recursive calls are already inside the outermost one.
+		if (--f->active == 0) {
+			f->inclusive_ns += elapsed;
+		}
+	}
+	if (profiler->call_count > 0) {
+		profiler->calls[profiler->call_count - 1].child_ns += elapsed;
+	}
+}
+
+void print_profile(FILE *file, Profiler *profiler) {
+	uint64_t total_ns = now_ns() - profiler->start_ns;
+	sorting = profiler;
+
+	uint64_t total = 0;
+	int used = 0;
+	int op_codes[256];
+	for (int i = 0; i < 256; i++) {
+		total += profiler->op_counts[i];
+		if (profiler->op_counts[i] > 0) {
+			op_codes[used++] = i;
+		}
+	}
+	qsort(op_codes, used, sizeof(int), compare_op_counts);
+
+	fprintf(file, "== Profile ==\n");
+	fprintf(file, "%" PRIu64 " instructions in %.3f ms\n\n", total,
+		total_ns / 1e6);
+	fprintf(file, "%-28s %14s %8s\n", "opcode", "count", "share");
+	for (int i = 0; i < used; i++) {
+		uint64_t count = profiler->op_counts[op_codes[i]];
+		const char *name = op_code_name(op_codes[i]);
+		fprintf(file, "%-28s %14" PRIu64 " %7.2f%%\n",
+			name != NULL ? name : "UNKNOWN", count,
+			100.0 * count / total);
+	}
+
+	FunctionList *flist = profiler->flist;
+	int *functions = malloc(flist->count * sizeof(int));
+	for (int i = 0; i < flist->count; i++) {
+		functions[i] = i;
+	}
+	qsort(functions, flist->count, sizeof(int), compare_functions);
+
+	fprintf(file, "\n%-20s %12s %14s %14s\n", "function", "calls",
+		"inclusive ms", "exclusive ms");
+	for (int i = 0; i < flist->count; i++) {
+		Function *f = &flist->functions[functions[i]];
+		FunctionProfile *p = &profiler->functions[functions[i]];
+		fprintf(file, "%-20.*s %12" PRIu64 " %14.3f %14.3f\n",
+			f->name.length, f->name.start, p->calls,
+			p->inclusive_ns / 1e6, p->exclusive_ns / 1e6);
+	}
+	free(functions);
+}
+
+void trace_sequences(Profiler *profiler) {
+	SequenceTrace *trace = malloc(sizeof(SequenceTrace));
+	int n = SEQUENCE_OP_CODES;
+	trace->pair_counts = calloc(n * n, sizeof(uint64_t));
+	trace->triple_counts = calloc(n * n * n, sizeof(uint64_t));
+	trace->run = 0;
+	trace->previous_index = -1;
+	profiler->sequences = trace;
+}
+
+// Records that op_code, at index in the code, is about to run.
+void profile_sequence(Profiler *profiler, OpCode op_code, int index) {
+	SequenceTrace *trace = profiler->sequences;
+	int n = SEQUENCE_OP_CODES;
+	if (index != trace->previous_index + 1) {
+		trace->run = 0;
+	}
+	if (trace->run >= 1) {
+		trace->pair_counts[trace->previous[1] * n + op_code]++;
+	}
+	if (trace->run >= 2) {
+		trace->triple_counts[(trace->previous[0] * n +
+				      trace->previous[1]) * n + op_code]++;
+	}
+	trace->previous[0] = trace->previous[1];
+	trace->previous[1] = op_code;
+	trace->run = trace->run < 2 ? trace->run + 1 : 2;
+	trace->previous_index = index;
+}
+
+// Prints every pair and triple that ran, most frequent first, in the
+// format gen_superinstructions.sh reads.
+void print_sequences(FILE *file, Profiler *profiler) {
+	SequenceTrace *trace = profiler->sequences;
+	int n = SEQUENCE_OP_CODES;
+	uint64_t total = 0;
+	for (int i = 0; i < n; i++) {
+		total += profiler->op_counts[i];
+	}
+
+	int count = 0;
+	int capacity = 64;
+	Sequence *sequences = malloc(capacity * sizeof(Sequence));
+	for (int i = 0; i < n * n + n * n * n; i++) {
+		bool is_pair = i < n * n;
+		int code = is_pair ? i : i - n * n;
+		uint64_t executed = is_pair ? trace->pair_counts[code]
+					    : trace->triple_counts[code];
+		if (executed == 0) {
+			continue;
+		}
+		if (count == capacity) {
+			capacity *= 2;
+			sequences =
+			    realloc(sequences, capacity * sizeof(Sequence));
+		}
+		Sequence *sequence = &sequences[count++];
+		sequence->count = executed;
+		sequence->length = is_pair ? 2 : 3;
+		for (int j = sequence->length - 1; j >= 0; j--) {
+			sequence->op_codes[j] = code % n;
+			code /= n;
+		}
+	}
+	qsort(sequences, count, sizeof(Sequence), compare_sequences);
+
+	fprintf(file, "== Opcode sequences ==\n");
+	fprintf(file, "%" PRIu64 " instructions\n\n", total);
+	fprintf(file, "%14s  %s\n", "count", "sequence");
+	for (int i = 0; i < count; i++) {
+		fprintf(file, "%14" PRIu64 " ", sequences[i].count);
+		for (int j = 0; j < sequences[i].length; j++) {
+			fprintf(file, " %s",
+				op_code_name(sequences[i].op_codes[j]));
+		}
+		fprintf(file, "\n");
+	}
+	free(sequences);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000u + time.tv_nsec;
+}
+
+static int compare_op_counts(const void *a, const void *b) {
+	uint64_t x = sorting->op_counts[*(int *) a];
+	uint64_t y = sorting->op_counts[*(int *) b];
+	return (x < y) - (x > y);
+}
+
+static int compare_functions(const void *a, const void *b) {
+	uint64_t x = sorting->functions[*(int *) a].exclusive_ns;
+	uint64_t y = sorting->functions[*(int *) b].exclusive_ns;
+	return (x < y) - (x > y);
+}
+
+static int compare_sequences(const void *a, const void *b) {
+	uint64_t x = ((const Sequence *) a)->count;
+	uint64_t y = ((const Sequence *) b)->count;
+	return (x < y) - (x > y);
+}
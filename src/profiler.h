@@ -0,0 +1,61 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "chunk.h"
+#include "function.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+typedef struct FunctionProfile {
+	uint64_t calls;
+	uint64_t inclusive_ns;
+	uint64_t exclusive_ns;
+	int active;
+} FunctionProfile;
+
+typedef struct ActiveCall {
+	int function;
+	uint64_t start_ns;
+	uint64_t child_ns;
+} ActiveCall;
+
+// Opcodes that can appear in a traced sequence: the ones that survive
+// decoding.
+#define SEQUENCE_OP_CODES OP_PUSH_WIDE
+
+// Counts how often each pair and triple of opcodes ran back to back, that
+// is, each one directly after the instruction before it in the code.
+typedef struct SequenceTrace {
+	uint64_t *pair_counts;
+	uint64_t *triple_counts;
+	OpCode previous[2];
+	// How many of the previous opcodes lead up to the next one.
+	int run;
+	int previous_index;
+} SequenceTrace;
+
+typedef struct Profiler {
+	FunctionList *flist;
+	uint64_t op_counts[256];
+	// NULL unless opcode sequences are traced.
+	SequenceTrace *sequences;
+	FunctionProfile *functions;
+	// Index into flist of the function starting at each chunk index.
+	int *function_at;
+	ActiveCall *calls;
+	int call_count;
+	int call_capacity;
+	uint64_t start_ns;
+} Profiler;
+
+void init_profiler(Profiler *profiler, Chunk *chunk, FunctionList *flist);
+void free_profiler(Profiler *profiler);
+void profile_call(Profiler *profiler, uint32_t dest);
+void profile_return(Profiler *profiler);
+void print_profile(FILE *file, Profiler *profiler);
+
+void trace_sequences(Profiler *profiler);
+void profile_sequence(Profiler *profiler, OpCode op_code, int index);
+void print_sequences(FILE *file, Profiler *profiler);
+
+#endif
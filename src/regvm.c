@@ -0,0 +1,1107 @@
+#include "regvm.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include "guard.h"
+#include "interpreter.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The register VM runs a translation of the finished chunk into
+// three-address code. Stack slot n of a frame becomes register rn, so the
+// parameters and locals keep the slots the compiler gave them, the
+// temporaries sit above them, and every instruction names the registers it
+// reads and writes: i = i + 1 becomes ADD r1, r1, #1.
+//
+// The translation walks the stack heights from compute_depths and keeps a
+// symbolic view of the stack. Loads and literals are only remembered, so
+// the instruction that consumes them reads the local or takes the constant
+// directly. A remembered value is written to its own slot once something
+// relies on the slot: a jump target, a jump, a call, or a store to the
+// local it copies.
+
+// See interpreter.c.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(AQ_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef THREADED_DISPATCH
+#define TARGET(op) label_##op:
+#define DISPATCH() __extension__({ goto *dispatch_table[ip->op_code]; })
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+#endif
+
+// The form of an instruction that takes a constant as its last source
+// directly follows the form that reads a register. Everything before
+// REG_JUMP only computes register a.
+typedef enum RegisterOpCode {
+	REG_MOVE,
+	REG_LOAD_CONSTANT,
+
+	REG_ADD,
+	REG_ADD_CONSTANT,
+	REG_SUB,
+	REG_SUB_CONSTANT,
+	REG_MUL,
+	REG_MUL_CONSTANT,
+	REG_DIV,
+	REG_DIV_CONSTANT,
+	REG_NEGATE,
+	REG_SHIFT_LEFT,
+	REG_DIV_SHIFT,
+	REG_DIV_MULTIPLY,
+
+	REG_EQUAL,
+	REG_EQUAL_CONSTANT,
+	REG_NOT_EQUAL,
+	REG_NOT_EQUAL_CONSTANT,
+	REG_LESS,
+	REG_LESS_CONSTANT,
+	REG_LESS_EQUAL,
+	REG_LESS_EQUAL_CONSTANT,
+	REG_GREATER,
+	REG_GREATER_CONSTANT,
+	REG_GREATER_EQUAL,
+	REG_GREATER_EQUAL_CONSTANT,
+
+	REG_JUMP,
+	REG_JUMP_IF_FALSE,
+	REG_JUMP_IF_NOT_EQUAL,
+	REG_JUMP_IF_NOT_EQUAL_CONSTANT,
+	REG_JUMP_IF_EQUAL,
+	REG_JUMP_IF_EQUAL_CONSTANT,
+	REG_JUMP_IF_NOT_LESS,
+	REG_JUMP_IF_NOT_LESS_CONSTANT,
+	REG_JUMP_IF_NOT_LESS_EQUAL,
+	REG_JUMP_IF_NOT_LESS_EQUAL_CONSTANT,
+	REG_JUMP_IF_NOT_GREATER,
+	REG_JUMP_IF_NOT_GREATER_CONSTANT,
+	REG_JUMP_IF_NOT_GREATER_EQUAL,
+	REG_JUMP_IF_NOT_GREATER_EQUAL_CONSTANT,
+
+	REG_CALL,
+	REG_RETURN,
+	REG_TAIL_CALL,
+
+	REG_PRINT_UNIT,
+	REG_PRINT_INTEGER,
+	REG_PRINT_BOOLEAN,
+	REG_EXIT,
+} RegisterOpCode;
+
+// Most instructions compute register a from b and c. Conditional jumps test
+// a, or compare it with b, and jumps and calls keep their target, an index
+// into the code, in c. Calls pass b arguments starting at register a.
+// Division by multiplication takes the magic number in c and also has a
+// shift.
+typedef struct RegisterInstruction {
+	uint16_t op_code;
+	uint16_t shift;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+} RegisterInstruction;
+
+typedef struct RegisterFrame {
+	RegisterInstruction *return_address;
+	Object *base;
+} RegisterFrame;
+
+// What the translation knows about the value in a stack slot: it is in the
+// slot's own register, it is a copy of register value or it is the
+// constant value.
+typedef enum SlotKind {
+	SLOT_REGISTER,
+	SLOT_COPY,
+	SLOT_CONSTANT,
+} SlotKind;
+
+typedef struct Slot {
+	SlotKind kind;
+	int value;
+} Slot;
+
+typedef struct RegisterVm {
+	Interpreter *interpreter;
+	Chunk *chunk;
+	FunctionList *flist;
+	RegisterInstruction *code;
+	int count;
+	int capacity;
+	// Index into code of the translation of each chunk index.
+	int *positions;
+	RegisterFrame *frames;
+
+	// Only used during the translation.
+	int *depths;
+	bool *is_target;
+	// Index into code of the first instruction after the last jump
+	// target.
+	int block_start;
+	Slot *slots;
+	int slot_capacity;
+} RegisterVm;
+
+// The name and the operands an instruction prints: r for a register, k for
+// a constant, n for a count and t for a target, with - skipping one.
+typedef struct RegisterOpInfo {
+	const char *name;
+	const char *operands;
+} RegisterOpInfo;
+
+static const RegisterOpInfo op_info[] = {
+	[REG_MOVE] = {"MOVE", "rr"},
+	[REG_LOAD_CONSTANT] = {"LOAD", "rk"},
+	[REG_ADD] = {"ADD", "rrr"},
+	[REG_ADD_CONSTANT] = {"ADD", "rrk"},
+	[REG_SUB] = {"SUB", "rrr"},
+	[REG_SUB_CONSTANT] = {"SUB", "rrk"},
+	[REG_MUL] = {"MUL", "rrr"},
+	[REG_MUL_CONSTANT] = {"MUL", "rrk"},
+	[REG_DIV] = {"DIV", "rrr"},
+	[REG_DIV_CONSTANT] = {"DIV", "rrk"},
+	[REG_NEGATE] = {"NEGATE", "rr"},
+	[REG_SHIFT_LEFT] = {"SHIFT_LEFT", "rrk"},
+	[REG_DIV_SHIFT] = {"DIV_SHIFT", "rrk"},
+	[REG_DIV_MULTIPLY] = {"DIV_MULTIPLY", "rrkn"},
+	[REG_EQUAL] = {"EQUAL", "rrr"},
+	[REG_EQUAL_CONSTANT] = {"EQUAL", "rrk"},
+	[REG_NOT_EQUAL] = {"NOT_EQUAL", "rrr"},
+	[REG_NOT_EQUAL_CONSTANT] = {"NOT_EQUAL", "rrk"},
+	[REG_LESS] = {"LESS", "rrr"},
+	[REG_LESS_CONSTANT] = {"LESS", "rrk"},
+	[REG_LESS_EQUAL] = {"LESS_EQUAL", "rrr"},
+	[REG_LESS_EQUAL_CONSTANT] = {"LESS_EQUAL", "rrk"},
+	[REG_GREATER] = {"GREATER", "rrr"},
+	[REG_GREATER_CONSTANT] = {"GREATER", "rrk"},
+	[REG_GREATER_EQUAL] = {"GREATER_EQUAL", "rrr"},
+	[REG_GREATER_EQUAL_CONSTANT] = {"GREATER_EQUAL", "rrk"},
+	[REG_JUMP] = {"JUMP", "--t"},
+	[REG_JUMP_IF_FALSE] = {"JUMP_IF_FALSE", "r-t"},
+	[REG_JUMP_IF_NOT_EQUAL] = {"JUMP_IF_NOT_EQUAL", "rrt"},
+	[REG_JUMP_IF_NOT_EQUAL_CONSTANT] = {"JUMP_IF_NOT_EQUAL", "rkt"},
+	[REG_JUMP_IF_EQUAL] = {"JUMP_IF_EQUAL", "rrt"},
+	[REG_JUMP_IF_EQUAL_CONSTANT] = {"JUMP_IF_EQUAL", "rkt"},
+	[REG_JUMP_IF_NOT_LESS] = {"JUMP_IF_NOT_LESS", "rrt"},
+	[REG_JUMP_IF_NOT_LESS_CONSTANT] = {"JUMP_IF_NOT_LESS", "rkt"},
+	[REG_JUMP_IF_NOT_LESS_EQUAL] = {"JUMP_IF_NOT_LESS_EQUAL", "rrt"},
+	[REG_JUMP_IF_NOT_LESS_EQUAL_CONSTANT] = {"JUMP_IF_NOT_LESS_EQUAL",
+						 "rkt"},
+	[REG_JUMP_IF_NOT_GREATER] = {"JUMP_IF_NOT_GREATER", "rrt"},
+	[REG_JUMP_IF_NOT_GREATER_CONSTANT] = {"JUMP_IF_NOT_GREATER", "rkt"},
+	[REG_JUMP_IF_NOT_GREATER_EQUAL] = {"JUMP_IF_NOT_GREATER_EQUAL", "rrt"},
+	[REG_JUMP_IF_NOT_GREATER_EQUAL_CONSTANT] = {"JUMP_IF_NOT_GREATER_EQUAL",
+						    "rkt"},
+	[REG_CALL] = {"CALL", "rnt"},
+	[REG_RETURN] = {"RETURN", "r"},
+	[REG_TAIL_CALL] = {"TAIL_CALL", "rnt"},
+	[REG_PRINT_UNIT] = {"PRINT_UNIT", ""},
+	[REG_PRINT_INTEGER] = {"PRINT_INTEGER", "r"},
+	[REG_PRINT_BOOLEAN] = {"PRINT_BOOLEAN", "r"},
+	[REG_EXIT] = {"EXIT", ""},
+};
+
+static void translate_chunk(RegisterVm *vm, Chunk *chunk, FunctionList *flist);
+static void free_translation(RegisterVm *vm);
+static void translate_function(RegisterVm *vm, Function *f, int start,
+			       int end);
+static void translate_instruction(RegisterVm *vm, int depth,
+				  Instruction *instruction);
+static void translate_store(RegisterVm *vm, int depth, int local);
+static void translate_increment(RegisterVm *vm, int depth, int local,
+				int amount);
+static void translate_by_constant(RegisterVm *vm, int depth,
+				  Instruction *instruction);
+static void translate_binary(RegisterVm *vm, int depth,
+			     RegisterOpCode op_code, bool commutative);
+static void translate_compare_jump(RegisterVm *vm, int depth,
+				   RegisterOpCode op_code, bool commutative,
+				   uint32_t target);
+static void resolve_operands(RegisterVm *vm, int depth,
+			     RegisterOpCode *op_code, bool commutative,
+			     uint32_t *left, uint32_t *right);
+static uint32_t source_register(RegisterVm *vm, int slot);
+static bool computed_last(RegisterVm *vm, int slot);
+static void materialize(RegisterVm *vm, int slot);
+static void materialize_slots(RegisterVm *vm, int from, int to);
+static void materialize_copies(RegisterVm *vm, int local, int from, int to);
+static void emit(RegisterVm *vm, RegisterOpCode op_code, uint32_t a,
+		 uint32_t b, uint32_t c);
+static bool has_target(RegisterOpCode op_code);
+static int run(RegisterVm *vm);
+static Function *locate_frame_overflow(void *context);
+
+int register_interpret(Interpreter *interpreter, FunctionList *flist) {
+	RegisterVm vm;
+	translate_chunk(&vm, interpreter->chunk, flist);
+	vm.interpreter = interpreter;
+	vm.frames = map_guarded_stack(
+	    (size_t) interpreter->max_depth * sizeof(RegisterFrame), false,
+	    locate_frame_overflow, &vm);
+
+	int result = run(&vm);
+
+	unmap_guarded_stack(vm.frames);
+	free_translation(&vm);
+	return result;
+}
+
+void print_register_code(FILE *file, Chunk *chunk, FunctionList *flist) {
+	RegisterVm vm;
+	translate_chunk(&vm, chunk, flist);
+	for (int i = 0; i < vm.count; i++) {
+		RegisterInstruction *instruction = &vm.code[i];
+		const RegisterOpInfo *info = &op_info[instruction->op_code];
+		uint32_t operands[] = {instruction->a, instruction->b,
+				       instruction->c, instruction->shift};
+		fprintf(file, "%-8d%s", i, info->name);
+		const char *separator = " ";
+		for (int j = 0; info->operands[j] != '\0'; j++) {
+			char kind = info->operands[j];
+			if (kind == '-') {
+				continue;
+			}
+			fprintf(file, "%s%s%d", separator,
+				kind == 'r'   ? "r"
+				: kind == 'k' ? "#"
+					      : "",
+				(int) operands[j]);
+			separator = ", ";
+		}
+		fprintf(file, "\n");
+	}
+	free_translation(&vm);
+}
+
+static void translate_chunk(RegisterVm *vm, Chunk *chunk, FunctionList *flist) {
+	vm->interpreter = NULL;
+	vm->chunk = chunk;
+	vm->flist = flist;
+	vm->count = 0;
+	vm->capacity = 64;
+	vm->code = malloc(vm->capacity * sizeof(RegisterInstruction));
+	vm->positions = malloc((chunk->length + 1) * sizeof(int));
+	vm->frames = NULL;
+	vm->depths = malloc((chunk->length + 1) * sizeof(int));
+	vm->is_target = malloc((chunk->length + 1) * sizeof(bool));
+	vm->slots = NULL;
+	vm->slot_capacity = 0;
+
+	Function **function_at = calloc(chunk->length + 1, sizeof(Function *));
+	for (int i = 0; i < flist->count; i++) {
+		function_at[flist->functions[i].index] = &flist->functions[i];
+	}
+	// The code before the first function calls main and exits.
+	int start = 0;
+	for (int index = 1; index <= chunk->length; index++) {
+		if (index == chunk->length || function_at[index] != NULL) {
+			translate_function(vm, function_at[start], start,
+					   index);
+			start = index;
+		}
+	}
+	// Running off the end of the code stops the program.
+	vm->positions[chunk->length] = vm->count;
+	emit(vm, REG_EXIT, 0, 0, 0);
+
+	for (int i = 0; i < vm->count; i++) {
+		RegisterInstruction *instruction = &vm->code[i];
+		if (has_target(instruction->op_code)) {
+			instruction->c = vm->positions[instruction->c];
+		}
+	}
+
+	free(function_at);
+	free(vm->depths);
+	free(vm->is_target);
+	free(vm->slots);
+}
+
+static void free_translation(RegisterVm *vm) {
+	free(vm->code);
+	free(vm->positions);
+}
+
+// Translates the function f, or the entry code when f is NULL, from the
+// chunk bytes in [start, end).
+static void translate_function(RegisterVm *vm, Function *f, int start,
+			       int end) {
+	int entry_depth = f != NULL ? f->parameter_count : 0;
+	int max_depth = entry_depth;
+	if (!compute_depths(vm->chunk, start, end, entry_depth, vm->depths,
+			    vm->is_target, &max_depth)) {
+		fprintf(stderr, "Cannot translate to register code: "
+				"inconsistent stack height in ");
+		if (f != NULL) {
+			print_token(stderr, &f->name);
+		} else {
+			fprintf(stderr, "entry code");
+		}
+		fprintf(stderr, "\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (max_depth + 1 > vm->slot_capacity) {
+		vm->slot_capacity = max_depth + 1;
+		vm->slots = realloc(vm->slots,
+				    vm->slot_capacity * sizeof(Slot));
+	}
+	for (int i = 0; i < vm->slot_capacity; i++) {
+		vm->slots[i].kind = SLOT_REGISTER;
+	}
+
+	vm->block_start = vm->count;
+	int index = start;
+	while (index < end) {
+		Instruction instruction;
+		int next = decode_instruction(vm->chunk, index, &instruction);
+		int depth = vm->depths[index];
+		if (depth >= 0 && vm->is_target[index]) {
+			// Every path into a jump target has to leave the
+			// stack in the same registers.
+			materialize_slots(vm, 0, depth);
+			vm->block_start = vm->count;
+		}
+		vm->positions[index] = vm->count;
+		if (depth >= 0) {
+			translate_instruction(vm, depth, &instruction);
+		}
+		if (!falls_through(instruction.op_code)) {
+			for (int i = 0; i < vm->slot_capacity; i++) {
+				vm->slots[i].kind = SLOT_REGISTER;
+			}
+		}
+		index = next;
+	}
+}
+
+static void translate_instruction(RegisterVm *vm, int depth,
+				  Instruction *instruction) {
+	Slot *slots = vm->slots;
+	uint32_t *operands = instruction->operands;
+	switch (instruction->op_code) {
+		case OP_NOOP:
+		case OP_POP:
+		case OP_POP_N:
+			break;
+		case OP_EXIT:
+			emit(vm, REG_EXIT, 0, 0, 0);
+			break;
+		case OP_PUSH:
+			slots[depth].kind = SLOT_CONSTANT;
+			slots[depth].value = (int) operands[0];
+			break;
+		case OP_LOAD:
+			if (slots[operands[0]].kind == SLOT_REGISTER) {
+				slots[depth].kind = SLOT_COPY;
+				slots[depth].value = (int) operands[0];
+			} else {
+				slots[depth] = slots[operands[0]];
+			}
+			break;
+		case OP_STORE:
+			translate_store(vm, depth, operands[0]);
+			break;
+		case OP_INCREMENT:
+			translate_increment(vm, depth, operands[0],
+					    (int) operands[1]);
+			break;
+		case OP_PRINT_UNIT:
+			emit(vm, REG_PRINT_UNIT, 0, 0, 0);
+			break;
+		case OP_PRINT_INTEGER:
+			emit(vm, REG_PRINT_INTEGER,
+			     source_register(vm, depth - 1), 0, 0);
+			break;
+		case OP_PRINT_BOOLEAN:
+			emit(vm, REG_PRINT_BOOLEAN,
+			     source_register(vm, depth - 1), 0, 0);
+			break;
+		case OP_ADD:
+			translate_binary(vm, depth, REG_ADD, true);
+			break;
+		case OP_SUB:
+			translate_binary(vm, depth, REG_SUB, false);
+			break;
+		case OP_MUL:
+			translate_binary(vm, depth, REG_MUL, true);
+			break;
+		case OP_DIV:
+			translate_binary(vm, depth, REG_DIV, false);
+			break;
+		case OP_NEGATE: {
+			Slot *slot = &slots[depth - 1];
+			if (slot->kind == SLOT_CONSTANT) {
+				slot->value =
+				    (int) (0u - (unsigned int) slot->value);
+				break;
+			}
+			emit(vm, REG_NEGATE, depth - 1,
+			     source_register(vm, depth - 1), 0);
+			slot->kind = SLOT_REGISTER;
+			break;
+		}
+		case OP_SHIFT_LEFT:
+		case OP_DIV_SHIFT:
+		case OP_DIV_MULTIPLY:
+			translate_by_constant(vm, depth, instruction);
+			break;
+		case OP_EQUAL:
+			translate_binary(vm, depth, REG_EQUAL, true);
+			break;
+		case OP_NOT_EQUAL:
+			translate_binary(vm, depth, REG_NOT_EQUAL, true);
+			break;
+		case OP_LESS:
+			translate_binary(vm, depth, REG_LESS, false);
+			break;
+		case OP_LESS_EQUAL:
+			translate_binary(vm, depth, REG_LESS_EQUAL, false);
+			break;
+		case OP_GREATER:
+			translate_binary(vm, depth, REG_GREATER, false);
+			break;
+		case OP_GREATER_EQUAL:
+			translate_binary(vm, depth, REG_GREATER_EQUAL, false);
+			break;
+		case OP_JUMP:
+			materialize_slots(vm, 0, depth);
+			emit(vm, REG_JUMP, 0, 0, operands[0]);
+			break;
+		case OP_JUMP_IF_FALSE: {
+			uint32_t condition = source_register(vm, depth - 1);
+			materialize_slots(vm, 0, depth - 1);
+			emit(vm, REG_JUMP_IF_FALSE, condition, 0, operands[0]);
+			break;
+		}
+		case OP_JUMP_IF_NOT_EQUAL:
+			translate_compare_jump(vm, depth, REG_JUMP_IF_NOT_EQUAL,
+					       true, operands[0]);
+			break;
+		case OP_JUMP_IF_EQUAL:
+			translate_compare_jump(vm, depth, REG_JUMP_IF_EQUAL,
+					       true, operands[0]);
+			break;
+		case OP_JUMP_IF_NOT_LESS:
+			translate_compare_jump(vm, depth, REG_JUMP_IF_NOT_LESS,
+					       false, operands[0]);
+			break;
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+			translate_compare_jump(vm, depth,
+					       REG_JUMP_IF_NOT_LESS_EQUAL,
+					       false, operands[0]);
+			break;
+		case OP_JUMP_IF_NOT_GREATER:
+			translate_compare_jump(vm, depth,
+					       REG_JUMP_IF_NOT_GREATER, false,
+					       operands[0]);
+			break;
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			translate_compare_jump(vm, depth,
+					       REG_JUMP_IF_NOT_GREATER_EQUAL,
+					       false, operands[0]);
+			break;
+		case OP_CALL: {
+			// The callee's registers start at the first argument,
+			// so only the arguments have to be in place.
+			int first = depth - (int) operands[1];
+			materialize_slots(vm, first, depth);
+			emit(vm, REG_CALL, first, operands[1], operands[0]);
+			slots[first].kind = SLOT_REGISTER;
+			break;
+		}
+		case OP_RETURN:
+			emit(vm, REG_RETURN, source_register(vm, depth - 1), 0,
+			     0);
+			break;
+		case OP_TAIL_CALL: {
+			int first = depth - (int) operands[1];
+			materialize_slots(vm, first, depth);
+			emit(vm, REG_TAIL_CALL, first, operands[1],
+			     operands[0]);
+			break;
+		}
+		default:
+			fprintf(stderr, "Cannot translate opcode %s\n",
+				op_code_name(instruction->op_code));
+			exit(EXIT_FAILURE);
+	}
+}
+
+static void translate_store(RegisterVm *vm, int depth, int local) {
+	// Copies of the local that are only remembered have to be made
+	// before it changes.
+	materialize_copies(vm, local, local + 1, depth - 1);
+	Slot *value = &vm->slots[depth - 1];
+	if (value->kind == SLOT_CONSTANT) {
+		emit(vm, REG_LOAD_CONSTANT, local, (uint32_t) value->value, 0);
+	} else if (value->kind == SLOT_REGISTER &&
+		   computed_last(vm, depth - 1)) {
+		// The value can be computed into the local instead.
+		vm->code[vm->count - 1].a = local;
+	} else {
+		int source =
+		    value->kind == SLOT_COPY ? value->value : depth - 1;
+		if (source != local) {
+			emit(vm, REG_MOVE, local, source, 0);
+		}
+	}
+	vm->slots[local].kind = SLOT_REGISTER;
+}
+
+static void translate_increment(RegisterVm *vm, int depth, int local,
+				int amount) {
+	Slot *slot = &vm->slots[local];
+	if (slot->kind == SLOT_CONSTANT) {
+		slot->value = (int) ((unsigned int) slot->value + amount);
+		return;
+	}
+	materialize_copies(vm, local, local + 1, depth);
+	materialize(vm, local);
+	emit(vm, REG_ADD_CONSTANT, local, local, (uint32_t) amount);
+}
+
+// Multiplication and division of the value on top of the stack by a
+// constant. A constant value is folded.
+static void translate_by_constant(RegisterVm *vm, int depth,
+				  Instruction *instruction) {
+	Slot *slot = &vm->slots[depth - 1];
+	uint32_t *operands = instruction->operands;
+	OpCode op_code = instruction->op_code;
+	if (slot->kind == SLOT_CONSTANT) {
+		if (op_code == OP_SHIFT_LEFT) {
+			uint32_t shifted = (uint32_t) slot->value << operands[0];
+			slot->value = (int) shifted;
+		} else if (op_code == OP_DIV_SHIFT) {
+			slot->value = divide_by_shift(slot->value, operands[0]);
+		} else {
+			slot->value = divide_by_multiply(
+			    slot->value, operands[0], operands[1]);
+		}
+		return;
+	}
+	RegisterOpCode register_op_code =
+	    op_code == OP_SHIFT_LEFT  ? REG_SHIFT_LEFT
+	    : op_code == OP_DIV_SHIFT ? REG_DIV_SHIFT
+				      : REG_DIV_MULTIPLY;
+	emit(vm, register_op_code, depth - 1, source_register(vm, depth - 1),
+	     operands[0]);
+	vm->code[vm->count - 1].shift = (uint16_t) operands[1];
+	slot->kind = SLOT_REGISTER;
+}
+
+// Replaces the two operands on top of the stack with their result.
+static void translate_binary(RegisterVm *vm, int depth,
+			     RegisterOpCode op_code, bool commutative) {
+	uint32_t left, right;
+	resolve_operands(vm, depth, &op_code, commutative, &left, &right);
+	emit(vm, op_code, depth - 2, left, right);
+	vm->slots[depth - 2].kind = SLOT_REGISTER;
+}
+
+static void translate_compare_jump(RegisterVm *vm, int depth,
+				   RegisterOpCode op_code, bool commutative,
+				   uint32_t target) {
+	uint32_t left, right;
+	resolve_operands(vm, depth, &op_code, commutative, &left, &right);
+	materialize_slots(vm, 0, depth - 2);
+	emit(vm, op_code, left, right, target);
+}
+
+// Finds the registers holding the two operands on top of the stack. A
+// constant right operand, or a constant left one of a commutative
+// operation, is used directly through the constant form of op_code.
+static void resolve_operands(RegisterVm *vm, int depth,
+			     RegisterOpCode *op_code, bool commutative,
+			     uint32_t *left, uint32_t *right) {
+	Slot *first = &vm->slots[depth - 2];
+	Slot *second = &vm->slots[depth - 1];
+	if (second->kind == SLOT_CONSTANT) {
+		*left = source_register(vm, depth - 2);
+		*right = (uint32_t) second->value;
+		*op_code += 1;
+	} else if (first->kind == SLOT_CONSTANT && commutative) {
+		*left = source_register(vm, depth - 1);
+		*right = (uint32_t) first->value;
+		*op_code += 1;
+	} else {
+		*left = source_register(vm, depth - 2);
+		*right = source_register(vm, depth - 1);
+	}
+}
+
+// The register that holds the value in slot. Constants are loaded into
+// the slot's own register first.
+static uint32_t source_register(RegisterVm *vm, int slot) {
+	Slot *value = &vm->slots[slot];
+	if (value->kind == SLOT_CONSTANT) {
+		materialize(vm, slot);
+	}
+	return value->kind == SLOT_COPY ? (uint32_t) value->value
+					: (uint32_t) slot;
+}
+
+// Whether the last instruction, in the current straight-line code, only
+// computed the register of slot.
+static bool computed_last(RegisterVm *vm, int slot) {
+	if (vm->count == vm->block_start) {
+		return false;
+	}
+	RegisterInstruction *last = &vm->code[vm->count - 1];
+	return last->op_code < REG_JUMP && last->a == (uint32_t) slot;
+}
+
+static void materialize(RegisterVm *vm, int slot) {
+	Slot *value = &vm->slots[slot];
+	if (value->kind == SLOT_COPY) {
+		emit(vm, REG_MOVE, slot, value->value, 0);
+	} else if (value->kind == SLOT_CONSTANT) {
+		emit(vm, REG_LOAD_CONSTANT, slot, (uint32_t) value->value, 0);
+	}
+	value->kind = SLOT_REGISTER;
+}
+
+static void materialize_slots(RegisterVm *vm, int from, int to) {
+	for (int i = from; i < to; i++) {
+		materialize(vm, i);
+	}
+}
+
+static void materialize_copies(RegisterVm *vm, int local, int from, int to) {
+	for (int i = from; i < to; i++) {
+		if (vm->slots[i].kind == SLOT_COPY &&
+		    vm->slots[i].value == local) {
+			materialize(vm, i);
+		}
+	}
+}
+
+static void emit(RegisterVm *vm, RegisterOpCode op_code, uint32_t a,
+		 uint32_t b, uint32_t c) {
+	if (vm->count == vm->capacity) {
+		vm->capacity *= 2;
+		vm->code = realloc(vm->code,
+				   vm->capacity * sizeof(RegisterInstruction));
+	}
+	RegisterInstruction *instruction = &vm->code[vm->count++];
+	instruction->op_code = op_code;
+	instruction->shift = 0;
+	instruction->a = a;
+	instruction->b = b;
+	instruction->c = c;
+}
+
+static bool has_target(RegisterOpCode op_code) {
+	const char *operands = op_info[op_code].operands;
+	return operands[0] != '\0' && operands[1] != '\0' &&
+	       operands[2] == 't';
+}
+
+static int run(RegisterVm *vm) {
+	// Registers are the slots above fp, on the interpreter's value stack.
+	Interpreter *interpreter = vm->interpreter;
+	RegisterInstruction *code = vm->code;
+	RegisterInstruction *ip = code + vm->positions[0];
+	Object *fp = interpreter->stack;
+	RegisterFrame *frame = vm->frames;
+
+#ifdef THREADED_DISPATCH
+	static const void *const dispatch_table[] = {
+	    [REG_MOVE] = __extension__ &&label_REG_MOVE,
+	    [REG_LOAD_CONSTANT] = __extension__ &&label_REG_LOAD_CONSTANT,
+	    [REG_ADD] = __extension__ &&label_REG_ADD,
+	    [REG_ADD_CONSTANT] = __extension__ &&label_REG_ADD_CONSTANT,
+	    [REG_SUB] = __extension__ &&label_REG_SUB,
+	    [REG_SUB_CONSTANT] = __extension__ &&label_REG_SUB_CONSTANT,
+	    [REG_MUL] = __extension__ &&label_REG_MUL,
+	    [REG_MUL_CONSTANT] = __extension__ &&label_REG_MUL_CONSTANT,
+	    [REG_DIV] = __extension__ &&label_REG_DIV,
+	    [REG_DIV_CONSTANT] = __extension__ &&label_REG_DIV_CONSTANT,
+	    [REG_NEGATE] = __extension__ &&label_REG_NEGATE,
+	    [REG_SHIFT_LEFT] = __extension__ &&label_REG_SHIFT_LEFT,
+	    [REG_DIV_SHIFT] = __extension__ &&label_REG_DIV_SHIFT,
+	    [REG_DIV_MULTIPLY] = __extension__ &&label_REG_DIV_MULTIPLY,
+	    [REG_EQUAL] = __extension__ &&label_REG_EQUAL,
+	    [REG_EQUAL_CONSTANT] = __extension__ &&label_REG_EQUAL_CONSTANT,
+	    [REG_NOT_EQUAL] = __extension__ &&label_REG_NOT_EQUAL,
+	    [REG_NOT_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_NOT_EQUAL_CONSTANT,
+	    [REG_LESS] = __extension__ &&label_REG_LESS,
+	    [REG_LESS_CONSTANT] = __extension__ &&label_REG_LESS_CONSTANT,
+	    [REG_LESS_EQUAL] = __extension__ &&label_REG_LESS_EQUAL,
+	    [REG_LESS_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_LESS_EQUAL_CONSTANT,
+	    [REG_GREATER] = __extension__ &&label_REG_GREATER,
+	    [REG_GREATER_CONSTANT] = __extension__ &&label_REG_GREATER_CONSTANT,
+	    [REG_GREATER_EQUAL] = __extension__ &&label_REG_GREATER_EQUAL,
+	    [REG_GREATER_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_GREATER_EQUAL_CONSTANT,
+	    [REG_JUMP] = __extension__ &&label_REG_JUMP,
+	    [REG_JUMP_IF_FALSE] = __extension__ &&label_REG_JUMP_IF_FALSE,
+	    [REG_JUMP_IF_NOT_EQUAL] =
+		__extension__ &&label_REG_JUMP_IF_NOT_EQUAL,
+	    [REG_JUMP_IF_NOT_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_NOT_EQUAL_CONSTANT,
+	    [REG_JUMP_IF_EQUAL] = __extension__ &&label_REG_JUMP_IF_EQUAL,
+	    [REG_JUMP_IF_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_EQUAL_CONSTANT,
+	    [REG_JUMP_IF_NOT_LESS] = __extension__ &&label_REG_JUMP_IF_NOT_LESS,
+	    [REG_JUMP_IF_NOT_LESS_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_NOT_LESS_CONSTANT,
+	    [REG_JUMP_IF_NOT_LESS_EQUAL] =
+		__extension__ &&label_REG_JUMP_IF_NOT_LESS_EQUAL,
+	    [REG_JUMP_IF_NOT_LESS_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_NOT_LESS_EQUAL_CONSTANT,
+	    [REG_JUMP_IF_NOT_GREATER] =
+		__extension__ &&label_REG_JUMP_IF_NOT_GREATER,
+	    [REG_JUMP_IF_NOT_GREATER_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_NOT_GREATER_CONSTANT,
+	    [REG_JUMP_IF_NOT_GREATER_EQUAL] =
+		__extension__ &&label_REG_JUMP_IF_NOT_GREATER_EQUAL,
+	    [REG_JUMP_IF_NOT_GREATER_EQUAL_CONSTANT] =
+		__extension__ &&label_REG_JUMP_IF_NOT_GREATER_EQUAL_CONSTANT,
+	    [REG_CALL] = __extension__ &&label_REG_CALL,
+	    [REG_RETURN] = __extension__ &&label_REG_RETURN,
+	    [REG_TAIL_CALL] = __extension__ &&label_REG_TAIL_CALL,
+	    [REG_PRINT_UNIT] = __extension__ &&label_REG_PRINT_UNIT,
+	    [REG_PRINT_INTEGER] = __extension__ &&label_REG_PRINT_INTEGER,
+	    [REG_PRINT_BOOLEAN] = __extension__ &&label_REG_PRINT_BOOLEAN,
+	    [REG_EXIT] = __extension__ &&label_REG_EXIT,
+	};
+
+	DISPATCH();
+#else
+	for (;;) {
+		switch (ip->op_code) {
+#endif
+		TARGET(REG_MOVE) {
+			fp[ip->a] = fp[ip->b];
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_LOAD_CONSTANT) {
+			fp[ip->a].integer = (int) ip->b;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_ADD) {
+			fp[ip->a].integer =
+			    fp[ip->b].integer + fp[ip->c].integer;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_ADD_CONSTANT) {
+			fp[ip->a].integer = fp[ip->b].integer + (int) ip->c;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_SUB) {
+			fp[ip->a].integer =
+			    fp[ip->b].integer - fp[ip->c].integer;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_SUB_CONSTANT) {
+			fp[ip->a].integer = fp[ip->b].integer - (int) ip->c;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_MUL) {
+			fp[ip->a].integer =
+			    fp[ip->b].integer * fp[ip->c].integer;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_MUL_CONSTANT) {
+			fp[ip->a].integer = fp[ip->b].integer * (int) ip->c;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_DIV) {
+			fp[ip->a].integer =
+			    fp[ip->b].integer / fp[ip->c].integer;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_DIV_CONSTANT) {
+			fp[ip->a].integer = fp[ip->b].integer / (int) ip->c;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_NEGATE) {
+			fp[ip->a].integer = -fp[ip->b].integer;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_SHIFT_LEFT) {
+			uint32_t shifted = (uint32_t) fp[ip->b].integer << ip->c;
+			fp[ip->a].integer = (int) shifted;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_DIV_SHIFT) {
+			fp[ip->a].integer =
+			    divide_by_shift(fp[ip->b].integer, ip->c);
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_DIV_MULTIPLY) {
+			fp[ip->a].integer = divide_by_multiply(
+			    fp[ip->b].integer, ip->c, ip->shift);
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_EQUAL) {
+			bool result = fp[ip->b].integer == fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_EQUAL_CONSTANT) {
+			bool result = fp[ip->b].integer == (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_NOT_EQUAL) {
+			bool result = fp[ip->b].integer != fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_NOT_EQUAL_CONSTANT) {
+			bool result = fp[ip->b].integer != (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_LESS) {
+			bool result = fp[ip->b].integer < fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_LESS_CONSTANT) {
+			bool result = fp[ip->b].integer < (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_LESS_EQUAL) {
+			bool result = fp[ip->b].integer <= fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_LESS_EQUAL_CONSTANT) {
+			bool result = fp[ip->b].integer <= (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_GREATER) {
+			bool result = fp[ip->b].integer > fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_GREATER_CONSTANT) {
+			bool result = fp[ip->b].integer > (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_GREATER_EQUAL) {
+			bool result = fp[ip->b].integer >= fp[ip->c].integer;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_GREATER_EQUAL_CONSTANT) {
+			bool result = fp[ip->b].integer >= (int) ip->c;
+			fp[ip->a].integer = result ? AQ_TRUE : AQ_FALSE;
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_JUMP) {
+			ip = code + ip->c;
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_FALSE) {
+			if (fp[ip->a].integer == AQ_FALSE) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_EQUAL) {
+			if (fp[ip->a].integer != fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_EQUAL_CONSTANT) {
+			if (fp[ip->a].integer != (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_EQUAL) {
+			if (fp[ip->a].integer == fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_EQUAL_CONSTANT) {
+			if (fp[ip->a].integer == (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_LESS) {
+			if (fp[ip->a].integer >= fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_LESS_CONSTANT) {
+			if (fp[ip->a].integer >= (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_LESS_EQUAL) {
+			if (fp[ip->a].integer > fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_LESS_EQUAL_CONSTANT) {
+			if (fp[ip->a].integer > (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_GREATER) {
+			if (fp[ip->a].integer <= fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_GREATER_CONSTANT) {
+			if (fp[ip->a].integer <= (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_GREATER_EQUAL) {
+			if (fp[ip->a].integer < fp[ip->b].integer) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_JUMP_IF_NOT_GREATER_EQUAL_CONSTANT) {
+			if (fp[ip->a].integer < (int) ip->b) {
+				ip = code + ip->c;
+			} else {
+				ip++;
+			}
+			DISPATCH();
+		}
+		TARGET(REG_CALL) {
+			// The arguments become the callee's first registers.
+			frame->return_address = ip + 1;
+			frame->base = fp;
+			frame++;
+			fp += ip->a;
+			ip = code + ip->c;
+			DISPATCH();
+		}
+		TARGET(REG_RETURN) {
+			// The result replaces the first argument, which is the
+			// register the caller expects it in.
+			fp[0] = fp[ip->a];
+			frame--;
+			ip = frame->return_address;
+			fp = frame->base;
+			DISPATCH();
+		}
+		TARGET(REG_TAIL_CALL) {
+			// The arguments always lie above the parameters.
+			for (uint32_t i = 0; i < ip->b; i++) {
+				fp[i] = fp[ip->a + i];
+			}
+			ip = code + ip->c;
+			DISPATCH();
+		}
+		TARGET(REG_PRINT_UNIT) {
+			print_unit(&interpreter->output);
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_PRINT_INTEGER) {
+			print_integer(&interpreter->output, fp[ip->a].integer);
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_PRINT_BOOLEAN) {
+			print_boolean(&interpreter->output, fp[ip->a].integer);
+			ip++;
+			DISPATCH();
+		}
+		TARGET(REG_EXIT) {
+			return 0;
+		}
+#ifndef THREADED_DISPATCH
+		default:
+			flush_output(&interpreter->output);
+			fprintf(stderr, "Invalid register opcode: %d\n",
+				(int) ip->op_code);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+#endif
+	return 0;
+}
+
+// The frame stack only overflows in REG_CALL, after the last frame was
+// filled by the call into the function that is running now.
+static Function *locate_frame_overflow(void *context) {
+	RegisterVm *vm = context;
+	RegisterFrame *last = &vm->frames[vm->interpreter->max_depth - 1];
+	uint32_t target = last->return_address[-1].c;
+	for (int i = 0; i < vm->flist->count; i++) {
+		Function *f = &vm->flist->functions[i];
+		if ((uint32_t) vm->positions[f->index] == target) {
+			return f;
+		}
+	}
+	return NULL;
+}
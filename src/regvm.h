@@ -0,0 +1,17 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+#include "chunk.h"
+#include "function.h"
+#include "interpreter.h"
+#include <stdio.h>
+
+// Runs the program on the register VM, which executes a translation of the
+// chunk into three-address code, using the interpreter's value stack and
+// output.
+int register_interpret(Interpreter *interpreter, FunctionList *flist);
+
+// Prints the register code the chunk translates to.
+void print_register_code(FILE *file, Chunk *chunk, FunctionList *flist);
+
+#endif
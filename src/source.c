@@ -0,0 +1,90 @@
+#include "source.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static void read_stream(Source *source, int fd);
+
+void load_source(Source *source, const char *path) {
+	source->text = NULL;
+	source->length = 0;
+	source->is_mapped = false;
+
+	if (strcmp(path, "-") == 0) {
+		read_stream(source, STDIN_FILENO);
+		return;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(EXIT_FAILURE);
+	}
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		perror("fstat");
+		exit(EXIT_FAILURE);
+	}
+
+	// Pipes, terminals and empty files cannot be mapped.
+	if (!S_ISREG(status.st_mode) || status.st_size == 0) {
+		read_stream(source, fd);
+		close(fd);
+		return;
+	}
+
+	size_t size = status.st_size;
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	// The lexer makes a single forward pass.
+	posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+
+	source->text = mapping;
+	source->length = size;
+	source->is_mapped = true;
+}
+
+void free_source(Source *source) {
+	if (source->is_mapped) {
+		munmap(source->text, source->length);
+	} else {
+		free(source->text);
+	}
+}
+
+static void read_stream(Source *source, int fd) {
+	size_t capacity = 0;
+	for (;;) {
+		if (capacity - source->length < READ_CHUNK_SIZE) {
+			capacity = capacity < READ_CHUNK_SIZE
+				       ? READ_CHUNK_SIZE
+				       : capacity * 2;
+			source->text = realloc(source->text, capacity);
+			if (source->text == NULL) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		ssize_t count = read(fd, source->text + source->length,
+				     capacity - source->length);
+		if (count < 0) {
+			perror("read");
+			exit(EXIT_FAILURE);
+		}
+		if (count == 0) {
+			break;
+		}
+		source->length += count;
+	}
+}
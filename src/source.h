@@ -0,0 +1,19 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The text of a program. It is not NUL-terminated: regular files are mapped
+// read-only and lexed in place, anything else is read into a buffer.
+typedef struct Source {
+	char *text;
+	size_t length;
+	bool is_mapped;
+} Source;
+
+// A path of "-" reads standard input.
+void load_source(Source *source, const char *path);
+void free_source(Source *source);
+
+#endif
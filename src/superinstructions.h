@@ -0,0 +1,25 @@
+// Generated by bench/gen_superinstructions.sh from the opcode
+// sequences the benchmarks run most. Run make superinstructions to
+// regenerate it.
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+// X(name, first, second), naming the opcodes without OP_.
+#define SUPERINSTRUCTION_PAIRS(X) \
+	X(SUPER_LOAD_PUSH, LOAD, PUSH) \
+	X(SUPER_PUSH_JUMP_IF_NOT_LESS, PUSH, JUMP_IF_NOT_LESS) \
+	X(SUPER_LOAD_LOAD, LOAD, LOAD) \
+	X(SUPER_INCREMENT_JUMP, INCREMENT, JUMP)
+
+// X(name, first, second, third)
+#define SUPERINSTRUCTION_TRIPLES(X) \
+	X(SUPER_LOAD_PUSH_JUMP_IF_NOT_LESS, LOAD, PUSH, JUMP_IF_NOT_LESS) \
+	X(SUPER_LOAD_PRINT_INTEGER_INCREMENT, LOAD, PRINT_INTEGER, INCREMENT) \
+	X(SUPER_PRINT_INTEGER_INCREMENT_JUMP, PRINT_INTEGER, INCREMENT, JUMP) \
+	X(SUPER_LOAD_PUSH_SUB, LOAD, PUSH, SUB) \
+	X(SUPER_PUSH_SUB_CALL, PUSH, SUB, CALL) \
+	X(SUPER_DIV_MULTIPLY_PUSH_MUL, DIV_MULTIPLY, PUSH, MUL) \
+	X(SUPER_LOAD_DIV_MULTIPLY_PUSH, LOAD, DIV_MULTIPLY, PUSH) \
+	X(SUPER_LOAD_LOAD_DIV_MULTIPLY, LOAD, LOAD, DIV_MULTIPLY)
+
+#endif
@@ -0,0 +1,92 @@
+#include "symbol.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t hash_name(const char *start, int length);
+static int find_slot(SymbolTable *table, const char *start, int length,
+		     uint32_t hash);
+static void grow_slots(SymbolTable *table);
+
+void init_symbol_table(SymbolTable *table, Arena *arena) {
+	table->arena = arena;
+	table->symbols = arena_alloc(arena, 64 * sizeof(Symbol));
+	table->count = 0;
+	table->capacity = 64;
+	table->slot_count = 128;
+	table->slots = arena_alloc(arena, table->slot_count * sizeof(int));
+	for (int i = 0; i < table->slot_count; i++) {
+		table->slots[i] = -1;
+	}
+}
+
+int intern_symbol(SymbolTable *table, const char *start, int length) {
+	uint32_t hash = hash_name(start, length);
+	int slot = find_slot(table, start, length, hash);
+	if (table->slots[slot] >= 0) {
+		return table->slots[slot];
+	}
+
+	if (table->count == table->capacity) {
+		table->symbols = arena_resize(
+		    table->arena, table->symbols,
+		    table->capacity * sizeof(Symbol),
+		    2 * table->capacity * sizeof(Symbol));
+		table->capacity *= 2;
+	}
+	int symbol = table->count++;
+	table->symbols[symbol].start = start;
+	table->symbols[symbol].length = length;
+	table->symbols[symbol].hash = hash;
+	table->slots[slot] = symbol;
+
+	// Keep the load factor at most one half.
+	if (2 * table->count > table->slot_count) {
+		grow_slots(table);
+	}
+	return symbol;
+}
+
+// 32-bit FNV-1a.
+static uint32_t hash_name(const char *start, int length) {
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < length; i++) {
+		hash ^= (unsigned char) start[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Returns the slot holding the name, or the empty slot where it belongs.
+static int find_slot(SymbolTable *table, const char *start, int length,
+		     uint32_t hash) {
+	uint32_t mask = table->slot_count - 1;
+	for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+		int symbol = table->slots[i];
+		if (symbol < 0) {
+			return i;
+		}
+		Symbol *s = &table->symbols[symbol];
+		if (s->hash == hash && s->length == length &&
+		    memcmp(s->start, start, length) == 0) {
+			return i;
+		}
+	}
+}
+
+static void grow_slots(SymbolTable *table) {
+	table->slot_count *= 2;
+	table->slots =
+	    arena_alloc(table->arena, table->slot_count * sizeof(int));
+	for (int i = 0; i < table->slot_count; i++) {
+		table->slots[i] = -1;
+	}
+	uint32_t mask = table->slot_count - 1;
+	for (int symbol = 0; symbol < table->count; symbol++) {
+		uint32_t i = table->symbols[symbol].hash & mask;
+		while (table->slots[i] >= 0) {
+			i = (i + 1) & mask;
+		}
+		table->slots[i] = symbol;
+	}
+}
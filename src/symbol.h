@@ -0,0 +1,31 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include "arena.h"
+#include <stdint.h>
+
+// Interns identifiers: every distinct name is mapped to a small integer
+// once, so later lookups can index arrays instead of comparing strings.
+
+typedef struct Symbol {
+	const char *start;
+	int length;
+	uint32_t hash;
+} Symbol;
+
+typedef struct SymbolTable {
+	Symbol *symbols;
+	int count;
+	int capacity;
+
+	// Open-addressing index into symbols, -1 marks an empty slot.
+	int *slots;
+	int slot_count;
+
+	Arena *arena;
+} SymbolTable;
+
+void init_symbol_table(SymbolTable *table, Arena *arena);
+int intern_symbol(SymbolTable *table, const char *start, int length);
+
+#endif
@@ -54,6 +54,8 @@ typedef struct Token {
 	TokenType type;
 	char *start;
 	int length;
+	// Interned name of a TT_NAME token, -1 for every other token.
+	int symbol;
 } Token;
 
 bool token_equal(Token *a, Token *b);
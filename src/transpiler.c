@@ -0,0 +1,368 @@
+#include "transpiler.h"
+#include "chunk.h"
+#include "flow.h"
+#include "function.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Translates a finished chunk into a self-contained C program. Within a
+// function the height of the value stack before every instruction is
+// fixed, so every stack slot becomes a C local: s0..s(n-1) are the
+// parameters, the slots above them the locals and temporaries. Aquila
+// functions become C functions and jumps become gotos, which leaves the
+// data flow entirely to the C compiler.
+
+typedef struct Transpiler {
+	FILE *file;
+	Chunk *chunk;
+	FunctionList *flist;
+	// Function being emitted, NULL for the entry code.
+	Function *function;
+
+	// Function starting at each chunk index, or NULL.
+	Function **function_at;
+	// Stack height before each instruction, -1 if unreachable.
+	int *depths;
+	bool *is_target;
+} Transpiler;
+
+static void emit_prelude(Transpiler *transpiler);
+static void emit_declaration(Transpiler *transpiler, Function *f);
+static void emit_function(Transpiler *transpiler, Function *f, int start,
+			  int end);
+static void emit_instruction(Transpiler *transpiler, int index,
+			     Instruction *instruction);
+static void emit_call_arguments(Transpiler *transpiler, int first, int count);
+static void emit_function_name(Transpiler *transpiler, Function *f);
+static const char *comparison_operator(OpCode op_code);
+static int compare_functions(const void *a, const void *b);
+
+void emit_c(FILE *file, Chunk *chunk, FunctionList *flist) {
+	Transpiler transpiler;
+	transpiler.file = file;
+	transpiler.chunk = chunk;
+	transpiler.flist = flist;
+	transpiler.function_at = calloc(chunk->length + 1, sizeof(Function *));
+	transpiler.depths = malloc((chunk->length + 1) * sizeof(int));
+	transpiler.is_target = calloc(chunk->length + 1, sizeof(bool));
+
+	Function **functions = malloc(flist->count * sizeof(Function *));
+	for (int i = 0; i < flist->count; i++) {
+		functions[i] = &flist->functions[i];
+		transpiler.function_at[functions[i]->index] = functions[i];
+	}
+	qsort(functions, flist->count, sizeof(Function *), compare_functions);
+
+	emit_prelude(&transpiler);
+	for (int i = 0; i < flist->count; i++) {
+		emit_declaration(&transpiler, functions[i]);
+		fprintf(file, ";\n");
+	}
+	fprintf(file, "\n");
+
+	// The code before the first function calls main and exits.
+	int first = flist->count > 0 ? functions[0]->index : chunk->length;
+	emit_function(&transpiler, NULL, 0, first);
+	for (int i = 0; i < flist->count; i++) {
+		int end = i + 1 < flist->count ? functions[i + 1]->index
+					       : chunk->length;
+		emit_function(&transpiler, functions[i], functions[i]->index,
+			      end);
+	}
+
+	free(functions);
+	free(transpiler.function_at);
+	free(transpiler.depths);
+	free(transpiler.is_target);
+}
+
+static void emit_prelude(Transpiler *transpiler) {
+	FILE *file = transpiler->file;
+	fprintf(file, "/* Generated by aquila --emit-c */\n");
+	fprintf(file, "#include <stdio.h>\n");
+	fprintf(file, "#include <stdlib.h>\n\n");
+	fprintf(file, "static inline void aq_print_unit(void) {\n"
+		      "\tputs(\"unit\");\n"
+		      "}\n\n");
+	// Like the interpreter, integers are formatted by hand rather than
+	// with printf.
+	fprintf(file, "static inline void aq_print_integer(int value) {\n"
+		      "\tchar digits[16];\n"
+		      "\tchar *start = digits + sizeof(digits);\n"
+		      "\tunsigned int magnitude = value < 0 ? "
+		      "0u - (unsigned int) value : (unsigned int) value;\n"
+		      "\t*--start = '\\n';\n"
+		      "\tdo {\n"
+		      "\t\t*--start = (char) ('0' + magnitude %% 10);\n"
+		      "\t\tmagnitude /= 10;\n"
+		      "\t} while (magnitude > 0);\n"
+		      "\tif (value < 0) {\n"
+		      "\t\t*--start = '-';\n"
+		      "\t}\n"
+		      "\tfwrite(start, 1, digits + sizeof(digits) - start, "
+		      "stdout);\n"
+		      "}\n\n");
+	fprintf(file, "static inline void aq_print_boolean(int value) {\n"
+		      "\tputs(value == %d ? \"true\" : \"false\");\n"
+		      "}\n\n",
+		AQ_TRUE);
+}
+
+static void emit_declaration(Transpiler *transpiler, Function *f) {
+	fprintf(transpiler->file, "static int ");
+	emit_function_name(transpiler, f);
+	fprintf(transpiler->file, "(");
+	if (f->parameter_count == 0) {
+		fprintf(transpiler->file, "void");
+	}
+	for (int i = 0; i < f->parameter_count; i++) {
+		fprintf(transpiler->file, "%sint s%d", i > 0 ? ", " : "", i);
+	}
+	fprintf(transpiler->file, ")");
+}
+
+// Emits the function f, or the C main function for the entry code when f is
+// NULL, from the chunk bytes in [start, end).
+static void emit_function(Transpiler *transpiler, Function *f, int start,
+			  int end) {
+	FILE *file = transpiler->file;
+	transpiler->function = f;
+	int entry_depth = f != NULL ? f->parameter_count : 0;
+	int max_depth = entry_depth;
+	if (!compute_depths(transpiler->chunk, start, end, entry_depth,
+			    transpiler->depths, transpiler->is_target,
+			    &max_depth)) {
+		fprintf(stderr, "Cannot emit C: inconsistent stack height in ");
+		if (f != NULL) {
+			print_token(stderr, &f->name);
+		} else {
+			fprintf(stderr, "entry code");
+		}
+		fprintf(stderr, "\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (f != NULL) {
+		emit_declaration(transpiler, f);
+	} else {
+		fprintf(file, "int main(void)");
+	}
+	fprintf(file, " {\n");
+	for (int i = entry_depth; i < max_depth; i++) {
+		fprintf(file, "\tint s%d;\n", i);
+	}
+
+	int index = start;
+	while (index < end) {
+		Instruction instruction;
+		int next = decode_instruction(transpiler->chunk, index,
+					      &instruction);
+		if (transpiler->is_target[index]) {
+			fprintf(file, "L%d:\n", index);
+		}
+		if (transpiler->depths[index] >= 0) {
+			emit_instruction(transpiler, index, &instruction);
+		}
+		index = next;
+	}
+	// Bytecode that runs past the end of a function has no meaning.
+	if (transpiler->is_target[end]) {
+		fprintf(file, "L%d:\n", end);
+	}
+	fprintf(file, "\tabort();\n");
+	fprintf(file, "}\n\n");
+}
+
+static void emit_instruction(Transpiler *transpiler, int index,
+			     Instruction *instruction) {
+	FILE *file = transpiler->file;
+	int d = transpiler->depths[index];
+	uint32_t *operands = instruction->operands;
+	switch (instruction->op_code) {
+		case OP_NOOP:
+		case OP_POP:
+		case OP_POP_N:
+			break;
+		case OP_EXIT:
+			fprintf(file, "\treturn 0;\n");
+			break;
+		case OP_PUSH:
+			fprintf(file, "\ts%d = %d;\n", d, (int) operands[0]);
+			break;
+		case OP_LOAD:
+			fprintf(file, "\ts%d = s%d;\n", d, operands[0]);
+			break;
+		case OP_STORE:
+			fprintf(file, "\ts%d = s%d;\n", operands[0], d - 1);
+			break;
+		case OP_INCREMENT:
+			fprintf(file, "\ts%d = (int) ((unsigned) s%d + %uu);\n",
+				operands[0], operands[0], operands[1]);
+			break;
+		case OP_PRINT_UNIT:
+			fprintf(file, "\taq_print_unit();\n");
+			break;
+		case OP_PRINT_INTEGER:
+			fprintf(file, "\taq_print_integer(s%d);\n", d - 1);
+			break;
+		case OP_PRINT_BOOLEAN:
+			fprintf(file, "\taq_print_boolean(s%d);\n", d - 1);
+			break;
+		// Arithmetic wraps around like it does in the VM.
+		case OP_ADD:
+			fprintf(file,
+				"\ts%d = (int) ((unsigned) s%d + (unsigned) "
+				"s%d);\n",
+				d - 2, d - 2, d - 1);
+			break;
+		case OP_SUB:
+			fprintf(file,
+				"\ts%d = (int) ((unsigned) s%d - (unsigned) "
+				"s%d);\n",
+				d - 2, d - 2, d - 1);
+			break;
+		case OP_MUL:
+			fprintf(file,
+				"\ts%d = (int) ((unsigned) s%d * (unsigned) "
+				"s%d);\n",
+				d - 2, d - 2, d - 1);
+			break;
+		case OP_DIV:
+			fprintf(file, "\ts%d = s%d / s%d;\n", d - 2, d - 2,
+				d - 1);
+			break;
+		case OP_NEGATE:
+			fprintf(file, "\ts%d = (int) (0u - (unsigned) s%d);\n",
+				d - 1, d - 1);
+			break;
+		// The same sequences as divide_by_shift and
+		// divide_by_multiply in chunk.h.
+		case OP_SHIFT_LEFT:
+			fprintf(file, "\ts%d = (int) ((unsigned) s%d << %u);\n",
+				d - 1, d - 1, operands[0]);
+			break;
+		case OP_DIV_SHIFT:
+			fprintf(file,
+				"\ts%d = (int) ((unsigned) s%d + ((unsigned) "
+				"(s%d >> 31) >> %u)) >> %u;\n",
+				d - 1, d - 1, d - 1, 32 - operands[0],
+				operands[0]);
+			break;
+		case OP_DIV_MULTIPLY:
+			fprintf(file,
+				"\ts%d = (int) ((long long) s%d * %uu >> %u) + "
+				"(int) ((unsigned) s%d >> 31);\n",
+				d - 1, d - 1, operands[0], 32 + operands[1],
+				d - 1);
+			break;
+		case OP_EQUAL:
+		case OP_NOT_EQUAL:
+		case OP_LESS:
+		case OP_LESS_EQUAL:
+		case OP_GREATER:
+		case OP_GREATER_EQUAL:
+			fprintf(file, "\ts%d = s%d %s s%d ? %d : %d;\n", d - 2,
+				d - 2, comparison_operator(instruction->op_code),
+				d - 1, AQ_TRUE, AQ_FALSE);
+			break;
+		case OP_JUMP:
+			fprintf(file, "\tgoto L%d;\n", operands[0]);
+			break;
+		case OP_JUMP_IF_FALSE:
+			fprintf(file, "\tif (s%d == %d) goto L%d;\n", d - 1,
+				AQ_FALSE, operands[0]);
+			break;
+		case OP_JUMP_IF_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+		case OP_JUMP_IF_NOT_LESS:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			fprintf(file, "\tif (!(s%d %s s%d)) goto L%d;\n", d - 2,
+				comparison_operator(instruction->op_code), d - 1,
+				operands[0]);
+			break;
+		case OP_CALL: {
+			Function *f = transpiler->function_at[operands[0]];
+			int first = d - (int) operands[1];
+			fprintf(file, "\ts%d = ", first);
+			emit_function_name(transpiler, f);
+			emit_call_arguments(transpiler, first, operands[1]);
+			fprintf(file, ";\n");
+			break;
+		}
+		case OP_RETURN:
+			fprintf(file, "\treturn s%d;\n", d - 1);
+			break;
+		case OP_TAIL_CALL: {
+			Function *f = transpiler->function_at[operands[0]];
+			int first = d - (int) operands[1];
+			if (f != transpiler->function) {
+				fprintf(file, "\treturn ");
+				emit_function_name(transpiler, f);
+				emit_call_arguments(transpiler, first, operands[1]);
+				fprintf(file, ";\n");
+				break;
+			}
+			// Self recursion becomes a loop even when the C compiler
+			// does not eliminate sibling calls. The arguments sit
+			// above all locals, so they never overlap the parameters.
+			for (int i = 0; i < (int) operands[1]; i++) {
+				fprintf(file, "\ts%d = s%d;\n", i, first + i);
+			}
+			fprintf(file, "\tgoto L%d;\n", operands[0]);
+			break;
+		}
+		default:
+			fprintf(stderr, "Cannot emit C for opcode %s\n",
+				op_code_name(instruction->op_code));
+			exit(EXIT_FAILURE);
+	}
+}
+
+static void emit_call_arguments(Transpiler *transpiler, int first, int count) {
+	fprintf(transpiler->file, "(");
+	for (int i = 0; i < count; i++) {
+		fprintf(transpiler->file, "%ss%d", i > 0 ? ", " : "", first + i);
+	}
+	fprintf(transpiler->file, ")");
+}
+
+static void emit_function_name(Transpiler *transpiler, Function *f) {
+	// Aquila names are purely alphabetic, but nothing stops two functions
+	// from sharing one, so the chunk index keeps them apart.
+	fprintf(transpiler->file, "aq_%.*s_%d", f->name.length, f->name.start,
+		f->index);
+}
+
+static const char *comparison_operator(OpCode op_code) {
+	switch (op_code) {
+		case OP_EQUAL:
+		case OP_JUMP_IF_NOT_EQUAL:
+			return "==";
+		case OP_NOT_EQUAL:
+		case OP_JUMP_IF_EQUAL:
+			return "!=";
+		case OP_LESS:
+		case OP_JUMP_IF_NOT_LESS:
+			return "<";
+		case OP_LESS_EQUAL:
+		case OP_JUMP_IF_NOT_LESS_EQUAL:
+			return "<=";
+		case OP_GREATER:
+		case OP_JUMP_IF_NOT_GREATER:
+			return ">";
+		case OP_GREATER_EQUAL:
+		case OP_JUMP_IF_NOT_GREATER_EQUAL:
+			return ">=";
+		default:
+			return "?";
+	}
+}
+
+static int compare_functions(const void *a, const void *b) {
+	Function *f = *(Function **) a;
+	Function *g = *(Function **) b;
+	return f->index - g->index;
+}
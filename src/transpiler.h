@@ -0,0 +1,10 @@
+#ifndef TRANSPILER_H
+#define TRANSPILER_H
+
+#include "chunk.h"
+#include "function.h"
+#include <stdio.h>
+
+void emit_c(FILE *file, Chunk *chunk, FunctionList *flist);
+
+#endif
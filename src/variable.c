@@ -1,24 +1,28 @@
 #include "variable.h"
 #include <stdlib.h>
 
-void init_variable_stack(VariableStack *vs) {
-	vs->variables = malloc(256 * sizeof(Variable));
+static int *find_binding(VariableStack *vs, int symbol);
+static void pop_variable(VariableStack *vs);
+
+void init_variable_stack(VariableStack *vs, Arena *arena) {
+	vs->arena = arena;
+	vs->variables = arena_alloc(arena, 64 * sizeof(Variable));
 	vs->variable_count = 0;
+	vs->variable_capacity = 64;
 	vs->depth = 0;
+	vs->bindings = NULL;
+	vs->binding_capacity = 0;
 }
 
-void free_variable_stack(VariableStack *vs) {
-	free(vs->variables);
-}
-
+// Variables that are still being initialized cannot be referenced yet, so
+// the name resolves to whatever they shadow.
 int resolve_variable(VariableStack *vs, Token *name) {
-	for (int i = vs->variable_count - 1; i >= 0; --i) {
-		Variable *variable = &vs->variables[i];
-		if (token_equal(&variable->name, name)) {
-			if (variable->depth != -1) {
-				return i;
-			}
-		}
+	int i = *find_binding(vs, name->symbol);
+	while (i >= 0 && vs->variables[i].depth == -1) {
+		i = vs->variables[i].shadowed;
+	}
+	if (i >= 0) {
+		return i;
 	}
 
 	fprintf(stderr, "Undeclared variable: ");
@@ -38,30 +42,64 @@ int exit_block(VariableStack *vs) {
 	while (vs->variable_count > 0 &&
 	       vs->variables[vs->variable_count - 1].depth > vs->depth) {
 		pops++;
-		vs->variable_count--;
+		pop_variable(vs);
 	}
 	return pops;
 }
 
-void declare_variable(VariableStack *vs, Token name, Type type) {
-	for (int i = vs->variable_count - 1; i >= 0; --i) {
-		Variable *variable = &vs->variables[i];
-		if (vs->depth != -1 && variable->depth < vs->depth) {
-			break;
-		}
+// Forgets every variable, e.g. the parameters at the end of a function.
+void clear_variables(VariableStack *vs) {
+	while (vs->variable_count > 0) {
+		pop_variable(vs);
+	}
+}
 
-		if (token_equal(&name, &variable->name)) {
-			fprintf(stderr, "Variable already declared\n");
-			exit(EXIT_FAILURE);
-		}
+void declare_variable(VariableStack *vs, Token name, Type type) {
+	int *binding = find_binding(vs, name.symbol);
+	if (*binding >= 0 && vs->variables[*binding].depth == vs->depth) {
+		fprintf(stderr, "Variable already declared\n");
+		exit(EXIT_FAILURE);
 	}
 
-	Variable *variable = &vs->variables[vs->variable_count++];
+	if (vs->variable_count == vs->variable_capacity) {
+		vs->variables = arena_resize(
+		    vs->arena, vs->variables,
+		    vs->variable_capacity * sizeof(Variable),
+		    2 * vs->variable_capacity * sizeof(Variable));
+		vs->variable_capacity *= 2;
+	}
+	int index = vs->variable_count++;
+	Variable *variable = &vs->variables[index];
 	variable->name = name;
 	variable->type = type;
 	variable->depth = -1;
+	variable->shadowed = *binding;
+	*binding = index;
 }
 
 void mark_initializied(VariableStack *vs) {
 	vs->variables[vs->variable_count - 1].depth = vs->depth;
 }
+
+static int *find_binding(VariableStack *vs, int symbol) {
+	if (symbol >= vs->binding_capacity) {
+		int capacity =
+		    vs->binding_capacity > 0 ? vs->binding_capacity : 64;
+		while (capacity <= symbol) {
+			capacity *= 2;
+		}
+		vs->bindings = arena_resize(vs->arena, vs->bindings,
+					    vs->binding_capacity * sizeof(int),
+					    capacity * sizeof(int));
+		for (int i = vs->binding_capacity; i < capacity; i++) {
+			vs->bindings[i] = -1;
+		}
+		vs->binding_capacity = capacity;
+	}
+	return &vs->bindings[symbol];
+}
+
+static void pop_variable(VariableStack *vs) {
+	Variable *variable = &vs->variables[--vs->variable_count];
+	vs->bindings[variable->name.symbol] = variable->shadowed;
+}
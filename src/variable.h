@@ -1,6 +1,7 @@
 #ifndef VARIABLE_H
 #define VARIABLE_H
 
+#include "arena.h"
 #include "token.h"
 #include "type.h"
 
@@ -8,19 +9,29 @@ typedef struct Variable {
 	Token name;
 	Type type;
 	int depth;
+	// Index of the variable with the same name that this one shadows, or
+	// -1.
+	int shadowed;
 } Variable;
 
 typedef struct VariableStack {
 	Variable *variables;
 	int variable_count;
+	int variable_capacity;
 	int depth;
+
+	// Index of the innermost variable for every interned name, or -1.
+	int *bindings;
+	int binding_capacity;
+
+	Arena *arena;
 } VariableStack;
 
-void init_variable_stack(VariableStack *vs);
-void free_variable_stack(VariableStack *vs);
+void init_variable_stack(VariableStack *vs, Arena *arena);
 
 void enter_block(VariableStack *vs);
 int exit_block(VariableStack *vs);
+void clear_variables(VariableStack *vs);
 void declare_variable(VariableStack *vs, Token name, Type type);
 int resolve_variable(VariableStack *vs, Token *name);
 void mark_initializied(VariableStack *vs);
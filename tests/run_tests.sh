@@ -1,9 +1,34 @@
 #!/bin/bash
+# Any arguments are passed on to aquila, e.g. run_tests.sh --jit.
+# run_tests.sh --emit-c translates every test to C, builds it with cc and
+# runs the resulting binary instead, and run_tests.sh --aqc compiles every
+# test to an .aqc file and runs that.
 cd $(dirname $0)
 
+run() {
+    local name=$1
+    shift
+    if [ "$1" = "--emit-c" ]; then
+        shift
+        ../src/aquila "./$name" --emit-c "$@" > "$name.c" &&
+            ${CC:-cc} -O2 -w -o "$name.bin" "$name.c" &&
+            "./$name.bin"
+        rm -f "$name.c" "$name.bin"
+    elif [ "$1" = "--aqc" ]; then
+        shift
+        ../src/aquila "./$name" -o "${name}c" "$@" &&
+            ../src/aquila "./${name}c" "$@"
+        rm -f "${name}c"
+    else
+        ../src/aquila "./$name" "$@"
+    fi
+}
+
+status=0
 for name in *.aq
 do
-    ../src/aquila "./$name" > "$name.out"
-    diff -s "${name%.aq}.ref" "$name.out"
+    run "$name" "$@" > "$name.out"
+    diff -s "${name%.aq}.ref" "$name.out" || status=1
     rm -f "$name.out"
 done
+exit $status